@@ -0,0 +1,1676 @@
+// SPDX-License-Identifier: MIT
+// myring consumer benchmarks
+// - builds an in-memory ring (same ctrl page + data layout as /dev/myring)
+//   filled with records shaped like the synthetic producer's
+// - runs one benchmark mode and prints ns/record and records/s, plus
+//   hardware counters per record where perf_event_open allows
+//
+// Usage: bench <mode> [options]
+//   soa       record-at-a-time drain vs. SoA batch decode + column loops
+//   prefetch  drain a ring larger than the LLC at several prefetch distances
+//   slot      framed records vs. slot mode: drain, indexed with exact
+//             prefetch, and a slot range split across threads
+//   merge     k rings read back ring by ring vs. in global ts_ns order
+//   spsc      producer/consumer threads: shared-line vs. cached vs. padded
+//             vs. batched cursors
+//   selftest  the module's in-kernel loopback throughput per record size
+//   inject    user consumer fed by MYRING_IOC_INJECT at a chosen rate and mix
+//   flip      copy vs. zero-copy page flip per record size, and the crossover
+//   ipc       user producer process -> consumer process through the ring,
+//             against a pipe and a Unix socket
+//   sketch    drain cost with and without a heavy-hitter sketch, and its
+//             top-k against exact counts
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <linux/perf_event.h>
+
+#include "myring_uapi.h"
+#include "myring_consumer.h"
+
+#define BENCH_PAGE_SIZE 4096
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Allocate ctrl page + 2^order data bytes, page aligned like the kernel's. */
+static void *bench_ring_alloc(unsigned order)
+{
+  size_t len = BENCH_PAGE_SIZE + (1ull << order);
+  void *map = aligned_alloc(BENCH_PAGE_SIZE, len);
+  if (!map) { perror("aligned_alloc"); exit(1); }
+  memset(map, 0, len);
+  struct myring_ctrl *ctrl = map;
+  ctrl->size = 1ull << order;
+  ctrl->hi_pct = 50;
+  ctrl->lo_pct = 30;
+  return map;
+}
+
+/* Producer-side write, mirroring myring_write_bytes() in the module. */
+static void bench_ring_write(void *map, uint64_t pos, const void *src, uint64_t len)
+{
+  struct myring_ctrl *ctrl = map;
+  uint8_t *data = (uint8_t *)map + BENCH_PAGE_SIZE;
+  uint64_t off = pos & (ctrl->size - 1);
+  uint64_t first = len < ctrl->size - off ? len : ctrl->size - off;
+  memcpy(data + off, src, first);
+  if (len > first) memcpy(data, (const uint8_t *)src + first, len - first);
+}
+
+/* Fill the ring with PKT records (payload: ts, seq, pattern, like
+   myring_prod_fn) until less than one record fits. Payload lengths are
+   uniform in [min_len, max_len] (pass equal values for fixed-size
+   records). Returns the record count. Every 64th record is a DROP record
+   to keep the type mix honest. */
+static uint64_t bench_ring_fill(void *map, uint32_t min_len, uint32_t max_len)
+{
+  struct myring_ctrl *ctrl = map;
+  static uint8_t buf[65536];
+  uint64_t pos = 0, n = 0;
+  uint32_t rng = 12345;
+  if (min_len < 16) min_len = 16;
+  if (max_len > sizeof(buf)) max_len = sizeof(buf);
+  if (max_len < min_len) max_len = min_len;
+
+  for (;;) {
+    rng = rng * 1103515245u + 12345u;
+    uint32_t len = min_len + (rng >> 8) % (max_len - min_len + 1);
+    struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = len, .ts_ns = 1000 + n * 500 };
+    if (n % 64 == 63) {
+      struct myring_rec_drop drop = { .lost = (uint32_t)(n % 7), .start_ns = hdr.ts_ns, .end_ns = hdr.ts_ns + 10 };
+      hdr.type = REC_TYPE_DROP;
+      hdr.len = len = sizeof(drop);
+      memcpy(buf, &drop, sizeof(drop));
+    } else {
+      uint64_t seq = n + 1;
+      memcpy(buf, &hdr.ts_ns, 8);
+      memcpy(buf + 8, &seq, 8);
+      for (uint32_t i = 16; i < len; i++) buf[i] = (uint8_t)(seq + i);
+    }
+    if (pos + sizeof(hdr) + len > ctrl->size) break;
+    bench_ring_write(map, pos, &hdr, sizeof(hdr));
+    bench_ring_write(map, pos + sizeof(hdr), buf, len);
+    pos += sizeof(hdr) + len;
+    n++;
+  }
+  myring_store_release(&ctrl->head, pos);
+  return n;
+}
+
+static void bench_report(const char *name, uint64_t records, uint64_t ns, uint64_t check)
+{
+  printf("%-28s %10" PRIu64 " rec  %8.2f ns/rec  %8.2f Mrec/s  (check=%" PRIu64 ")\n",
+         name, records, records ? (double)ns / records : 0.0,
+         ns ? records * 1e3 / ns : 0.0, check);
+}
+
+/* --- hardware counters ---
+   perf_event_open counters for the calling thread, user space only. Each
+   event is opened on its own so a counter the PMU (or perf_event_paranoid)
+   refuses just drops out of the report. Values are scaled for
+   multiplexing. */
+
+struct bench_pmu_event {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+};
+
+#define BENCH_CACHE_READ_MISS(cache) \
+  ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct bench_pmu_event pmu_events[] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instr", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "l1d-miss", PERF_TYPE_HW_CACHE, BENCH_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+  { "llc-miss", PERF_TYPE_HW_CACHE, BENCH_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+#ifdef __aarch64__
+  { "bus-access", PERF_TYPE_RAW, 0x19 },  /* ARMv8 PMU BUS_ACCESS */
+#endif
+};
+
+#define BENCH_PMU_N (sizeof(pmu_events) / sizeof(pmu_events[0]))
+
+struct bench_pmu {
+  int fd[BENCH_PMU_N];
+  double val[BENCH_PMU_N];
+};
+
+static void bench_pmu_open(struct bench_pmu *p)
+{
+  static unsigned warned;  /* one message per event per run */
+
+  for (size_t i = 0; i < BENCH_PMU_N; i++) {
+    struct perf_event_attr attr = {
+      .size = sizeof(attr),
+      .type = pmu_events[i].type,
+      .config = pmu_events[i].config,
+      .disabled = 1,
+      .exclude_kernel = 1,
+      .exclude_hv = 1,
+      .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+    };
+    p->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    p->val[i] = 0;
+    if (p->fd[i] < 0 && !(__atomic_fetch_or(&warned, 1u << i, __ATOMIC_RELAXED) & (1u << i)))
+      fprintf(stderr, "bench: %s counter unavailable: %s\n", pmu_events[i].name, strerror(errno));
+  }
+}
+
+static void bench_pmu_close(struct bench_pmu *p)
+{
+  for (size_t i = 0; i < BENCH_PMU_N; i++)
+    if (p->fd[i] >= 0) close(p->fd[i]);
+}
+
+static void bench_pmu_ctl(struct bench_pmu *p, unsigned long op)
+{
+  for (size_t i = 0; i < BENCH_PMU_N; i++)
+    if (p->fd[i] >= 0) ioctl(p->fd[i], op, 0);
+}
+
+/* reset to zero; start/stop may then bracket several timed regions */
+static void bench_pmu_reset(struct bench_pmu *p) { bench_pmu_ctl(p, PERF_EVENT_IOC_RESET); }
+static void bench_pmu_start(struct bench_pmu *p) { bench_pmu_ctl(p, PERF_EVENT_IOC_ENABLE); }
+static void bench_pmu_stop(struct bench_pmu *p) { bench_pmu_ctl(p, PERF_EVENT_IOC_DISABLE); }
+
+static void bench_pmu_read(struct bench_pmu *p)
+{
+  for (size_t i = 0; i < BENCH_PMU_N; i++) {
+    uint64_t v[3];  /* value, time enabled, time running */
+    p->val[i] = -1;
+    if (p->fd[i] < 0 || read(p->fd[i], v, sizeof(v)) != sizeof(v)) continue;
+    p->val[i] = v[2] ? (double)v[0] * v[1] / v[2] : 0;
+  }
+}
+
+/* One line of per-record counts under a bench_report() line */
+static void bench_pmu_report(const char *who, const struct bench_pmu *p, uint64_t records)
+{
+  char line[256];
+  int len = 0;
+
+  if (!records) return;
+  for (size_t i = 0; i < BENCH_PMU_N; i++) {
+    if (p->val[i] < 0) continue;
+    len += snprintf(line + len, sizeof(line) - len, "  %7.2f %s", p->val[i] / records, pmu_events[i].name);
+  }
+  if (p->val[0] > 0 && p->val[1] >= 0)
+    len += snprintf(line + len, sizeof(line) - len, "  ipc %.2f", p->val[1] / p->val[0]);
+  if (len) printf("  %-26s per rec:%s\n", who, line);
+}
+
+/* --- soa: same analytics query both ways ---
+   query: over PKT records with seq (payload u64 #1) divisible by 4, count
+   them and sum len and ts. */
+
+struct soa_acc {
+  uint64_t count;
+  uint64_t sum_len;
+  uint64_t sum_ts;
+};
+
+static int soa_on_pkt(void *ctx, const struct myring_rec *rec)
+{
+  struct soa_acc *a = ctx;
+  uint64_t seq;
+  if (rec->hdr->len < 16) return 0;
+  memcpy(&seq, rec->payload + 8, sizeof(seq));
+  if ((seq & 3) == 0) {
+    a->count++;
+    a->sum_len += rec->hdr->len;
+    a->sum_ts += rec->hdr->ts_ns;
+  }
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(soa_drain, .on_pkt = soa_on_pkt)
+
+/* Column loop: branch-free so the compiler can vectorize it. */
+static void soa_query_batch(const struct myring_batch *b, struct soa_acc *a)
+{
+  const uint16_t *type = b->type;
+  const uint32_t *len = b->len;
+  const uint64_t *ts = b->ts_ns;
+  const uint64_t *seq = b->field[0];
+  uint64_t count = 0, sum_len = 0, sum_ts = 0;
+
+  for (size_t i = 0; i < b->n; i++) {
+    uint64_t m = (uint64_t)0 - (uint64_t)(type[i] == REC_TYPE_PKT && (seq[i] & 3) == 0);
+    count += m & 1;
+    sum_len += m & len[i];
+    sum_ts += m & ts[i];
+  }
+  a->count += count;
+  a->sum_len += sum_len;
+  a->sum_ts += sum_ts;
+}
+
+static int bench_soa(int argc, char **argv)
+{
+  unsigned order = 24;
+  uint32_t payload = 256;
+  unsigned reps = 20;
+  size_t batch = 256;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:p:r:b:")) != -1) {
+    switch (opt) {
+      case 'o': order = (unsigned)atoi(optarg); break;
+      case 'p': payload = (uint32_t)atoi(optarg); break;
+      case 'r': reps = (unsigned)atoi(optarg); break;
+      case 'b': batch = (size_t)atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: bench soa [-o ring_order] [-p payload] [-r reps] [-b batch]\n");
+        return 2;
+    }
+  }
+
+  void *map = bench_ring_alloc(order);
+  uint64_t nrec = bench_ring_fill(map, payload, payload);
+  struct myring_consumer c;
+  myring_consumer_attach(&c, map, BENCH_PAGE_SIZE);
+  printf("soa: ring=%" PRIu64 " bytes, %" PRIu64 " records of %u bytes, batch=%zu, reps=%u\n",
+         c.size, nrec, payload, batch, reps);
+
+  /* record-at-a-time */
+  struct bench_pmu pmu_rec, pmu_soa;
+  bench_pmu_open(&pmu_rec);
+  bench_pmu_open(&pmu_soa);
+
+  struct soa_acc a1 = {0};
+  bench_pmu_reset(&pmu_rec);
+  bench_pmu_start(&pmu_rec);
+  uint64_t t0 = now_ns();
+  for (unsigned r = 0; r < reps; r++) {
+    c.tail = 0;
+    soa_drain(&c, &a1, 0);
+  }
+  uint64_t t_rec = now_ns() - t0;
+  bench_pmu_stop(&pmu_rec);
+  bench_pmu_read(&pmu_rec);
+
+  /* SoA: decode a batch, then run the query over columns */
+  struct myring_batch b;
+  uint32_t field_off[] = { 8 };
+  if (myring_batch_init(&b, batch, field_off, 1) != 0) { perror("myring_batch_init"); return 1; }
+  struct soa_acc a2 = {0};
+  bench_pmu_reset(&pmu_soa);
+  bench_pmu_start(&pmu_soa);
+  t0 = now_ns();
+  for (unsigned r = 0; r < reps; r++) {
+    c.tail = 0;
+    while (myring_decode_batch(&c, &b) > 0)
+      soa_query_batch(&b, &a2);
+  }
+  uint64_t t_soa = now_ns() - t0;
+  bench_pmu_stop(&pmu_soa);
+  bench_pmu_read(&pmu_soa);
+
+  bench_report("record-at-a-time", nrec * reps, t_rec, a1.count + a1.sum_len + a1.sum_ts);
+  bench_pmu_report("consumer", &pmu_rec, nrec * reps);
+  bench_report("soa decode+columns", nrec * reps, t_soa, a2.count + a2.sum_len + a2.sum_ts);
+  bench_pmu_report("consumer", &pmu_soa, nrec * reps);
+  bench_pmu_close(&pmu_rec);
+  bench_pmu_close(&pmu_soa);
+  if (a1.count != a2.count || a1.sum_len != a2.sum_len || a1.sum_ts != a2.sum_ts) {
+    fprintf(stderr, "soa: result mismatch\n");
+    return 1;
+  }
+
+  /* columns only: the same batches queried again, i.e. the analytics cost
+     once the decode is amortised over several queries */
+  uint64_t t_cols = 0, rows = 0;
+  struct soa_acc a3 = {0};
+  c.tail = 0;
+  while (myring_decode_batch(&c, &b) > 0) {
+    t0 = now_ns();
+    for (unsigned r = 0; r < reps; r++) soa_query_batch(&b, &a3);
+    t_cols += now_ns() - t0;
+    rows += b.n * reps;
+  }
+  bench_report("soa columns only", rows, t_cols, a3.count);
+
+  myring_batch_free(&b);
+  myring_consumer_close(&c);
+  free(map);
+  return 0;
+}
+
+/* --- prefetch: sequential drain of a ring larger than the LLC ---
+   The handler reads the header, the seq field and the last payload byte,
+   so every record's lines are actually touched. */
+
+static int pf_on_pkt(void *ctx, const struct myring_rec *rec)
+{
+  uint64_t *sum = ctx;
+  uint64_t seq;
+  memcpy(&seq, rec->payload + 8, sizeof(seq));
+  *sum += seq + rec->payload[rec->hdr->len - 1];
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(pf_drain, .on_pkt = pf_on_pkt)
+
+static int bench_prefetch(int argc, char **argv)
+{
+  unsigned order = 28;
+  uint32_t min_len = 16, max_len = 1024;
+  unsigned reps = 3;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:l:L:r:")) != -1) {
+    switch (opt) {
+      case 'o': order = (unsigned)atoi(optarg); break;
+      case 'l': min_len = (uint32_t)atoi(optarg); break;
+      case 'L': max_len = (uint32_t)atoi(optarg); break;
+      case 'r': reps = (unsigned)atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: bench prefetch [-o ring_order] [-l min_len] [-L max_len] [-r reps]\n");
+        return 2;
+    }
+  }
+
+  void *map = bench_ring_alloc(order);
+  uint64_t nrec = bench_ring_fill(map, min_len, max_len);
+  struct myring_consumer c;
+  myring_consumer_attach(&c, map, BENCH_PAGE_SIZE);
+  printf("prefetch: ring=%" PRIu64 " MB, %" PRIu64 " records of %u..%u bytes, reps=%u\n",
+         c.size >> 20, nrec, min_len, max_len, reps);
+
+  struct bench_pmu pmu;
+  bench_pmu_open(&pmu);
+  static const unsigned dist[] = { 0, 1, 2, 4, 8, 16, 32, 64 };
+  for (size_t i = 0; i < sizeof(dist) / sizeof(dist[0]); i++) {
+    uint64_t sum = 0, ns = 0;
+    bench_pmu_reset(&pmu);
+    for (unsigned r = 0; r < reps; r++) {
+      c.tail = 0;
+      myring_consumer_set_prefetch(&c, dist[i]);
+      /* with ring > LLC the previous pass evicted the start, so this one runs cold */
+      bench_pmu_start(&pmu);
+      uint64_t t0 = now_ns();
+      pf_drain(&c, &sum, 0);
+      ns += now_ns() - t0;
+      bench_pmu_stop(&pmu);
+    }
+    bench_pmu_read(&pmu);
+    char name[32];
+    snprintf(name, sizeof(name), "prefetch %2u lines", dist[i]);
+    bench_report(name, nrec * reps, ns, sum);
+    bench_pmu_report("consumer", &pmu, nrec * reps);
+  }
+  bench_pmu_close(&pmu);
+  myring_consumer_close(&c);
+  free(map);
+  return 0;
+}
+
+/* --- slot: variable-length framing vs. fixed slots ---
+   The same records (fixed payload, every 64th a DROP) framed back to back
+   and in slot mode. Framed records are found one header at a time; slots
+   are addressed by index, so the next ones can be prefetched exactly and
+   a range can be split across threads. Every record is touched like in
+   prefetch mode: header, seq and last payload byte. */
+
+/* Fill every slot of a slot-mode ring; returns the slot count */
+static uint64_t bench_ring_fill_slots(void *map, uint32_t slot, uint32_t len)
+{
+  struct myring_ctrl *ctrl = map;
+  uint8_t *data = (uint8_t *)map + BENCH_PAGE_SIZE;
+  uint64_t n = ctrl->size / slot;
+
+  ctrl->slot_size = slot;
+  for (uint64_t i = 0; i < n; i++) {
+    struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = len, .ts_ns = 1000 + i * 500 };
+    uint8_t *p = data + i * slot + sizeof(hdr);
+    if (i % 64 == 63) {
+      struct myring_rec_drop drop = { .lost = (uint32_t)(i % 7), .start_ns = hdr.ts_ns, .end_ns = hdr.ts_ns + 10 };
+      hdr.type = REC_TYPE_DROP;
+      hdr.len = sizeof(drop);
+      memcpy(p, &drop, sizeof(drop));
+    } else {
+      uint64_t seq = i + 1;
+      memcpy(p, &hdr.ts_ns, 8);
+      memcpy(p + 8, &seq, 8);
+      for (uint32_t j = 16; j < len; j++) p[j] = (uint8_t)(seq + j);
+    }
+    memcpy(data + i * slot, &hdr, sizeof(hdr));
+  }
+  myring_store_release(&ctrl->head, n * slot);
+  return n;
+}
+
+/* Slots [first, first + n) past the consumer's tail, each slot's lines
+   prefetched ahead slots early (0 = off) */
+static uint64_t slot_scan(const struct myring_consumer *c, uint64_t first, uint64_t n, unsigned ahead)
+{
+  uint64_t sum = 0, end = first + n;
+
+  for (uint64_t i = first; i < end; i++) {
+    if (ahead && i + ahead < end) {
+      const uint8_t *p = (const uint8_t *)myring_slot(c, i + ahead);
+      for (uint32_t l = 0; l < c->slot_size; l += MYRING_CACHE_LINE)
+        __builtin_prefetch(p + l, 0, 3);
+    }
+    const struct myring_rec_hdr *h = myring_slot(c, i);
+    const uint8_t *pl = (const uint8_t *)(h + 1);
+    if (h->type == REC_TYPE_PKT) {
+      uint64_t seq;
+      memcpy(&seq, pl + 8, sizeof(seq));
+      sum += seq + pl[h->len - 1];
+    }
+  }
+  return sum;
+}
+
+struct slot_worker {
+  pthread_t tid;
+  const struct myring_consumer *c;
+  uint64_t first, n;
+  unsigned ahead;
+  uint64_t sum;
+};
+
+static void *slot_worker_fn(void *arg)
+{
+  struct slot_worker *w = arg;
+  w->sum = slot_scan(w->c, w->first, w->n, w->ahead);
+  return NULL;
+}
+
+static int bench_slot(int argc, char **argv)
+{
+  unsigned order = 28;
+  uint32_t payload = 240;
+  unsigned reps = 3, ahead = 4;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:p:r:a:t:")) != -1) {
+    switch (opt) {
+      case 'o': order = (unsigned)atoi(optarg); break;
+      case 'p': payload = (uint32_t)atoi(optarg); break;
+      case 'r': reps = (unsigned)atoi(optarg); break;
+      case 'a': ahead = (unsigned)atoi(optarg); break;
+      case 't': threads = atol(optarg); break;
+      default:
+        fprintf(stderr, "usage: bench slot [-o ring_order] [-p payload] [-r reps] [-a prefetch_slots] [-t threads]\n");
+        return 2;
+    }
+  }
+  if (payload < sizeof(struct myring_rec_drop)) payload = sizeof(struct myring_rec_drop);
+  if (threads < 1) threads = 1;
+  uint32_t slot = 64;
+  while (slot < sizeof(struct myring_rec_hdr) + payload) slot <<= 1;
+
+  void *fmap = bench_ring_alloc(order);
+  uint64_t fn = bench_ring_fill(fmap, payload, payload);
+  void *smap = bench_ring_alloc(order);
+  uint64_t sn = bench_ring_fill_slots(smap, slot, payload);
+  struct myring_consumer fc, sc;
+  myring_consumer_attach(&fc, fmap, BENCH_PAGE_SIZE);
+  myring_consumer_attach(&sc, smap, BENCH_PAGE_SIZE);
+  printf("slot: ring=%" PRIu64 " MB, %u-byte payloads, framed %" PRIu64 " records, %u-byte slots %" PRIu64
+         " records, reps=%u\n", fc.size >> 20, payload, fn, slot, sn, reps);
+
+  struct bench_pmu pmu;
+  bench_pmu_open(&pmu);
+  uint64_t sum, ns;
+
+  /* framed and slot rings through the same drain loop */
+  const struct { const char *name; struct myring_consumer *c; uint64_t n; } drains[] = {
+    { "framed drain", &fc, fn },
+    { "slot drain", &sc, sn },
+  };
+  for (size_t k = 0; k < sizeof(drains) / sizeof(drains[0]); k++) {
+    sum = ns = 0;
+    bench_pmu_reset(&pmu);
+    for (unsigned r = 0; r < reps; r++) {
+      drains[k].c->tail = 0;
+      bench_pmu_start(&pmu);
+      uint64_t t0 = now_ns();
+      pf_drain(drains[k].c, &sum, 0);
+      ns += now_ns() - t0;
+      bench_pmu_stop(&pmu);
+    }
+    bench_pmu_read(&pmu);
+    bench_report(drains[k].name, drains[k].n * reps, ns, sum);
+    bench_pmu_report("consumer", &pmu, drains[k].n * reps);
+  }
+
+  /* indexed, with and without exact prefetch */
+  sc.tail = 0;
+  for (unsigned pf = 0; pf <= 1; pf++) {
+    sum = ns = 0;
+    bench_pmu_reset(&pmu);
+    for (unsigned r = 0; r < reps; r++) {
+      bench_pmu_start(&pmu);
+      uint64_t t0 = now_ns();
+      sum += slot_scan(&sc, 0, myring_slots_ready(&sc), pf ? ahead : 0);
+      ns += now_ns() - t0;
+      bench_pmu_stop(&pmu);
+    }
+    bench_pmu_read(&pmu);
+    char name[32];
+    snprintf(name, sizeof(name), pf ? "slot index, prefetch %u" : "slot index", ahead);
+    bench_report(name, sn * reps, ns, sum);
+    bench_pmu_report("consumer", &pmu, sn * reps);
+  }
+  bench_pmu_close(&pmu);
+
+  /* indexed ranges split across threads */
+  struct slot_worker *w = calloc((size_t)threads, sizeof(*w));
+  if (!w) { perror("calloc"); return 1; }
+  sum = ns = 0;
+  for (unsigned r = 0; r < reps; r++) {
+    uint64_t t0 = now_ns();
+    for (long i = 0; i < threads; i++) {
+      w[i] = (struct slot_worker){ .c = &sc, .first = sn * i / threads,
+                                   .n = sn * (i + 1) / threads - sn * i / threads, .ahead = ahead };
+      if (pthread_create(&w[i].tid, NULL, slot_worker_fn, &w[i]) != 0) { perror("pthread_create"); return 1; }
+    }
+    for (long i = 0; i < threads; i++) {
+      pthread_join(w[i].tid, NULL);
+      sum += w[i].sum;
+    }
+    ns += now_ns() - t0;
+  }
+  char name[48];  /* "slot index, " + 20 digits + " threads" */
+  snprintf(name, sizeof(name), "slot index, %ld threads", threads);
+  bench_report(name, sn * reps, ns, sum);
+  myring_slots_consume(&sc, sn);
+
+  free(w);
+  myring_consumer_close(&fc);
+  myring_consumer_close(&sc);
+  free(fmap);
+  free(smap);
+  return 0;
+}
+
+/* --- merge: k rings read back in global ts_ns order ---
+   Records with increasing timestamps are dealt to -k rings at random (as
+   per-CPU routing would), each ring filled once; every repetition rewinds
+   the tails and reads all of them back, first ring by ring in no
+   particular order, then through the library's merge heap. The check
+   counts records handed out out of order, which must be 0. */
+
+static uint64_t merge_fill(void **maps, unsigned k, uint32_t len)
+{
+  uint64_t pos[MYRING_MERGE_MAX] = { 0 }, n = 0;
+  uint8_t buf[4096];
+  uint32_t rng = 12345;
+
+  for (;;) {
+    rng = rng * 1103515245u + 12345u;
+    unsigned r = (rng >> 8) % k;
+    struct myring_ctrl *ctrl = maps[r];
+    struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = len, .ts_ns = 1000 + n * 7 };
+    if (pos[r] + sizeof(hdr) + len > ctrl->size) break;
+    memset(buf, (int)n, len);
+    bench_ring_write(maps[r], pos[r], &hdr, sizeof(hdr));
+    bench_ring_write(maps[r], pos[r] + sizeof(hdr), buf, len);
+    pos[r] += sizeof(hdr) + len;
+    n++;
+  }
+  for (unsigned r = 0; r < k; r++) myring_store_release(&((struct myring_ctrl *)maps[r])->head, pos[r]);
+  return n;
+}
+
+static int merge_on_rec(void *ctx, const struct myring_rec *rec)
+{
+  *(uint64_t *)ctx += rec->payload[rec->hdr->len - 1];
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(merge_drain, .on_pkt = merge_on_rec)
+
+static int bench_merge(int argc, char **argv)
+{
+  char ks_buf[] = "2,4,8,16";
+  char *ks = ks_buf;
+  unsigned order = 22, reps = 5;
+  uint32_t len = 48;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "k:o:l:r:")) != -1) {
+    switch (opt) {
+      case 'k': ks = optarg; break;
+      case 'o': order = (unsigned)atoi(optarg); break;
+      case 'l': len = (uint32_t)atoi(optarg); break;
+      case 'r': reps = (unsigned)atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: bench merge [-k rings,rings,..] [-o ring_order] [-l payload_len] [-r reps]\n");
+        return 2;
+    }
+  }
+  if (!len || len > 4096 || order < 12 || !reps) {
+    fprintf(stderr, "merge: need 1 <= len <= 4096, ring_order >= 12, reps > 0\n");
+    return 2;
+  }
+  printf("merge: %u-byte rings, %u-byte payloads, %u reps\n", 1u << order, len, reps);
+
+  for (char *tok = strtok(ks, ","); tok; tok = strtok(NULL, ",")) {
+    unsigned k = (unsigned)atoi(tok);
+    if (!k || k > MYRING_MERGE_MAX) { fprintf(stderr, "merge: 1..%d rings\n", MYRING_MERGE_MAX); return 2; }
+
+    void *maps[MYRING_MERGE_MAX];
+    struct myring_consumer cons[MYRING_MERGE_MAX], *cp[MYRING_MERGE_MAX];
+    for (unsigned r = 0; r < k; r++) maps[r] = bench_ring_alloc(order);
+    uint64_t n = merge_fill(maps, k, len);
+
+    uint64_t ns_drain = 0, ns_merge = 0, sum_drain = 0, sum_merge = 0, late = 0;
+    for (unsigned rep = 0; rep < reps; rep++) {
+      for (unsigned r = 0; r < k; r++) {
+        ((struct myring_ctrl *)maps[r])->tail = 0;
+        myring_consumer_attach(&cons[r], maps[r], BENCH_PAGE_SIZE);
+        cons[r].tail = 0;
+      }
+      uint64_t t0 = now_ns();
+      for (unsigned r = 0; r < k; r++) {
+        merge_drain(&cons[r], &sum_drain, 0);
+        myring_consumer_commit(&cons[r]);
+      }
+      ns_drain += now_ns() - t0;
+
+      for (unsigned r = 0; r < k; r++) {
+        ((struct myring_ctrl *)maps[r])->tail = 0;
+        cons[r].tail = 0;
+        cp[r] = &cons[r];
+      }
+      struct myring_merge m;
+      struct myring_rec rec;
+      myring_merge_init(&m, cp, k, 0);
+      t0 = now_ns();
+      int ret;
+      while ((ret = myring_merge_next(&m, UINT64_MAX, &rec, NULL)) > 0)
+        sum_merge += rec.payload[rec.hdr->len - 1];
+      myring_merge_commit(&m);
+      ns_merge += now_ns() - t0;
+      if (ret < 0) { fprintf(stderr, "merge: decode error\n"); return 1; }
+      if (m.records != n) fprintf(stderr, "merge: %" PRIu64 " of %" PRIu64 " records\n", m.records, n);
+      late += m.late;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%2u rings, ring by ring", k);
+    bench_report(name, n * reps, ns_drain, sum_drain);
+    snprintf(name, sizeof(name), "%2u rings, ts merge", k);
+    bench_report(name, n * reps, ns_merge, sum_merge);
+    printf("  %-26s out of order: %" PRIu64 "\n", "", late);
+    for (unsigned r = 0; r < k; r++) free(maps[r]);
+  }
+  return 0;
+}
+
+/* --- spsc: cursor-protocol variants, producer and consumer threads ---
+   Same record format and head/tail protocol as the module, different
+   cursor handling:
+     shared-line   head and tail next to each other (the ctrl page layout),
+                   both sides re-read the other's cursor for every record
+     cached        each side keeps a private copy of the other's cursor and
+                   re-reads it only when the ring looks full / empty
+     cached+pad    as cached, head and tail on separate cache lines
+     cached+pad+batch  as cached+pad, cursors published every -b records
+   Compare the per-record miss counts, not just ns/rec. */
+
+struct spsc_variant {
+  const char *name;
+  bool cached;
+  bool padded;
+  bool batched;
+};
+
+static const struct spsc_variant spsc_variants[] = {
+  { "shared-line", false, false, false },
+  { "cached", true, false, false },
+  { "cached+pad", true, true, false },
+  { "cached+pad+batch", true, true, true },
+};
+
+struct spsc_run {
+  const struct spsc_variant *v;
+  uint8_t *data;
+  uint64_t size;
+  volatile uint64_t *head, *tail;
+  uint64_t records;
+  uint32_t payload;
+  unsigned batch;
+  int prod_cpu, cons_cpu;
+  volatile int ready;
+  uint64_t ns[2];             /* producer, consumer */
+  uint64_t check;
+  struct bench_pmu pmu[2];
+};
+
+static inline void spsc_relax(unsigned *spins)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield" ::: "memory");
+#endif
+  /* let the peer run when both threads share a CPU */
+  if (++*spins % 1024 == 0) sched_yield();
+}
+
+static void spsc_pin(int cpu)
+{
+  cpu_set_t set;
+  if (cpu < 0) return;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) perror("sched_setaffinity");
+}
+
+static void spsc_start_barrier(struct spsc_run *r)
+{
+  unsigned spins = 0;
+  __atomic_add_fetch(&r->ready, 1, __ATOMIC_ACQ_REL);
+  while (__atomic_load_n(&r->ready, __ATOMIC_ACQUIRE) < 2) spsc_relax(&spins);
+}
+
+static void spsc_read(const struct spsc_run *r, uint64_t pos, void *dst, uint64_t len)
+{
+  uint64_t off = pos & (r->size - 1);
+  uint64_t first = len < r->size - off ? len : r->size - off;
+  memcpy(dst, r->data + off, first);
+  if (len > first) memcpy((uint8_t *)dst + first, r->data, len - first);
+}
+
+static void spsc_write(struct spsc_run *r, uint64_t pos, const void *src, uint64_t len)
+{
+  uint64_t off = pos & (r->size - 1);
+  uint64_t first = len < r->size - off ? len : r->size - off;
+  memcpy(r->data + off, src, first);
+  if (len > first) memcpy(r->data, (const uint8_t *)src + first, len - first);
+}
+
+static void *spsc_producer(void *arg)
+{
+  struct spsc_run *r = arg;
+  const struct spsc_variant *v = r->v;
+  uint8_t rec[sizeof(struct myring_rec_hdr) + 65536];
+  struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = r->payload };
+  uint64_t need = sizeof(hdr) + r->payload;
+  uint64_t head = 0, tail_cache = 0;
+  unsigned pending = 0, spins = 0;
+  unsigned batch = v->batched ? r->batch : 1;
+
+  spsc_pin(r->prod_cpu);
+  bench_pmu_open(&r->pmu[0]);
+  memset(rec, 0x5a, sizeof(rec));
+  spsc_start_barrier(r);
+  bench_pmu_reset(&r->pmu[0]);
+  bench_pmu_start(&r->pmu[0]);
+  uint64_t t0 = now_ns();
+
+  for (uint64_t n = 0; n < r->records; n++) {
+    if (!v->cached) tail_cache = myring_load_acquire(r->tail);
+    while (r->size - (head - tail_cache) < need) {
+      /* never wait on the consumer while holding back records it could take */
+      if (pending) { myring_store_release(r->head, head); pending = 0; }
+      spsc_relax(&spins);
+      tail_cache = myring_load_acquire(r->tail);
+    }
+    hdr.ts_ns = n;
+    memcpy(rec, &hdr, sizeof(hdr));
+    memcpy(rec + sizeof(hdr), &n, sizeof(n));
+    spsc_write(r, head, rec, need);
+    head += need;
+    if (++pending >= batch) { myring_store_release(r->head, head); pending = 0; }
+  }
+  myring_store_release(r->head, head);
+
+  r->ns[0] = now_ns() - t0;
+  bench_pmu_stop(&r->pmu[0]);
+  bench_pmu_read(&r->pmu[0]);
+  bench_pmu_close(&r->pmu[0]);
+  return NULL;
+}
+
+static void *spsc_consumer(void *arg)
+{
+  struct spsc_run *r = arg;
+  const struct spsc_variant *v = r->v;
+  struct myring_rec_hdr hdr;
+  uint64_t tail = 0, head_cache = 0, sum = 0, seq;
+  unsigned pending = 0, spins = 0;
+  unsigned batch = v->batched ? r->batch : 1;
+
+  spsc_pin(r->cons_cpu);
+  bench_pmu_open(&r->pmu[1]);
+  spsc_start_barrier(r);
+  bench_pmu_reset(&r->pmu[1]);
+  bench_pmu_start(&r->pmu[1]);
+  uint64_t t0 = now_ns();
+
+  for (uint64_t n = 0; n < r->records; n++) {
+    if (!v->cached) head_cache = myring_load_acquire(r->head);
+    while (head_cache == tail) {
+      if (pending) { myring_store_release(r->tail, tail); pending = 0; }
+      spsc_relax(&spins);
+      head_cache = myring_load_acquire(r->head);
+    }
+    spsc_read(r, tail, &hdr, sizeof(hdr));
+    spsc_read(r, tail + sizeof(hdr), &seq, sizeof(seq));
+    sum += hdr.ts_ns + seq;
+    tail += sizeof(hdr) + hdr.len;
+    if (++pending >= batch) { myring_store_release(r->tail, tail); pending = 0; }
+  }
+  myring_store_release(r->tail, tail);
+
+  r->ns[1] = now_ns() - t0;
+  bench_pmu_stop(&r->pmu[1]);
+  bench_pmu_read(&r->pmu[1]);
+  bench_pmu_close(&r->pmu[1]);
+  r->check = sum;
+  return NULL;
+}
+
+static int bench_spsc(int argc, char **argv)
+{
+  unsigned order = 16;
+  uint32_t payload = 64;
+  uint64_t records = 10000000;
+  unsigned batch = 32;
+  int prod_cpu = 0, cons_cpu = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 1 : 0;
+  const char *only = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:p:n:b:P:C:v:")) != -1) {
+    switch (opt) {
+      case 'o': order = (unsigned)atoi(optarg); break;
+      case 'p': payload = (uint32_t)atoi(optarg); break;
+      case 'n': records = strtoull(optarg, NULL, 0); break;
+      case 'b': batch = (unsigned)atoi(optarg); break;
+      case 'P': prod_cpu = atoi(optarg); break;
+      case 'C': cons_cpu = atoi(optarg); break;
+      case 'v': only = optarg; break;
+      default:
+        fprintf(stderr, "usage: bench spsc [-o ring_order] [-p payload] [-n records] [-b batch]\n"
+                        "                  [-P prod_cpu] [-C cons_cpu] [-v variant]\n");
+        return 2;
+    }
+  }
+  if (payload < sizeof(uint64_t) || payload > 65536 || !batch ||
+      sizeof(struct myring_rec_hdr) + payload > (1ull << order)) {
+    fprintf(stderr, "spsc: payload must be 8..65536 bytes and fit the ring, batch > 0\n");
+    return 2;
+  }
+
+  /* cursors: head at 0, tail at 8 (shared line) or 128 (clear of the
+     adjacent-line prefetcher) */
+  uint64_t *cursors = aligned_alloc(128, 256);
+  uint8_t *data = aligned_alloc(BENCH_PAGE_SIZE, 1ull << order);
+  if (!cursors || !data) { perror("aligned_alloc"); return 1; }
+  memset(data, 0, 1ull << order);
+
+  printf("spsc: ring=%llu bytes, %" PRIu64 " records of %u bytes, batch=%u, cpus %d -> %d\n",
+         1ull << order, records, payload, batch, prod_cpu, cons_cpu);
+
+  for (size_t i = 0; i < sizeof(spsc_variants) / sizeof(spsc_variants[0]); i++) {
+    const struct spsc_variant *v = &spsc_variants[i];
+    if (only && strcmp(only, v->name) != 0) continue;
+
+    struct spsc_run r = {
+      .v = v, .data = data, .size = 1ull << order,
+      .head = &cursors[0], .tail = &cursors[v->padded ? 16 : 1],
+      .records = records, .payload = payload, .batch = batch,
+      .prod_cpu = prod_cpu, .cons_cpu = cons_cpu,
+    };
+    memset(cursors, 0, 256);
+    pthread_t tp, tc;
+    if (pthread_create(&tc, NULL, spsc_consumer, &r) != 0 ||
+        pthread_create(&tp, NULL, spsc_producer, &r) != 0) {
+      perror("pthread_create");
+      return 1;
+    }
+    pthread_join(tp, NULL);
+    pthread_join(tc, NULL);
+
+    bench_report(v->name, records, r.ns[0] > r.ns[1] ? r.ns[0] : r.ns[1], r.check);
+    bench_pmu_report("producer", &r.pmu[0], records);
+    bench_pmu_report("consumer", &r.pmu[1], records);
+  }
+  free(cursors);
+  free(data);
+  return 0;
+}
+
+/* --- selftest: the module's in-kernel loopback ceiling ---
+   MYRING_IOC_SELFTEST per record size; the upper bound a user-space
+   consumer of the same ring can be held against. Resets the ring. */
+
+static int bench_selftest(int argc, char **argv)
+{
+  const char *dev = "/dev/myring";
+  char sizes_buf[] = "16,64,256,1024,4096,16384,65536";
+  char *sizes = sizes_buf;
+  struct myring_selftest st = { .prod_cpu = 0, .cons_cpu = 1, .duration_ms = 1000 };
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:s:P:C:t:")) != -1) {
+    switch (opt) {
+      case 'd': dev = optarg; break;
+      case 's': sizes = optarg; break;
+      case 'P': st.prod_cpu = (uint32_t)atoi(optarg); break;
+      case 'C': st.cons_cpu = (uint32_t)atoi(optarg); break;
+      case 't': st.duration_ms = (uint32_t)atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: bench selftest [-d dev] [-s size,size,..] [-P prod_cpu] [-C cons_cpu]\n"
+                        "                      [-t duration_ms]\n");
+        return 2;
+    }
+  }
+
+  int fd = open(dev, O_RDWR | O_CLOEXEC);
+  if (fd < 0) { fprintf(stderr, "selftest: open %s: %s\n", dev, strerror(errno)); return 1; }
+  printf("selftest: %s, cpus %u -> %u, %u ms per size\n", dev, st.prod_cpu, st.cons_cpu, st.duration_ms);
+
+  for (char *tok = strtok(sizes, ","); tok; tok = strtok(NULL, ",")) {
+    st.rec_size = (uint32_t)atoi(tok);
+    if (ioctl(fd, MYRING_IOC_SELFTEST, &st) != 0) {
+      fprintf(stderr, "selftest: rec_size=%u: %s\n", st.rec_size, strerror(errno));
+      close(fd);
+      return 1;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "kernel loopback %5u B", st.rec_size);
+    bench_report(name, st.records, st.ns, st.bytes);
+    printf("  %-26s %8.2f GB/s\n", "", st.ns ? (double)st.bytes / st.ns : 0.0);
+  }
+  close(fd);
+  return 0;
+}
+
+/* --- inject: user consumer throughput fed by MYRING_IOC_INJECT ---
+   An injector thread pushes pre-built records (uniform [-l, -L] payload
+   lengths) through the module's enqueue path at -r records/s (0 = as
+   fast as possible), -b records per ioctl, every -u'th one flagged
+   REC_FLAG_URGENT; this thread drains the ring with the library like
+   user.c does, committing once per drain. */
+
+struct inject_run {
+  int fd;
+  uint8_t *buf;               /* one batch of records */
+  uint32_t buf_len, batch;
+  uint64_t records, rate;
+  uint64_t injected, dropped;
+  volatile bool done;
+};
+
+static uint32_t inject_build(uint8_t *buf, uint32_t nrec, uint32_t min_len, uint32_t max_len,
+                             uint32_t urgent_every)
+{
+  uint32_t rng = 12345, off = 0;
+  for (uint32_t n = 0; n < nrec; n++) {
+    rng = rng * 1103515245u + 12345u;
+    uint32_t len = min_len + (rng >> 8) % (max_len - min_len + 1);
+    struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = len };  /* ts 0: stamped by the module */
+    if (urgent_every && n % urgent_every == urgent_every - 1) hdr.flags = REC_FLAG_URGENT;
+    memcpy(buf + off, &hdr, sizeof(hdr));
+    memset(buf + off + sizeof(hdr), (int)n, len);
+    off += sizeof(hdr) + len;
+  }
+  return off;
+}
+
+static void *inject_thread(void *arg)
+{
+  struct inject_run *r = arg;
+  uint64_t t0 = now_ns();
+
+  while (r->injected + r->dropped < r->records) {
+    struct myring_inject inj = { .buf = (uintptr_t)r->buf, .len = r->buf_len };
+    if (ioctl(r->fd, MYRING_IOC_INJECT, &inj) != 0) { perror("MYRING_IOC_INJECT"); break; }
+    r->injected += inj.records;
+    r->dropped += inj.dropped;
+    if (r->rate) {
+      /* pace to rate on average; no catch-up bursts beyond one batch */
+      uint64_t due = t0 + (r->injected + r->dropped) * 1000000000ull / r->rate;
+      while (now_ns() < due) ;
+    }
+  }
+  __atomic_store_n(&r->done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static int inject_on_rec(void *ctx, const struct myring_rec *rec)
+{
+  uint64_t *sum = ctx;
+  *sum += rec->payload[rec->hdr->len - 1];
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(inject_drain, .on_pkt = inject_on_rec)
+
+static int bench_inject(int argc, char **argv)
+{
+  const char *dev = "/dev/myring";
+  uint32_t min_len = 64, max_len = 1024, urgent_every = 0;
+  struct inject_run r = { .records = 10000000, .batch = 256 };
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:l:L:n:r:b:u:")) != -1) {
+    switch (opt) {
+      case 'd': dev = optarg; break;
+      case 'l': min_len = (uint32_t)atoi(optarg); break;
+      case 'L': max_len = (uint32_t)atoi(optarg); break;
+      case 'n': r.records = strtoull(optarg, NULL, 0); break;
+      case 'r': r.rate = strtoull(optarg, NULL, 0); break;
+      case 'b': r.batch = (uint32_t)atoi(optarg); break;
+      case 'u': urgent_every = (uint32_t)atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: bench inject [-d dev] [-l min_len] [-L max_len] [-n records]\n"
+                        "                    [-r records_per_s] [-b records_per_ioctl] [-u urgent_every]\n");
+        return 2;
+    }
+  }
+  if (!min_len || max_len < min_len || max_len > MYRING_INJECT_MAX_PAYLOAD || !r.batch) {
+    fprintf(stderr, "inject: need 1 <= min_len <= max_len <= %u, batch > 0\n", MYRING_INJECT_MAX_PAYLOAD);
+    return 2;
+  }
+
+  struct myring_consumer c;
+  if (myring_consumer_open(&c, dev) != 0) {
+    fprintf(stderr, "inject: open %s: %s\n", dev, strerror(errno));
+    return 1;
+  }
+  r.fd = c.fd;
+  r.buf = malloc((size_t)r.batch * (sizeof(struct myring_rec_hdr) + max_len));
+  if (!r.buf) { perror("malloc"); return 1; }
+  r.buf_len = inject_build(r.buf, r.batch, min_len, max_len, urgent_every);
+
+  /* start from an empty ring */
+  c.tail = myring_load_acquire(&c.ctrl->head);
+  myring_consumer_commit(&c);
+  struct myring_stats st0, st1;
+  ioctl(c.fd, MYRING_IOC_GET_STATS, &st0);
+
+  printf("inject: %s ring=%" PRIu64 " bytes, %" PRIu64 " records of %u..%u bytes, %u per ioctl, rate %s\n",
+         dev, c.size, r.records, min_len, max_len, r.batch, r.rate ? "paced" : "max");
+
+  pthread_t t;
+  uint64_t sum = 0, consumed = 0, t0 = now_ns();
+  if (pthread_create(&t, NULL, inject_thread, &r) != 0) { perror("pthread_create"); return 1; }
+  for (;;) {
+    bool done = __atomic_load_n(&r.done, __ATOMIC_ACQUIRE);
+    if (myring_load_acquire(&c.ctrl->head) == c.tail) {
+      if (done) break;
+      continue;
+    }
+    long n = inject_drain(&c, &sum, 0);
+    if (n < 0) { perror("inject: drain"); break; }
+    consumed += (uint64_t)n;
+    myring_consumer_commit(&c);
+  }
+  uint64_t ns = now_ns() - t0;
+  pthread_join(t, NULL);
+  ioctl(c.fd, MYRING_IOC_GET_STATS, &st1);
+
+  bench_report("inject -> consumer", consumed, ns, sum);
+  printf("  injected %" PRIu64 ", dropped %" PRIu64 " (ring full), module drops +%" PRIu64 "\n",
+         r.injected, r.dropped, (uint64_t)(st1.drops - st0.drops));
+  free(r.buf);
+  myring_consumer_close(&c);
+  return 0;
+}
+
+/* --- flip: copy vs. zero-copy page flip, per record size ---
+   MYRING_IOC_PAGES fills a page per record in the kernel and either copies
+   it into the ring or flips it into a slot (module loaded with flip_pages>0,
+   and a low rate_hz so the synthetic producer stays out of the way). This
+   thread drains and reads every cache line of each payload, so both modes
+   pay for getting the bytes to the consumer; the flip side pays a fault per
+   record instead of a copy. Prints the size where flipping starts to win. */
+
+struct flip_run {
+  int fd;
+  struct myring_pages pg;
+  int ret;
+  int cpu;
+  volatile bool done;
+};
+
+static void *flip_thread(void *arg)
+{
+  struct flip_run *r = arg;
+  spsc_pin(r->cpu);
+  r->ret = ioctl(r->fd, MYRING_IOC_PAGES, &r->pg) != 0 ? errno : 0;
+  __atomic_store_n(&r->done, true, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static uint64_t flip_touch(const uint8_t *p, uint32_t len)
+{
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < len; i += 64) sum += p[i];
+  return sum + p[len - 1];
+}
+
+static int flip_on_pkt(void *ctx, const struct myring_rec *rec)
+{
+  *(uint64_t *)ctx += flip_touch(rec->payload, rec->hdr->len);
+  return 0;
+}
+
+struct flip_ctx {
+  const struct myring_consumer *c;
+  uint64_t sum;
+};
+
+static int flip_on_page(void *ctx, const struct myring_rec *rec)
+{
+  struct flip_ctx *f = ctx;
+  uint32_t len;
+  const uint8_t *p = myring_page_data(f->c, rec, &len);
+  f->sum += flip_touch(p, len);
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(flip_drain_copy, .on_pkt = flip_on_pkt)
+MYRING_DEFINE_DRAIN(flip_drain_page, .on_page = flip_on_page)
+
+/* one run of count records of len bytes; returns consumer ns, 0 on error */
+static uint64_t flip_run_one(struct myring_consumer *c, int prod_cpu, uint32_t len,
+                             uint32_t count, bool flip, uint64_t *sum)
+{
+  struct flip_run r = {
+    .fd = c->fd, .cpu = prod_cpu,
+    .pg = { .len = len, .count = count, .flags = flip ? MYRING_PAGES_FLIP : 0 },
+  };
+  struct flip_ctx f = { .c = c };
+  uint64_t consumed = 0;
+
+  c->tail = myring_load_acquire(&c->ctrl->head);
+  myring_consumer_commit(c);
+
+  pthread_t t;
+  uint64_t t0 = now_ns();
+  if (pthread_create(&t, NULL, flip_thread, &r) != 0) { perror("pthread_create"); return 0; }
+  for (;;) {
+    bool done = __atomic_load_n(&r.done, __ATOMIC_ACQUIRE);
+    if (myring_load_acquire(&c->ctrl->head) == c->tail) {
+      if (done) break;
+      continue;
+    }
+    long n = flip ? flip_drain_page(c, &f, 0) : flip_drain_copy(c, &f.sum, 0);
+    if (n < 0) { perror("flip: drain"); break; }
+    consumed += (uint64_t)n;
+    myring_consumer_commit(c);
+  }
+  uint64_t ns = now_ns() - t0;
+  pthread_join(t, NULL);
+  if (r.ret) {
+    fprintf(stderr, "flip: MYRING_IOC_PAGES len=%u%s: %s\n", len, flip ? " flip" : "", strerror(r.ret));
+    return 0;
+  }
+  if (consumed != r.pg.records)
+    fprintf(stderr, "flip: produced %u, consumed %" PRIu64 " (other records in the ring?)\n",
+            r.pg.records, consumed);
+  *sum = f.sum;
+  return ns;
+}
+
+static int bench_flip(int argc, char **argv)
+{
+  const char *dev = "/dev/myring";
+  char sizes_buf[] = "256,512,1024,2048,4096";
+  char *sizes = sizes_buf;
+  uint32_t count = 1000000;
+  int prod_cpu = 0, cons_cpu = 1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:n:s:P:C:")) != -1) {
+    switch (opt) {
+      case 'd': dev = optarg; break;
+      case 'n': count = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 's': sizes = optarg; break;
+      case 'P': prod_cpu = atoi(optarg); break;
+      case 'C': cons_cpu = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: bench flip [-d dev] [-n records] [-s size,size,..] [-P prod_cpu] [-C cons_cpu]\n");
+        return 2;
+    }
+  }
+
+  struct myring_consumer c;
+  if (myring_consumer_open(&c, dev) != 0) {
+    fprintf(stderr, "flip: open %s: %s\n", dev, strerror(errno));
+    return 1;
+  }
+  if (!c.flip) {
+    fprintf(stderr, "flip: %s has no flip slots (load the module with flip_pages=N)\n", dev);
+    myring_consumer_close(&c);
+    return 1;
+  }
+  spsc_pin(cons_cpu);
+  printf("flip: %s ring=%" PRIu64 " bytes, %u flip slots, %u records per size, cpus %d -> %d\n",
+         dev, c.size, c.ctrl->flip_pages, count, prod_cpu, cons_cpu);
+
+  uint32_t crossover = 0;
+  for (char *tok = strtok(sizes, ","); tok; tok = strtok(NULL, ",")) {
+    uint32_t len = (uint32_t)atoi(tok);
+    uint64_t ns[2], sum[2];
+    for (int m = 0; m < 2; m++) {
+      ns[m] = flip_run_one(&c, prod_cpu, len, count, m == 1, &sum[m]);
+      if (!ns[m]) { myring_consumer_close(&c); return 1; }
+      char name[32];
+      snprintf(name, sizeof(name), "%-4s %5u B", m ? "flip" : "copy", len);
+      bench_report(name, count, ns[m], sum[m]);
+      printf("  %-26s %8.2f GB/s\n", "", (double)count * len / ns[m]);
+    }
+    if (!crossover && ns[1] < ns[0]) crossover = len;
+  }
+  if (crossover) printf("flip beats copy from %u bytes\n", crossover);
+  else printf("copy wins at every size tried\n");
+  myring_consumer_close(&c);
+  return 0;
+}
+
+/* --- ipc: process-to-process records, ring vs. pipe vs. Unix socket ---
+   This process produces -n messages of each -s size, a forked child
+   consumes them and reports a checksum. The ring transport takes over the
+   producer side of -d with MYRING_IOC_SET_USER_PROD; both sides run
+   lock-free through the mapping and only make a syscall to wake a peer
+   that went to sleep (after -S empty polls on the consumer side). Pipes and
+   sockets pay a write() and a read() per message. Needs the module; point
+   it at a spare ring, kernel records routed there are dropped meanwhile. */
+
+enum { IPC_RING, IPC_PIPE, IPC_UNIX };
+static const char *const ipc_names[] = { "ring", "pipe", "unix" };
+
+struct ipc_opts {
+  const char *dev;
+  uint64_t count;
+  uint32_t batch;             /* ring: records per publish */
+  unsigned spins;             /* ring: empty polls before sleeping */
+  int prod_cpu, cons_cpu;
+};
+
+static int ipc_on_rec(void *ctx, const struct myring_rec *rec)
+{
+  *(uint64_t *)ctx += rec->payload[rec->hdr->len - 1];
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(ipc_drain, .on_pkt = ipc_on_rec)
+
+static int ipc_xfer(int fd, void *buf, size_t len, bool out)
+{
+  for (size_t done = 0; done < len;) {
+    ssize_t n = out ? write(fd, (uint8_t *)buf + done, len - done)
+                    : read(fd, (uint8_t *)buf + done, len - done);
+    if (n <= 0) return -1;
+    done += (size_t)n;
+  }
+  return 0;
+}
+
+/* child: consume count messages, write the checksum to res */
+static int ipc_consume(int kind, const struct ipc_opts *o, int fd, uint64_t start,
+                       uint32_t len, int res)
+{
+  uint64_t sum = 0, got = 0;
+  spsc_pin(o->cons_cpu);
+
+  if (kind == IPC_RING) {
+    struct myring_consumer c;
+    if (myring_consumer_open(&c, o->dev) != 0) { perror("ipc: consumer open"); return 1; }
+    c.tail = start;
+    unsigned idle = 0;
+    while (got < o->count) {
+      if (myring_load_acquire(&c.ctrl->head) == c.tail) {
+        if (++idle > o->spins && myring_consumer_wait(&c, -1) < 0) { perror("ipc: wait"); return 1; }
+        continue;
+      }
+      idle = 0;
+      long n = ipc_drain(&c, &sum, 0);
+      if (n < 0) { perror("ipc: drain"); return 1; }
+      got += (uint64_t)n;
+      myring_consumer_commit(&c);
+    }
+    myring_consumer_close(&c);
+  } else {
+    uint8_t *buf = malloc(len);
+    for (; got < o->count; got++) {
+      if (ipc_xfer(fd, buf, len, false) != 0) { perror("ipc: read"); return 1; }
+      sum += buf[len - 1];
+    }
+    free(buf);
+  }
+  return ipc_xfer(res, &sum, sizeof(sum), true) != 0;
+}
+
+/* one transport at one size; returns 0 and fills ns/sum/notifies */
+static int ipc_run(int kind, const struct ipc_opts *o, uint32_t len,
+                   uint64_t *ns, uint64_t *sum, uint64_t *notifies)
+{
+  struct myring_producer p = { .fd = -1 };
+  int fds[2] = { -1, -1 }, res[2];
+  uint8_t *buf = malloc(len);
+  int ret = 1;
+
+  if (!buf || pipe(res) != 0) { perror("ipc: setup"); free(buf); return 1; }
+  if (kind == IPC_RING && myring_producer_open(&p, o->dev) != 0) {
+    fprintf(stderr, "ipc: take over %s: %s\n", o->dev, strerror(errno));
+    goto out;
+  }
+  if (kind == IPC_PIPE && pipe(fds) != 0) { perror("pipe"); goto out; }
+  if (kind == IPC_UNIX && socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) { perror("socketpair"); goto out; }
+
+  pid_t pid = fork();
+  if (pid < 0) { perror("fork"); goto out; }
+  if (pid == 0) {
+    close(res[0]);
+    if (fds[1] >= 0) close(fds[1]);
+    _exit(ipc_consume(kind, o, fds[0], kind == IPC_RING ? p.head : 0, len, res[1]));
+  }
+  close(res[1]);
+  if (fds[0] >= 0) close(fds[0]);
+  fds[0] = -1;
+
+  spsc_pin(o->prod_cpu);
+  struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = len };
+  uint64_t t0 = now_ns();
+  for (uint64_t i = 0; i < o->count; i++) {
+    memset(buf, (int)i, len);
+    if (kind != IPC_RING) {
+      if (ipc_xfer(fds[1], buf, len, true) != 0) { perror("ipc: write"); break; }
+      continue;
+    }
+    while (myring_produce(&p, &hdr, buf) != 0) {
+      if (myring_producer_wait(&p) != 0) {
+        perror("ipc: producer wait");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        goto out;
+      }
+    }
+    if ((i + 1) % o->batch == 0) myring_producer_publish(&p);
+  }
+  if (kind == IPC_RING) myring_producer_publish(&p);
+  bool ok = ipc_xfer(res[0], sum, sizeof(*sum), false) == 0;
+  *ns = now_ns() - t0;
+  int status;
+  waitpid(pid, &status, 0);
+  if (ok && WIFEXITED(status) && WEXITSTATUS(status) == 0) ret = 0;
+  else fprintf(stderr, "ipc: %s consumer failed\n", ipc_names[kind]);
+  *notifies = kind == IPC_RING ? p.notifies : 0;
+
+out:
+  if (kind == IPC_RING && p.fd >= 0) myring_producer_close(&p);
+  if (fds[0] >= 0) close(fds[0]);
+  if (fds[1] >= 0) close(fds[1]);
+  close(res[0]);
+  free(buf);
+  return ret;
+}
+
+static int bench_ipc(int argc, char **argv)
+{
+  struct ipc_opts o = { .dev = "/dev/myring", .count = 1000000, .batch = 1, .prod_cpu = 0, .cons_cpu = 1 };
+  char sizes_buf[] = "64,256,1024,4096";
+  char *sizes = sizes_buf;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:n:s:b:S:P:C:")) != -1) {
+    switch (opt) {
+      case 'd': o.dev = optarg; break;
+      case 'n': o.count = strtoull(optarg, NULL, 0); break;
+      case 's': sizes = optarg; break;
+      case 'b': o.batch = (uint32_t)atoi(optarg); break;
+      case 'S': o.spins = (unsigned)atoi(optarg); break;
+      case 'P': o.prod_cpu = atoi(optarg); break;
+      case 'C': o.cons_cpu = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: bench ipc [-d dev] [-n messages] [-s size,size,..] [-b records_per_publish]\n"
+                        "                 [-S spins_before_sleep] [-P prod_cpu] [-C cons_cpu]\n");
+        return 2;
+    }
+  }
+  if (!o.count || !o.batch) {
+    fprintf(stderr, "ipc: need messages > 0, batch > 0\n");
+    return 2;
+  }
+  printf("ipc: %s, %" PRIu64 " messages per size, publish every %u, spin %u, cpus %d -> %d\n",
+         o.dev, o.count, o.batch, o.spins, o.prod_cpu, o.cons_cpu);
+
+  for (char *tok = strtok(sizes, ","); tok; tok = strtok(NULL, ",")) {
+    uint32_t len = (uint32_t)atoi(tok);
+    if (!len) continue;
+    for (int kind = IPC_RING; kind <= IPC_UNIX; kind++) {
+      uint64_t ns, sum, notifies;
+      if (ipc_run(kind, &o, len, &ns, &sum, &notifies) != 0) return 1;
+      char name[32];
+      snprintf(name, sizeof(name), "%s %5u B", ipc_names[kind], len);
+      bench_report(name, o.count, ns, sum);
+      if (kind == IPC_RING)
+        printf("  %-26s %8.2f GB/s  %.4f wakeups/msg\n", "", (double)o.count * len / ns,
+               (double)notifies / o.count);
+      else
+        printf("  %-26s %8.2f GB/s\n", "", (double)o.count * len / ns);
+    }
+  }
+  return 0;
+}
+
+/* --- sketch: heavy hitters on a skewed key stream ---
+   Each PKT payload starts with a u64 key. hot_pct% of the records pick one
+   of 2k hot keys with weight 1/(i+1), the rest are uniform over the
+   universe, so the exact top k is known up front. */
+
+struct sketch_acc {
+  struct myring_sketch *s;
+  uint64_t sum;
+};
+
+static int sketch_on_plain(void *ctx, const struct myring_rec *rec)
+{
+  struct sketch_acc *a = ctx;
+  uint64_t key;
+  memcpy(&key, rec->payload, sizeof(key));
+  a->sum += key;
+  return 0;
+}
+
+static int sketch_on_add(void *ctx, const struct myring_rec *rec)
+{
+  struct sketch_acc *a = ctx;
+  uint64_t key;
+  memcpy(&key, rec->payload, sizeof(key));
+  a->sum += key;
+  myring_sketch_add(a->s, &key, sizeof(key), 1);
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(sketch_drain_plain, .on_pkt = sketch_on_plain)
+MYRING_DEFINE_DRAIN(sketch_drain_add, .on_pkt = sketch_on_add)
+
+static uint64_t sketch_fill(void *map, uint32_t payload, uint32_t universe, uint32_t hot,
+                            unsigned hot_pct, uint32_t *exact)
+{
+  struct myring_ctrl *ctrl = map;
+  uint8_t buf[256] = { 0 };
+  uint64_t pos = 0, n = 0, hsum = 0;
+  uint32_t rng = 12345;
+  uint64_t *cum = malloc(hot * sizeof(*cum));
+  if (!cum) { perror("malloc"); exit(1); }
+  for (uint32_t i = 0; i < hot; i++) cum[i] = hsum += 1000000 / (i + 1);
+
+  for (;;) {
+    struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = payload, .ts_ns = 1000 + n * 500 };
+    if (pos + sizeof(hdr) + payload > ctrl->size) break;
+    rng = rng * 1103515245u + 12345u;
+    uint64_t key;
+    if ((rng >> 8) % 100 < hot_pct) {
+      rng = rng * 1103515245u + 12345u;
+      uint64_t r = ((uint64_t)rng << 16 ^ (rng >> 8)) % hsum;
+      uint32_t lo = 0, hi = hot - 1;
+      while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (cum[mid] > r) hi = mid; else lo = mid + 1;
+      }
+      key = lo;
+    } else {
+      rng = rng * 1103515245u + 12345u;
+      key = hot + ((uint64_t)rng << 8 ^ (rng >> 8)) % (universe - hot);
+    }
+    exact[key]++;
+    memcpy(buf, &key, sizeof(key));
+    bench_ring_write(map, pos, &hdr, sizeof(hdr));
+    bench_ring_write(map, pos + sizeof(hdr), buf, payload);
+    pos += sizeof(hdr) + payload;
+    n++;
+  }
+  free(cum);
+  myring_store_release(&ctrl->head, pos);
+  return n;
+}
+
+static int bench_sketch(int argc, char **argv)
+{
+  unsigned order = 26, reps = 5, hot_pct = 30, depth = 4;
+  uint32_t payload = 64, universe = 1u << 20, k = 10, width = 1u << 16;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:p:r:u:z:k:D:w:")) != -1) {
+    switch (opt) {
+      case 'o': order = (unsigned)atoi(optarg); break;
+      case 'p': payload = (uint32_t)atoi(optarg); break;
+      case 'r': reps = (unsigned)atoi(optarg); break;
+      case 'u': universe = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'z': hot_pct = (unsigned)atoi(optarg); break;
+      case 'k': k = (uint32_t)atoi(optarg); break;
+      case 'D': depth = (unsigned)atoi(optarg); break;
+      case 'w': width = (uint32_t)strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "usage: bench sketch [-o ring_order] [-p payload] [-r reps] [-u key_universe]\n"
+                        "                    [-z hot_pct] [-k topk] [-D depth] [-w width]\n");
+        return 2;
+    }
+  }
+  if (payload < 8 || payload > 256 || !k || universe <= 2 * k || hot_pct > 100) {
+    fprintf(stderr, "sketch: need 8 <= payload <= 256, universe > 2 * topk, hot_pct <= 100\n");
+    return 2;
+  }
+
+  uint32_t *exact = calloc(universe, sizeof(*exact));
+  if (!exact) { perror("calloc"); return 1; }
+  void *map = bench_ring_alloc(order);
+  uint64_t nrec = sketch_fill(map, payload, universe, 2 * k, hot_pct, exact);
+  struct myring_consumer c;
+  myring_consumer_attach(&c, map, BENCH_PAGE_SIZE);
+  struct myring_sketch sk;
+  if (myring_sketch_init(&sk, depth, width, 4 * k) != 0) { perror("myring_sketch_init"); return 1; }
+  printf("sketch: %" PRIu64 " records of %u bytes, %u keys, %u%% hot, top %u, %ux%u counters "
+         "(%zu KB)\n", nrec, payload, universe, hot_pct, k, sk.depth, sk.width,
+         (size_t)sk.depth * sk.width * sizeof(*sk.cm) >> 10);
+
+  struct sketch_acc a1 = { 0 }, a2 = { .s = &sk };
+  uint64_t t0 = now_ns();
+  for (unsigned r = 0; r < reps; r++) {
+    c.tail = 0;
+    sketch_drain_plain(&c, &a1, 0);
+  }
+  uint64_t t_plain = now_ns() - t0;
+  uint64_t t_add = 0;
+  for (unsigned r = 0; r < reps; r++) {
+    myring_sketch_reset(&sk);
+    c.tail = 0;
+    t0 = now_ns();
+    sketch_drain_add(&c, &a2, 0);
+    t_add += now_ns() - t0;
+  }
+  bench_report("drain", nrec * reps, t_plain, a1.sum);
+  bench_report("drain + sketch", nrec * reps, t_add, a2.sum);
+
+  /* exact top k: k selection passes over the counts */
+  uint32_t *want = malloc(k * sizeof(*want));
+  struct myring_topk *got = malloc(k * sizeof(*got));
+  if (!want || !got) { perror("malloc"); return 1; }
+  for (uint32_t i = 0; i < k; i++) {
+    uint32_t best = UINT32_MAX;
+    for (uint32_t key = 0; key < universe; key++) {
+      bool taken = false;
+      for (uint32_t j = 0; j < i && !taken; j++) taken = want[j] == key;
+      if (!taken && (best == UINT32_MAX || exact[key] > exact[best])) best = key;
+    }
+    want[i] = best;
+  }
+  uint32_t n = myring_sketch_top(&sk, got, k), hits = 0;
+  double max_err = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    uint64_t key;
+    memcpy(&key, got[i].key, sizeof(key));
+    for (uint32_t j = 0; j < k; j++) hits += want[j] == key;
+    double err = key < universe ? (double)(got[i].count - exact[key]) / exact[want[0]] : 1.0;
+    if (err > max_err) max_err = err;
+  }
+  printf("top %u: %u/%u exact heavy hitters found, max overestimate %.4f%% of the largest\n",
+         k, hits, k, 100.0 * max_err);
+
+  myring_sketch_free(&sk);
+  free(want);
+  free(got);
+  free(exact);
+  free(map);
+  return 0;
+}
+
+struct bench_mode {
+  const char *name;
+  int (*fn)(int argc, char **argv);
+  const char *help;
+};
+
+static const struct bench_mode modes[] = {
+  { "soa", bench_soa, "record-at-a-time drain vs. SoA batch decode + column loops" },
+  { "prefetch", bench_prefetch, "drain a ring larger than the LLC at several prefetch distances" },
+  { "slot", bench_slot, "variable-length framing vs. fixed slots: drain, indexed, prefetched, threaded" },
+  { "merge", bench_merge, "k rings read back in global ts_ns order through the merge heap" },
+  { "spsc", bench_spsc, "producer/consumer threads, cursor variants, counters per record" },
+  { "selftest", bench_selftest, "in-kernel loopback records/s and GB/s per record size (module)" },
+  { "inject", bench_inject, "consumer throughput fed by MYRING_IOC_INJECT at any rate (module)" },
+  { "flip", bench_flip, "kernel page producer: copy into the ring vs. page flip, per size (module)" },
+  { "ipc", bench_ipc, "process-to-process messages: user-produced ring vs. pipe vs. Unix socket (module)" },
+  { "sketch", bench_sketch, "drain with and without count-min + space-saving heavy hitters, top-k accuracy" },
+};
+
+int main(int argc, char **argv)
+{
+  if (argc > 1) {
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+      if (strcmp(argv[1], modes[i].name) == 0)
+        return modes[i].fn(argc - 1, argv + 1);
+    }
+  }
+  fprintf(stderr, "usage: %s <mode> [options]\n", argv[0]);
+  for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+    fprintf(stderr, "  %-8s %s\n", modes[i].name, modes[i].help);
+  return 2;
+}
@@ -0,0 +1,408 @@
+// SPDX-License-Identifier: MIT
+// core-to-core probe + placement advisor for myring
+// - for every ordered (producer, consumer) CPU pair, runs the ring's own
+//   head/tail protocol over an in-memory ring:
+//     latency   : one record in flight, producer waits for tail == head
+//                 (cache-line ping-pong, reported as one-way ns)
+//     bandwidth : producer streams 256B records, consumer drains in batches
+// - prints the CPU topology (package / cluster / shared L2 / capacity, so
+//   big.LITTLE arm64 boards show up) and both matrices
+// - recommends the best pair, and with --apply pins the module's producer
+//   (prod_cpu module parameter) and optionally a running consumer (--pid)
+//
+// Usage: c2c [-c cpulist] [-i iters] [-m MB] [-B] [--apply] [--pid PID]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "myring_uapi.h"
+#include "myring_consumer.h"
+
+#define C2C_PAGE_SIZE     4096
+#define C2C_RING_ORDER    18          /* 256KB: stays in L2, measures the handoff not DRAM */
+#define C2C_REC_PAYLOAD   256
+#define C2C_MAX_CPUS      256
+#define PROD_CPU_PARAM    "/sys/module/myring/parameters/prod_cpu"
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield" ::: "memory");
+#else
+  __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* --- topology --- */
+
+struct cpu_topo {
+  int cpu;
+  int package;
+  int cluster;
+  int core;
+  int l2_id;                  /* lowest CPU sharing this CPU's L2, -1 if unknown */
+  int capacity;               /* arm64 cpu_capacity (1024 = biggest), -1 if absent */
+};
+
+static int read_sysfs_int(const char *fmt, int cpu, int def)
+{
+  char path[256];
+  snprintf(path, sizeof(path), fmt, cpu);
+  FILE *f = fopen(path, "r");
+  if (!f) return def;
+  int v = def;
+  if (fscanf(f, "%d", &v) != 1) v = def;
+  fclose(f);
+  return v;
+}
+
+/* Lowest CPU in a "0-3,8" style list. */
+static int read_sysfs_first_cpu(const char *fmt, int cpu)
+{
+  char path[256], buf[256];
+  snprintf(path, sizeof(path), fmt, cpu);
+  FILE *f = fopen(path, "r");
+  if (!f) return -1;
+  int v = -1;
+  if (fgets(buf, sizeof(buf), f)) v = atoi(buf);
+  fclose(f);
+  return v;
+}
+
+static void topo_read(struct cpu_topo *t, int cpu)
+{
+  t->cpu = cpu;
+  t->package = read_sysfs_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu, 0);
+  t->cluster = read_sysfs_int("/sys/devices/system/cpu/cpu%d/topology/cluster_id", cpu, -1);
+  t->core = read_sysfs_int("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu, cpu);
+  t->capacity = read_sysfs_int("/sys/devices/system/cpu/cpu%d/cpu_capacity", cpu, -1);
+  t->l2_id = -1;
+  for (int idx = 0; idx < 8; idx++) {
+    char fmt[128];
+    snprintf(fmt, sizeof(fmt), "/sys/devices/system/cpu/cpu%%d/cache/index%d/level", idx);
+    if (read_sysfs_int(fmt, cpu, -1) != 2) continue;
+    snprintf(fmt, sizeof(fmt), "/sys/devices/system/cpu/cpu%%d/cache/index%d/shared_cpu_list", idx);
+    t->l2_id = read_sysfs_first_cpu(fmt, cpu);
+    break;
+  }
+}
+
+static const char *topo_relation(const struct cpu_topo *a, const struct cpu_topo *b)
+{
+  if (a->package != b->package) return "cross-package";
+  if (a->core == b->core && a->cluster == b->cluster) return "smt-sibling";
+  if (a->l2_id >= 0 && a->l2_id == b->l2_id) return "shared-L2";
+  if (a->cluster >= 0 && a->cluster == b->cluster) return "same-cluster";
+  return "same-package";
+}
+
+/* --- probe --- */
+
+struct probe {
+  void *map;
+  struct myring_ctrl *ctrl;
+  uint8_t *data;
+  uint64_t size;
+  int prod_cpu;
+  int cons_cpu;
+  uint64_t iters;             /* latency round trips */
+  uint64_t bytes;             /* bandwidth transfer size */
+  bool stream;                /* false = latency, true = bandwidth */
+  volatile int ready;
+  uint64_t elapsed_ns;
+};
+
+static void pin_self(int cpu)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+    perror("sched_setaffinity");
+    exit(1);
+  }
+}
+
+static void probe_start_barrier(struct probe *p)
+{
+  __atomic_add_fetch(&p->ready, 1, __ATOMIC_ACQ_REL);
+  while (__atomic_load_n(&p->ready, __ATOMIC_ACQUIRE) < 2) cpu_relax();
+}
+
+static void probe_write(struct probe *p, uint64_t pos, const void *src, uint64_t len)
+{
+  uint64_t off = pos & (p->size - 1);
+  uint64_t first = len < p->size - off ? len : p->size - off;
+  memcpy(p->data + off, src, first);
+  if (len > first) memcpy(p->data, (const uint8_t *)src + first, len - first);
+}
+
+static void *probe_producer(void *arg)
+{
+  struct probe *p = arg;
+  uint8_t rec[sizeof(struct myring_rec_hdr) + C2C_REC_PAYLOAD];
+  struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT };
+  uint64_t head = 0, tail_cache = 0;
+
+  pin_self(p->prod_cpu);
+  memset(rec, 0x5a, sizeof(rec));
+  probe_start_barrier(p);
+  uint64_t t0 = now_ns();
+
+  if (!p->stream) {
+    hdr.len = sizeof(uint64_t);
+    for (uint64_t i = 0; i < p->iters; i++) {
+      hdr.ts_ns = i;
+      memcpy(rec, &hdr, sizeof(hdr));
+      memcpy(rec + sizeof(hdr), &i, sizeof(i));
+      probe_write(p, head, rec, sizeof(hdr) + hdr.len);
+      head += sizeof(hdr) + hdr.len;
+      myring_store_release(&p->ctrl->head, head);
+      while (myring_load_acquire(&p->ctrl->tail) != head) cpu_relax();
+    }
+  } else {
+    hdr.len = C2C_REC_PAYLOAD;
+    uint64_t need = sizeof(hdr) + hdr.len;
+    while (head < p->bytes) {
+      /* cached tail: only re-read the consumer's line when we look full */
+      if (p->size - (head - tail_cache) < need) {
+        while (p->size - (head - (tail_cache = myring_load_acquire(&p->ctrl->tail))) < need)
+          cpu_relax();
+      }
+      hdr.ts_ns = head;
+      memcpy(rec, &hdr, sizeof(hdr));
+      probe_write(p, head, rec, need);
+      head += need;
+      myring_store_release(&p->ctrl->head, head);
+    }
+    while (myring_load_acquire(&p->ctrl->tail) != head) cpu_relax();
+  }
+  p->elapsed_ns = now_ns() - t0;
+  return NULL;
+}
+
+static int probe_on_rec(void *ctx, const struct myring_rec *rec)
+{
+  uint64_t *sum = ctx;
+  *sum += rec->payload[0];
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(probe_drain, .on_pkt = probe_on_rec)
+
+static void *probe_consumer(void *arg)
+{
+  struct probe *p = arg;
+  struct myring_consumer c;
+  uint64_t sum = 0;
+  uint64_t rec = sizeof(struct myring_rec_hdr) + (p->stream ? C2C_REC_PAYLOAD : sizeof(uint64_t));
+  uint64_t end = p->stream ? (p->bytes + rec - 1) / rec * rec : p->iters * rec;
+
+  pin_self(p->cons_cpu);
+  myring_consumer_attach(&c, p->map, C2C_PAGE_SIZE);
+  probe_start_barrier(p);
+
+  while (c.tail < end) {
+    if (myring_load_acquire(&c.ctrl->head) == c.tail) { cpu_relax(); continue; }
+    probe_drain(&c, &sum, 64);
+    myring_consumer_commit(&c);
+  }
+  myring_consumer_close(&c);
+  __asm__ __volatile__("" :: "r"(sum));
+  return NULL;
+}
+
+static uint64_t probe_run(struct probe *p)
+{
+  pthread_t tp, tc;
+  p->ctrl->head = 0;
+  p->ctrl->tail = 0;
+  p->ready = 0;
+  if (pthread_create(&tc, NULL, probe_consumer, p) != 0 ||
+      pthread_create(&tp, NULL, probe_producer, p) != 0) {
+    perror("pthread_create");
+    exit(1);
+  }
+  pthread_join(tp, NULL);
+  pthread_join(tc, NULL);
+  return p->elapsed_ns;
+}
+
+/* --- cpu list / apply --- */
+
+static int parse_cpulist(const char *s, int *cpus, int max)
+{
+  int n = 0;
+  while (*s && n < max) {
+    char *end;
+    long a = strtol(s, &end, 10), b = a;
+    if (end == s) break;
+    if (*end == '-') b = strtol(end + 1, &end, 10);
+    for (long c = a; c <= b && n < max; c++) cpus[n++] = (int)c;
+    s = (*end == ',') ? end + 1 : end;
+  }
+  return n;
+}
+
+static int apply_placement(int prod_cpu, int cons_cpu, pid_t pid)
+{
+  int ret = 0;
+  FILE *f = fopen(PROD_CPU_PARAM, "w");
+  if (!f || fprintf(f, "%d\n", prod_cpu) < 0 || fclose(f) != 0) {
+    fprintf(stderr, "c2c: writing %s failed: %s (module loaded? root?)\n", PROD_CPU_PARAM, strerror(errno));
+    ret = 1;
+  } else {
+    printf("applied: producer -> CPU %d (%s)\n", prod_cpu, PROD_CPU_PARAM);
+  }
+  if (pid > 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cons_cpu, &set);
+    if (sched_setaffinity(pid, sizeof(set), &set) != 0) {
+      fprintf(stderr, "c2c: sched_setaffinity(%d) failed: %s\n", (int)pid, strerror(errno));
+      ret = 1;
+    } else {
+      printf("applied: consumer pid %d -> CPU %d\n", (int)pid, cons_cpu);
+    }
+  } else {
+    printf("consumer: taskset -c %d ./build/user\n", cons_cpu);
+  }
+  return ret;
+}
+
+int main(int argc, char **argv)
+{
+  int cpus[C2C_MAX_CPUS];
+  int ncpu = 0;
+  uint64_t iters = 20000;
+  uint64_t mb = 64;
+  bool do_bw = true, apply = false;
+  pid_t pid = 0;
+
+  static const struct option lopts[] = {
+    { "apply", no_argument, NULL, 'A' },
+    { "pid", required_argument, NULL, 'P' },
+    { 0 },
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "c:i:m:B", lopts, NULL)) != -1) {
+    switch (opt) {
+      case 'c': ncpu = parse_cpulist(optarg, cpus, C2C_MAX_CPUS); break;
+      case 'i': iters = strtoull(optarg, NULL, 0); break;
+      case 'm': mb = strtoull(optarg, NULL, 0); break;
+      case 'B': do_bw = false; break;
+      case 'A': apply = true; break;
+      case 'P': pid = (pid_t)atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-c cpulist] [-i iters] [-m MB] [-B] [--apply] [--pid PID]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  if (!ncpu) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) { perror("sched_getaffinity"); return 1; }
+    for (int c = 0; c < CPU_SETSIZE && ncpu < C2C_MAX_CPUS; c++)
+      if (CPU_ISSET(c, &set)) cpus[ncpu++] = c;
+  }
+  if (ncpu < 2) {
+    fprintf(stderr, "c2c: need at least two CPUs (have %d)\n", ncpu);
+    return 1;
+  }
+
+  struct cpu_topo topo[C2C_MAX_CPUS];
+  printf("cpu  package  cluster  core  l2  capacity\n");
+  for (int i = 0; i < ncpu; i++) {
+    topo_read(&topo[i], cpus[i]);
+    printf("%3d  %7d  %7d  %4d  %2d  %8d\n", topo[i].cpu, topo[i].package, topo[i].cluster,
+           topo[i].core, topo[i].l2_id, topo[i].capacity);
+  }
+
+  struct probe p = { .iters = iters, .bytes = mb << 20 };
+  p.map = aligned_alloc(C2C_PAGE_SIZE, C2C_PAGE_SIZE + (1ull << C2C_RING_ORDER));
+  if (!p.map) { perror("aligned_alloc"); return 1; }
+  memset(p.map, 0, C2C_PAGE_SIZE + (1ull << C2C_RING_ORDER));
+  p.ctrl = p.map;
+  p.data = (uint8_t *)p.map + C2C_PAGE_SIZE;
+  p.size = p.ctrl->size = 1ull << C2C_RING_ORDER;
+
+  double *lat = calloc((size_t)ncpu * ncpu, sizeof(double));
+  double *bw = calloc((size_t)ncpu * ncpu, sizeof(double));
+  if (!lat || !bw) { perror("calloc"); return 1; }
+
+  for (int i = 0; i < ncpu; i++) {
+    for (int j = 0; j < ncpu; j++) {
+      if (i == j) continue;
+      p.prod_cpu = cpus[i];
+      p.cons_cpu = cpus[j];
+      p.stream = false;
+      lat[i * ncpu + j] = (double)probe_run(&p) / iters / 2;
+      if (do_bw) {
+        p.stream = true;
+        bw[i * ncpu + j] = (double)p.bytes / probe_run(&p) * 1e9 / (1 << 20);
+      }
+    }
+  }
+
+  printf("\none-way latency (ns), row = producer, col = consumer\n     ");
+  for (int j = 0; j < ncpu; j++) printf("%7d", cpus[j]);
+  printf("\n");
+  for (int i = 0; i < ncpu; i++) {
+    printf("%4d ", cpus[i]);
+    for (int j = 0; j < ncpu; j++)
+      i == j ? printf("%7s", "-") : printf("%7.1f", lat[i * ncpu + j]);
+    printf("\n");
+  }
+  if (do_bw) {
+    printf("\nbandwidth (MB/s, %u-byte records), row = producer, col = consumer\n     ", C2C_REC_PAYLOAD);
+    for (int j = 0; j < ncpu; j++) printf("%7d", cpus[j]);
+    printf("\n");
+    for (int i = 0; i < ncpu; i++) {
+      printf("%4d ", cpus[i]);
+      for (int j = 0; j < ncpu; j++)
+        i == j ? printf("%7s", "-") : printf("%7.0f", bw[i * ncpu + j]);
+      printf("\n");
+    }
+  }
+
+  /* best pair: highest bandwidth, or lowest latency with -B */
+  int bi = -1, bj = -1;
+  for (int i = 0; i < ncpu; i++) {
+    for (int j = 0; j < ncpu; j++) {
+      if (i == j) continue;
+      bool better = bi < 0 ||
+        (do_bw ? bw[i * ncpu + j] > bw[bi * ncpu + bj] : lat[i * ncpu + j] < lat[bi * ncpu + bj]);
+      if (better) { bi = i; bj = j; }
+    }
+  }
+  printf("\nrecommended: producer CPU %d, consumer CPU %d (%s, %.1f ns",
+         cpus[bi], cpus[bj], topo_relation(&topo[bi], &topo[bj]), lat[bi * ncpu + bj]);
+  if (do_bw) printf(", %.0f MB/s", bw[bi * ncpu + bj]);
+  printf(")\n");
+
+  int ret = apply ? apply_placement(cpus[bi], cpus[bj], pid) : 0;
+  free(lat);
+  free(bw);
+  free(p.map);
+  return ret;
+}
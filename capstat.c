@@ -0,0 +1,463 @@
+// SPDX-License-Identifier: MIT
+// parallel offline analyzer for myring capture files (MYRING_IOC_CAPTURE,
+// capz -d output)
+// - cuts every file into chunks at record boundaries (myring_capfile_split)
+//   and drains the chunks on all cores with the consumer library's own drain
+//   loop and handlers, the same code path a live consumer runs
+// - per thread: record counts by type, payload size and inter-record gap
+//   histograms, gaps over a threshold, DROP losses, per-flow stats for
+//   PKT_META records; merged at the end, including the gaps across chunk
+//   and file boundaries
+//
+// Usage: capstat [-t threads] [-c chunk_mb] [-S slot_size] [-g gap_us] [-k flows] file...
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "myring_uapi.h"
+#include "myring_consumer.h"
+
+#define CAPSTAT_MAX_THREADS 256
+#define CAPSTAT_TOP_GAPS    10
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* --- per-flow table (PKT_META), open addressing --- */
+
+struct flow {
+  struct myring_flow_key key;
+  bool used;
+  uint64_t packets;
+  uint64_t bytes;             /* pkt_len */
+  uint64_t first_ts, last_ts;
+};
+
+struct flow_table {
+  struct flow *slot;
+  uint64_t mask;
+  uint64_t n;
+};
+
+static struct flow *flow_get(struct flow_table *t, const struct myring_flow_key *k)
+{
+  if (!t->slot || (t->n + 1) * 2 > t->mask + 1) {
+    uint64_t cap = t->slot ? 2 * (t->mask + 1) : 1024;
+    struct flow *old = t->slot, *ns = calloc(cap, sizeof(*ns));
+    if (!ns) { perror("calloc"); exit(1); }
+    uint64_t old_cap = old ? t->mask + 1 : 0;
+    t->slot = ns;
+    t->mask = cap - 1;
+    t->n = 0;
+    for (uint64_t i = 0; i < old_cap; i++) {
+      if (!old[i].used) continue;
+      *flow_get(t, &old[i].key) = old[i];
+    }
+    free(old);
+  }
+  uint64_t i = myring_sketch_hash(k, sizeof(*k)) & t->mask;
+  for (;; i = (i + 1) & t->mask) {
+    struct flow *f = &t->slot[i];
+    if (!f->used) {
+      f->used = true;
+      f->key = *k;
+      f->first_ts = UINT64_MAX;
+      t->n++;
+      return f;
+    }
+    if (memcmp(&f->key, k, sizeof(*k)) == 0) return f;
+  }
+}
+
+static void flow_merge(struct flow_table *dst, const struct flow *src)
+{
+  struct flow *f = flow_get(dst, &src->key);
+  f->packets += src->packets;
+  f->bytes += src->bytes;
+  if (src->first_ts < f->first_ts) f->first_ts = src->first_ts;
+  if (src->last_ts > f->last_ts) f->last_ts = src->last_ts;
+}
+
+/* --- chunks and statistics --- */
+
+struct gap {
+  uint64_t ns;
+  uint64_t ts;                /* of the record after the gap */
+  uint64_t pos;               /* its file offset */
+  uint32_t file;
+};
+
+struct chunk {
+  uint32_t file;
+  uint64_t start, end;
+  uint64_t first_ts, last_ts; /* of the first and last record */
+  bool any;
+  bool bad;                   /* decode error at bad_pos */
+  uint64_t bad_pos;
+};
+
+enum { T_PKT, T_META, T_PAGE, T_DROP, T_OTHER, T_MAX };
+
+struct stats {
+  uint64_t records;
+  uint64_t bytes;             /* header + payload */
+  uint64_t type[T_MAX];
+  uint64_t lost;              /* sum of DROP record counts */
+  uint64_t backwards;         /* ts_ns lower than the record before */
+  uint64_t gaps_over;
+  struct myring_hist size;    /* payload bytes */
+  struct myring_hist gap;     /* ts_ns delta to the record before */
+  struct gap top[CAPSTAT_TOP_GAPS];
+  unsigned ntop;
+  struct flow_table flows;
+
+  /* the chunk being drained */
+  struct chunk *chunk;
+  uint64_t prev_ts;
+  bool have_prev;
+};
+
+static uint64_t gap_min_ns = 10000000;
+
+static void gap_top_add(struct stats *s, const struct gap *g)
+{
+  unsigned i;
+  if (s->ntop < CAPSTAT_TOP_GAPS) i = s->ntop++;
+  else if (s->top[CAPSTAT_TOP_GAPS - 1].ns >= g->ns) return;
+  else i = CAPSTAT_TOP_GAPS - 1;
+  for (; i && s->top[i - 1].ns < g->ns; i--) s->top[i] = s->top[i - 1];
+  s->top[i] = *g;
+}
+
+static void gap_add(struct stats *s, uint64_t prev_ts, uint64_t ts, uint32_t file, uint64_t pos)
+{
+  if (ts < prev_ts) {
+    s->backwards++;
+    return;
+  }
+  uint64_t ns = ts - prev_ts;
+  myring_hist_add(&s->gap, ns);
+  if (ns >= gap_min_ns) {
+    struct gap g = { .ns = ns, .ts = ts, .pos = pos, .file = file };
+    s->gaps_over++;
+    gap_top_add(s, &g);
+  }
+}
+
+/* Every record, whatever its type */
+static MYRING_ALWAYS_INLINE void account(struct stats *s, const struct myring_rec *rec, int type)
+{
+  const struct myring_rec_hdr *h = rec->hdr;
+  struct chunk *c = s->chunk;
+
+  s->records++;
+  s->bytes += rec->reclen;
+  s->type[type]++;
+  myring_hist_add(&s->size, h->len);
+  if (s->have_prev) gap_add(s, s->prev_ts, h->ts_ns, c->file, rec->pos);
+  else c->first_ts = h->ts_ns;
+  s->prev_ts = c->last_ts = h->ts_ns;
+  s->have_prev = c->any = true;
+}
+
+static int on_pkt(void *ctx, const struct myring_rec *rec)
+{
+  account(ctx, rec, T_PKT);
+  return 0;
+}
+
+static int on_meta(void *ctx, const struct myring_rec *rec)
+{
+  struct stats *s = ctx;
+  struct myring_pkt_meta m;
+  account(s, rec, T_META);
+  if (rec->hdr->len < sizeof(m)) return 0;
+  memcpy(&m, rec->payload, sizeof(m));
+  struct myring_flow_key k;
+  myring_flow_key(&k, &m);
+  struct flow *f = flow_get(&s->flows, &k);
+  f->packets++;
+  f->bytes += m.pkt_len;
+  if (rec->hdr->ts_ns < f->first_ts) f->first_ts = rec->hdr->ts_ns;
+  if (rec->hdr->ts_ns > f->last_ts) f->last_ts = rec->hdr->ts_ns;
+  return 0;
+}
+
+static int on_page(void *ctx, const struct myring_rec *rec)
+{
+  account(ctx, rec, T_PAGE);
+  return 0;
+}
+
+static int on_drop(void *ctx, const struct myring_rec *rec)
+{
+  struct stats *s = ctx;
+  struct myring_rec_drop dr;
+  account(s, rec, T_DROP);
+  if (rec->hdr->len >= sizeof(dr)) {
+    memcpy(&dr, rec->payload, sizeof(dr));
+    s->lost += dr.lost;
+  }
+  return 0;
+}
+
+static int on_other(void *ctx, const struct myring_rec *rec)
+{
+  account(ctx, rec, T_OTHER);
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(drain_chunk, .on_pkt = on_pkt, .on_meta = on_meta, .on_page = on_page,
+                    .on_drop = on_drop, .on_other = on_other)
+
+/* --- work distribution --- */
+
+static struct {
+  struct myring_capfile *files;
+  char **names;
+  uint32_t nfiles;
+  uint64_t chunk_bytes;
+  uint64_t **cuts;            /* per file */
+  unsigned *nparts;
+  struct chunk *chunks;
+  uint32_t nchunks;
+  uint32_t next;              /* work index, atomic */
+  struct stats *stats;        /* per thread */
+} w;
+
+static void *split_worker(void *arg)
+{
+  (void)arg;
+  for (;;) {
+    uint32_t i = __atomic_fetch_add(&w.next, 1, __ATOMIC_RELAXED);
+    if (i >= w.nfiles) return NULL;
+    uint64_t parts = w.files[i].len / w.chunk_bytes + 1;
+    w.cuts[i] = malloc((parts + 1) * sizeof(**w.cuts));
+    if (!w.cuts[i]) { perror("malloc"); exit(1); }
+    w.nparts[i] = myring_capfile_split(&w.files[i], w.cuts[i], (unsigned)parts);
+  }
+}
+
+static void *drain_worker(void *arg)
+{
+  struct stats *s = arg;
+  for (;;) {
+    uint32_t i = __atomic_fetch_add(&w.next, 1, __ATOMIC_RELAXED);
+    if (i >= w.nchunks) return NULL;
+    struct chunk *ch = &w.chunks[i];
+    struct myring_consumer c;
+    struct myring_ctrl ctrl __attribute__((aligned(8)));
+    myring_capfile_reader(&w.files[ch->file], &c, &ctrl, ch->start, ch->end);
+    s->chunk = ch;
+    s->have_prev = false;
+    if (drain_chunk(&c, s, 0) < 0) {
+      ch->bad = true;
+      ch->bad_pos = c.tail;
+    }
+    myring_consumer_close(&c);
+  }
+}
+
+static void run_threads(void *(*fn)(void *), unsigned threads)
+{
+  pthread_t tids[CAPSTAT_MAX_THREADS];
+  w.next = 0;
+  for (unsigned i = 0; i < threads; i++) {
+    if (pthread_create(&tids[i], NULL, fn, &w.stats[i]) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  for (unsigned i = 0; i < threads; i++) pthread_join(tids[i], NULL);
+}
+
+/* --- report --- */
+
+static int flow_cmp(const void *a, const void *b)
+{
+  uint64_t x = ((const struct flow *)a)->bytes, y = ((const struct flow *)b)->bytes;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_size_hist(const struct myring_hist *h)
+{
+  uint64_t pow2[65] = { 0 };
+  for (unsigned i = 0; i < MYRING_HIST_BUCKETS; i++) {
+    if (!h->bucket[i]) continue;
+    uint64_t v = myring_hist_value(i);
+    pow2[v ? 64 - __builtin_clzll(v) : 0] += h->bucket[i];
+  }
+  for (unsigned b = 0; b < 65; b++) {
+    if (!pow2[b]) continue;
+    uint64_t lo = b ? 1ull << (b - 1) : 0, hi = b ? (1ull << b) - 1 : 0;
+    printf("  %8" PRIu64 " .. %-8" PRIu64 " %12" PRIu64 "  %5.1f%%\n", lo, hi, pow2[b],
+           100.0 * pow2[b] / h->count);
+  }
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "usage: %s [-t threads] [-c chunk_mb] [-S slot_size] [-g gap_us] [-k flows] file...\n",
+          argv0);
+}
+
+int main(int argc, char **argv)
+{
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned threads = ncpu > 0 ? (unsigned)ncpu : 1;
+  uint32_t slot_size = 0;
+  unsigned top_flows = 10;
+  int opt;
+
+  w.chunk_bytes = 64ull << 20;
+  while ((opt = getopt(argc, argv, "t:c:S:g:k:h")) != -1) {
+    switch (opt) {
+      case 't': threads = (unsigned)atoi(optarg); break;
+      case 'c': w.chunk_bytes = strtoull(optarg, NULL, 0) << 20; break;
+      case 'S': slot_size = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'g': gap_min_ns = strtoull(optarg, NULL, 0) * 1000; break;
+      case 'k': top_flows = (unsigned)atoi(optarg); break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (optind >= argc || !threads || threads > CAPSTAT_MAX_THREADS || !w.chunk_bytes) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  w.nfiles = (uint32_t)(argc - optind);
+  w.names = argv + optind;
+  w.files = calloc(w.nfiles, sizeof(*w.files));
+  w.cuts = calloc(w.nfiles, sizeof(*w.cuts));
+  w.nparts = calloc(w.nfiles, sizeof(*w.nparts));
+  w.stats = calloc(threads, sizeof(*w.stats));
+  if (!w.files || !w.cuts || !w.nparts || !w.stats) { perror("calloc"); return 1; }
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < w.nfiles; i++) {
+    if (myring_capfile_open(&w.files[i], w.names[i], slot_size) != 0) {
+      fprintf(stderr, "capstat: %s: %s\n", w.names[i], strerror(errno));
+      return 1;
+    }
+    total += w.files[i].len;
+  }
+
+  /* files in parallel, each cut with one pass over its headers */
+  uint64_t t0 = now_ns();
+  run_threads(split_worker, threads < w.nfiles ? threads : w.nfiles);
+  uint64_t t_split = now_ns() - t0;
+
+  for (uint32_t i = 0; i < w.nfiles; i++) w.nchunks += w.nparts[i];
+  w.chunks = calloc(w.nchunks ? w.nchunks : 1, sizeof(*w.chunks));
+  if (!w.chunks) { perror("calloc"); return 1; }
+  uint32_t k = 0;
+  for (uint32_t i = 0; i < w.nfiles; i++) {
+    for (unsigned p = 0; p < w.nparts[i]; p++)
+      w.chunks[k++] = (struct chunk){ .file = i, .start = w.cuts[i][p], .end = w.cuts[i][p + 1] };
+    uint64_t whole = w.nparts[i] ? w.cuts[i][w.nparts[i]] : 0;
+    if (whole < w.files[i].len)
+      fprintf(stderr, "capstat: %s: last %" PRIu64 " bytes are not a whole record\n", w.names[i],
+              w.files[i].len - whole);
+  }
+
+  run_threads(drain_worker, threads);
+  uint64_t t_all = now_ns() - t0;
+
+  /* merge the threads, then the gaps across chunk and file boundaries */
+  struct stats *m = calloc(1, sizeof(*m));
+  if (!m) { perror("calloc"); return 1; }
+  for (unsigned t = 0; t < threads; t++) {
+    struct stats *s = &w.stats[t];
+    m->records += s->records;
+    m->bytes += s->bytes;
+    for (int i = 0; i < T_MAX; i++) m->type[i] += s->type[i];
+    m->lost += s->lost;
+    m->backwards += s->backwards;
+    m->gaps_over += s->gaps_over;
+    myring_hist_merge(&m->size, &s->size);
+    myring_hist_merge(&m->gap, &s->gap);
+    for (unsigned i = 0; i < s->ntop; i++) gap_top_add(m, &s->top[i]);
+    for (uint64_t i = 0; s->flows.slot && i <= s->flows.mask; i++)
+      if (s->flows.slot[i].used) flow_merge(&m->flows, &s->flows.slot[i]);
+    free(s->flows.slot);
+  }
+  uint64_t first_ts = 0, last_ts = 0;
+  const struct chunk *prev = NULL;
+  for (uint32_t i = 0; i < w.nchunks; i++) {
+    const struct chunk *c = &w.chunks[i];
+    if (c->bad)
+      fprintf(stderr, "capstat: %s: bad record at offset %" PRIu64 ", rest of the chunk skipped\n",
+              w.names[c->file], c->bad_pos);
+    if (!c->any) continue;
+    if (prev) gap_add(m, prev->last_ts, c->first_ts, c->file, c->start);
+    else first_ts = c->first_ts;
+    last_ts = c->last_ts;
+    prev = c;
+  }
+
+  printf("capstat: %u files, %.1f MB in %u chunks on %u threads: %.3f s (split %.3f s), %.0f MB/s\n",
+         w.nfiles, total / 1e6, w.nchunks, threads, t_all / 1e9, t_split / 1e9,
+         t_all ? total * 1e3 / t_all : 0.0);
+  printf("records: %" PRIu64 " (%.1f MB)  pkt %" PRIu64 "  meta %" PRIu64 "  page %" PRIu64
+         "  drop %" PRIu64 "  other %" PRIu64 "\n", m->records, m->bytes / 1e6, m->type[T_PKT],
+         m->type[T_META], m->type[T_PAGE], m->type[T_DROP], m->type[T_OTHER]);
+  if (m->records)
+    printf("ts_ns: %" PRIu64 " .. %" PRIu64 " (%.3f s)\n", first_ts, last_ts,
+           last_ts > first_ts ? (last_ts - first_ts) / 1e9 : 0.0);
+  printf("lost in DROP records: %" PRIu64 "\n", m->lost);
+
+  printf("payload bytes: p50=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64 "\n",
+         myring_hist_pct(&m->size, 50), myring_hist_pct(&m->size, 99), m->size.max);
+  if (m->size.count) print_size_hist(&m->size);
+  printf("gap to previous record: p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus, %" PRIu64
+         " out of order\n", myring_hist_pct(&m->gap, 50) / 1e3, myring_hist_pct(&m->gap, 99) / 1e3,
+         myring_hist_pct(&m->gap, 99.9) / 1e3, m->gap.max / 1e3, m->backwards);
+  printf("gaps >= %.1f ms: %" PRIu64 "\n", gap_min_ns / 1e6, m->gaps_over);
+  for (unsigned i = 0; i < m->ntop; i++)
+    printf("  %10.3f ms before ts %" PRIu64 " at %s:%" PRIu64 "\n", m->top[i].ns / 1e6,
+           m->top[i].ts, w.names[m->top[i].file], m->top[i].pos);
+
+  if (m->flows.n && top_flows) {
+    struct flow *all = malloc(m->flows.n * sizeof(*all));
+    if (!all) { perror("malloc"); return 1; }
+    uint64_t n = 0;
+    for (uint64_t i = 0; i <= m->flows.mask; i++)
+      if (m->flows.slot[i].used) all[n++] = m->flows.slot[i];
+    qsort(all, n, sizeof(*all), flow_cmp);
+    printf("flows: %" PRIu64 ", top %u by bytes:\n", n, (unsigned)(n < top_flows ? n : top_flows));
+    for (uint64_t i = 0; i < n && i < top_flows; i++) {
+      char key[128];
+      double secs = all[i].last_ts > all[i].first_ts ? (all[i].last_ts - all[i].first_ts) / 1e9 : 0.0;
+      myring_flow_str(&all[i].key, key, sizeof(key));
+      printf("  %-56s %10" PRIu64 " pkts %12" PRIu64 " bytes %8.3f s\n", key, all[i].packets,
+             all[i].bytes, secs);
+    }
+    free(all);
+  }
+
+  for (uint32_t i = 0; i < w.nfiles; i++) {
+    free(w.cuts[i]);
+    myring_capfile_close(&w.files[i]);
+  }
+  free(m->flows.slot);
+  free(m);
+  free(w.chunks);
+  free(w.cuts);
+  free(w.nparts);
+  free(w.files);
+  free(w.stats);
+  return 0;
+}
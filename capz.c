@@ -0,0 +1,718 @@
+// SPDX-License-Identifier: MIT
+// parallel compressor for myring capture files (MYRING_IOC_CAPTURE, user -W)
+// - watches path.0, path.1, ... and compresses each segment once the kernel
+//   has sealed it (the next one exists) into path.N.zst, then removes it
+// - a segment is cut into blocks at record boundaries, and a pool of worker
+//   threads compresses the blocks; each block is one independent codec
+//   frame behind a small header (sizes, record count, ts_ns range), so a
+//   reader can skip to any time range without decoding what comes before
+// - reports per segment and overall ratio and MB/s, and with -L sweeps
+//   levels over existing files to pick one that keeps up with ingest
+// - codec at build time: zstd (HAVE_ZSTD), LZ4 frames (HAVE_LZ4), zlib
+//
+// Usage: capz [-t threads] [-l level] [-b block_kb] [-m max_files] [-i poll_ms] [-a] path
+//        capz -1 [-t threads] [-l level] [-b block_kb] path.N...
+//        capz -L level,level,.. [-t threads] [-b block_kb] file...
+//        capz -d [-T from_ns:to_ns] file.zst... > records
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "myring_uapi.h"
+
+#if defined(HAVE_ZSTD)
+#include <zstd.h>
+#define CAPZ_CODEC        1
+#define CAPZ_EXT          ".zst"
+#define CAPZ_LEVEL        3
+#elif defined(HAVE_LZ4)
+#include <lz4frame.h>
+#define CAPZ_CODEC        2
+#define CAPZ_EXT          ".lz4"
+#define CAPZ_LEVEL        0
+#else
+#include <zlib.h>
+#define CAPZ_CODEC        3
+#define CAPZ_EXT          ".z"
+#define CAPZ_LEVEL        1
+#endif
+
+#define CAPZ_MAGIC        0x315A524Du  /* "MRZ1" */
+#define CAPZ_MAX_THREADS  64
+#define CAPZ_MAX_PATH     512
+
+/* In front of every block. A compressed file is nothing but blocks. */
+struct capz_block {
+  uint32_t magic;
+  uint8_t  codec;        /* CAPZ_CODEC of the writer */
+  uint8_t  _pad[3];
+  uint32_t slot_size;    /* 0 = variable-length records */
+  uint32_t raw_len;      /* record bytes in the block */
+  uint32_t comp_len;     /* codec frame bytes following this header */
+  uint32_t records;
+  uint64_t min_ts;       /* ts_ns range of the records */
+  uint64_t max_ts;
+} __attribute__((packed));
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* --- codec --- */
+
+static size_t codec_bound(size_t n)
+{
+#if defined(HAVE_ZSTD)
+  return ZSTD_compressBound(n);
+#elif defined(HAVE_LZ4)
+  return LZ4F_compressFrameBound(n, NULL);
+#else
+  return compressBound(n);
+#endif
+}
+
+/* One frame of src into dst. Returns its length, or 0 on error. ctx is the
+   worker's codec context (zstd only). */
+static size_t codec_compress(void *ctx, void *dst, size_t cap, const void *src, size_t n, int level)
+{
+#if defined(HAVE_ZSTD)
+  size_t r = ZSTD_compressCCtx(ctx, dst, cap, src, n, level);
+  if (ZSTD_isError(r)) {
+    fprintf(stderr, "capz: zstd: %s\n", ZSTD_getErrorName(r));
+    return 0;
+  }
+  return r;
+#elif defined(HAVE_LZ4)
+  LZ4F_preferences_t prefs = { .compressionLevel = level };
+  (void)ctx;
+  size_t r = LZ4F_compressFrame(dst, cap, src, n, &prefs);
+  if (LZ4F_isError(r)) {
+    fprintf(stderr, "capz: lz4: %s\n", LZ4F_getErrorName(r));
+    return 0;
+  }
+  return r;
+#else
+  uLongf len = cap;
+  (void)ctx;
+  if (compress2(dst, &len, src, n, level) != Z_OK) return 0;
+  return len;
+#endif
+}
+
+/* Exactly raw bytes out of one frame, 0 or -1 */
+static int codec_decompress(void *dst, size_t raw, const void *src, size_t n)
+{
+#if defined(HAVE_ZSTD)
+  size_t r = ZSTD_decompress(dst, raw, src, n);
+  return ZSTD_isError(r) || r != raw ? -1 : 0;
+#elif defined(HAVE_LZ4)
+  LZ4F_dctx *dctx;
+  size_t out = raw, in = n;
+  if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) return -1;
+  size_t r = LZ4F_decompress(dctx, dst, &out, src, &in, NULL);
+  LZ4F_freeDecompressionContext(dctx);
+  return LZ4F_isError(r) || r != 0 || out != raw ? -1 : 0;
+#else
+  uLongf len = raw;
+  return uncompress(dst, &len, src, n) != Z_OK || len != raw ? -1 : 0;
+#endif
+}
+
+static void *codec_ctx_new(void)
+{
+#if defined(HAVE_ZSTD)
+  return ZSTD_createCCtx();
+#else
+  return NULL;
+#endif
+}
+
+static void codec_ctx_free(void *ctx)
+{
+#if defined(HAVE_ZSTD)
+  ZSTD_freeCCtx(ctx);
+#else
+  (void)ctx;
+#endif
+}
+
+/* --- segments and blocks --- */
+
+struct segment;
+
+struct block {
+  struct segment *seg;
+  struct block *next;    /* work queue */
+  uint64_t off;          /* in the segment */
+  struct capz_block hdr;
+  void *out;             /* compressed frame, until written */
+  bool done;
+};
+
+struct segment {
+  char raw[CAPZ_MAX_PATH];
+  char out[CAPZ_MAX_PATH];  /* final name; written as out + ".tmp" */
+  int fd, out_fd;           /* out_fd -1 for a level sweep */
+  ino_t ino;
+  uint8_t *map;
+  uint64_t size;
+  struct block *blocks;
+  uint32_t nblocks;
+  uint32_t next_write;      /* first block not yet written, under mu */
+  bool failed;
+  pthread_mutex_t mu;
+  uint64_t comp_bytes;
+  uint64_t start_ns;
+  bool remove_raw;
+};
+
+static struct {
+  int level;
+  uint32_t block_bytes;
+  uint32_t slot_size;
+  unsigned threads;
+  bool quiet;
+
+  pthread_mutex_t mu;      /* queue, inflight, live segments */
+  pthread_cond_t work;     /* queue non-empty or stopping */
+  pthread_cond_t room;     /* a block was written, or a segment finished */
+  struct block *head, *tail;
+  unsigned inflight, max_inflight;
+  unsigned live;           /* segments not finished yet */
+  bool stopping;
+
+  /* totals, under mu */
+  uint64_t raw_bytes, comp_bytes, busy_ns, segments, errors;
+} q;
+
+static volatile sig_atomic_t stop_flag;
+
+static void on_signal(int sig)
+{
+  (void)sig;
+  stop_flag = 1;
+}
+
+/* Cut [0, size) at record boundaries into blocks of about block_bytes */
+static int segment_split(struct segment *s)
+{
+  uint32_t cap = (uint32_t)(s->size / q.block_bytes) + 2;
+  s->blocks = calloc(cap, sizeof(*s->blocks));
+  if (!s->blocks) return -1;
+
+  uint64_t pos = 0;
+  while (pos < s->size) {
+    if (s->nblocks == cap) {
+      struct block *nb = realloc(s->blocks, 2 * cap * sizeof(*nb));
+      if (!nb) return -1;
+      memset(nb + cap, 0, cap * sizeof(*nb));
+      s->blocks = nb;
+      cap *= 2;
+    }
+    struct block *b = &s->blocks[s->nblocks++];
+    b->seg = s;
+    b->off = pos;
+    b->hdr = (struct capz_block){ .magic = CAPZ_MAGIC, .codec = CAPZ_CODEC,
+                                  .slot_size = q.slot_size, .min_ts = UINT64_MAX };
+    uint64_t end = pos;
+    /* at least one record per block, however long */
+    while (end < s->size && (end == pos || end - pos < q.block_bytes)) {
+      struct myring_rec_hdr h;
+      uint64_t len;
+      if (s->size - end < sizeof(h)) {
+        len = s->size - end;  /* torn tail, kept as is */
+      } else {
+        memcpy(&h, s->map + end, sizeof(h));
+        len = q.slot_size ? q.slot_size : sizeof(h) + (uint64_t)h.len;
+        if (len > s->size - end) len = s->size - end;
+        else {
+          b->hdr.records++;
+          if (h.ts_ns < b->hdr.min_ts) b->hdr.min_ts = h.ts_ns;
+          if (h.ts_ns > b->hdr.max_ts) b->hdr.max_ts = h.ts_ns;
+        }
+      }
+      if (end > pos && end - pos + len > UINT32_MAX) break;
+      end += len;
+    }
+    if (end - pos > UINT32_MAX) {
+      fprintf(stderr, "capz: %s: record at %" PRIu64 " too long for a block\n", s->raw, pos);
+      return -1;
+    }
+    if (!b->hdr.records) b->hdr.min_ts = 0;
+    b->hdr.raw_len = (uint32_t)(end - pos);
+    pos = end;
+  }
+  return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+  while (len) {
+    ssize_t w = write(fd, p, len);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += w;
+    len -= (size_t)w;
+  }
+  return 0;
+}
+
+/* Last block written: publish the output, drop the raw file */
+static void segment_finish(struct segment *s)
+{
+  uint64_t ns = now_ns() - s->start_ns;
+  char tmp[CAPZ_MAX_PATH + 8];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", s->out);
+
+  if (s->out_fd >= 0) {
+    if (!s->failed && fsync(s->out_fd) != 0) s->failed = true;
+    close(s->out_fd);
+    if (!s->failed && rename(tmp, s->out) != 0) s->failed = true;
+    if (s->failed) {
+      fprintf(stderr, "capz: %s: %s, raw file kept\n", s->out, strerror(errno));
+      unlink(tmp);
+    } else if (s->remove_raw) {
+      /* the kernel reuses names with max_files: only remove what was read */
+      struct stat st;
+      if (stat(s->raw, &st) == 0 && st.st_ino == s->ino && (uint64_t)st.st_size == s->size)
+        unlink(s->raw);
+      else
+        fprintf(stderr, "capz: %s was rewritten while compressing, capture is ahead of capz\n",
+                s->raw);
+    }
+  }
+  if (!q.quiet)
+    printf("%s: %.1f MB -> %.1f MB (%.2fx) in %.2f s, %.0f MB/s\n", s->raw, s->size / 1e6,
+           s->comp_bytes / 1e6, s->comp_bytes ? (double)s->size / s->comp_bytes : 0.0,
+           ns / 1e9, ns ? s->size * 1e3 / ns : 0.0);
+
+  munmap(s->map, s->size);
+  close(s->fd);
+  pthread_mutex_destroy(&s->mu);
+  pthread_mutex_lock(&q.mu);
+  q.segments++;
+  q.errors += s->failed;
+  q.live--;
+  pthread_cond_broadcast(&q.room);
+  pthread_mutex_unlock(&q.mu);
+  free(s->blocks);
+  free(s);
+}
+
+/* Block b is compressed: write every finished block in order */
+static void block_done(struct block *b)
+{
+  struct segment *s = b->seg;
+  unsigned written = 0;
+  bool last = false;
+
+  pthread_mutex_lock(&s->mu);
+  b->done = true;
+  while (s->next_write < s->nblocks && s->blocks[s->next_write].done) {
+    struct block *w = &s->blocks[s->next_write++];
+    if (s->out_fd >= 0 && !s->failed &&
+        (write_all(s->out_fd, &w->hdr, sizeof(w->hdr)) != 0 ||
+         write_all(s->out_fd, w->out, w->hdr.comp_len) != 0))
+      s->failed = true;
+    s->comp_bytes += sizeof(w->hdr) + w->hdr.comp_len;
+    free(w->out);
+    w->out = NULL;
+    written++;
+  }
+  last = s->next_write == s->nblocks;
+  pthread_mutex_unlock(&s->mu);
+
+  if (written) {
+    pthread_mutex_lock(&q.mu);
+    q.inflight -= written;
+    pthread_cond_broadcast(&q.room);
+    pthread_mutex_unlock(&q.mu);
+  }
+  if (last) segment_finish(s);
+}
+
+static void *worker(void *arg)
+{
+  void *ctx = codec_ctx_new();
+  (void)arg;
+
+  for (;;) {
+    pthread_mutex_lock(&q.mu);
+    while (!q.head && !q.stopping) pthread_cond_wait(&q.work, &q.mu);
+    struct block *b = q.head;
+    if (!b) {
+      pthread_mutex_unlock(&q.mu);
+      break;
+    }
+    q.head = b->next;
+    if (!q.head) q.tail = NULL;
+    pthread_mutex_unlock(&q.mu);
+
+    struct segment *s = b->seg;
+    uint64_t t0 = now_ns();
+    size_t cap = codec_bound(b->hdr.raw_len);
+    b->out = malloc(cap ? cap : 1);
+    size_t n = b->out ? codec_compress(ctx, b->out, cap, s->map + b->off, b->hdr.raw_len, q.level) : 0;
+    if (!n) {
+      fprintf(stderr, "capz: %s: block at %" PRIu64 " failed\n", s->raw, b->off);
+      pthread_mutex_lock(&s->mu);
+      s->failed = true;
+      pthread_mutex_unlock(&s->mu);
+    }
+    b->hdr.comp_len = (uint32_t)n;
+    uint64_t t = now_ns() - t0;
+
+    pthread_mutex_lock(&q.mu);
+    q.busy_ns += t;
+    q.raw_bytes += b->hdr.raw_len;
+    q.comp_bytes += sizeof(b->hdr) + n;
+    pthread_mutex_unlock(&q.mu);
+    block_done(b);
+  }
+  codec_ctx_free(ctx);
+  return NULL;
+}
+
+/* Map raw, split it and queue its blocks. out NULL = measure only. Blocks
+   past max_inflight wait, so memory stays bounded however large the
+   segment. */
+static int segment_submit(const char *raw, const char *out, bool remove_raw)
+{
+  struct segment *s = calloc(1, sizeof(*s));
+  struct stat st;
+  if (!s) return -1;
+  snprintf(s->raw, sizeof(s->raw), "%s", raw);
+  s->out_fd = -1;
+  s->fd = open(raw, O_RDONLY | O_CLOEXEC);
+  if (s->fd < 0 || fstat(s->fd, &st) != 0) {
+    fprintf(stderr, "capz: %s: %s\n", raw, strerror(errno));
+    if (s->fd >= 0) close(s->fd);
+    free(s);
+    return -1;
+  }
+  s->ino = st.st_ino;
+  s->size = (uint64_t)st.st_size;
+  s->remove_raw = remove_raw;
+  if (!s->size) {
+    /* an empty segment (capture stopped right after a rotation) */
+    close(s->fd);
+    free(s);
+    if (remove_raw) unlink(raw);
+    return 0;
+  }
+  s->map = mmap(NULL, s->size, PROT_READ, MAP_SHARED, s->fd, 0);
+  if (s->map == MAP_FAILED) {
+    fprintf(stderr, "capz: mmap %s: %s\n", raw, strerror(errno));
+    close(s->fd);
+    free(s);
+    return -1;
+  }
+  madvise(s->map, s->size, MADV_SEQUENTIAL);
+  if (segment_split(s) != 0) {
+    munmap(s->map, s->size);
+    close(s->fd);
+    free(s->blocks);
+    free(s);
+    return -1;
+  }
+  if (out) {
+    char tmp[CAPZ_MAX_PATH + 8];
+    snprintf(s->out, sizeof(s->out), "%s", out);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", out);
+    s->out_fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (s->out_fd < 0) {
+      fprintf(stderr, "capz: %s: %s\n", tmp, strerror(errno));
+      munmap(s->map, s->size);
+      close(s->fd);
+      free(s->blocks);
+      free(s);
+      return -1;
+    }
+  }
+  pthread_mutex_init(&s->mu, NULL);
+  s->start_ns = now_ns();
+
+  pthread_mutex_lock(&q.mu);
+  q.live++;
+  for (uint32_t i = 0; i < s->nblocks; i++) {
+    while (q.inflight >= q.max_inflight) pthread_cond_wait(&q.room, &q.mu);
+    struct block *b = &s->blocks[i];
+    q.inflight++;
+    if (q.tail) q.tail->next = b;
+    else q.head = b;
+    q.tail = b;
+    pthread_cond_signal(&q.work);
+  }
+  pthread_mutex_unlock(&q.mu);
+  return 0;
+}
+
+/* Wait until every submitted segment is written */
+static void drain_segments(void)
+{
+  pthread_mutex_lock(&q.mu);
+  while (q.live) pthread_cond_wait(&q.room, &q.mu);
+  pthread_mutex_unlock(&q.mu);
+}
+
+static void pool_start(pthread_t *tids)
+{
+  q.stopping = false;
+  q.max_inflight = 4 * q.threads;
+  for (unsigned i = 0; i < q.threads; i++) {
+    if (pthread_create(&tids[i], NULL, worker, NULL) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+}
+
+static void pool_stop(pthread_t *tids)
+{
+  drain_segments();
+  pthread_mutex_lock(&q.mu);
+  q.stopping = true;
+  pthread_cond_broadcast(&q.work);
+  pthread_mutex_unlock(&q.mu);
+  for (unsigned i = 0; i < q.threads; i++) pthread_join(tids[i], NULL);
+}
+
+static void report_totals(const char *what, uint64_t wall_ns)
+{
+  printf("%s: %" PRIu64 " segments, %.1f MB -> %.1f MB (%.2fx), %.0f MB/s wall, "
+         "%.0f MB/s per thread, %" PRIu64 " errors\n", what, q.segments, q.raw_bytes / 1e6,
+         q.comp_bytes / 1e6, q.comp_bytes ? (double)q.raw_bytes / q.comp_bytes : 0.0,
+         wall_ns ? q.raw_bytes * 1e3 / wall_ns : 0.0,
+         q.busy_ns ? q.raw_bytes * 1e3 / q.busy_ns : 0.0, q.errors);
+}
+
+/* --- modes --- */
+
+static void seg_name(char *buf, size_t len, const char *path, uint64_t seq, uint32_t max_files)
+{
+  snprintf(buf, len, "%s.%" PRIu64, path, max_files ? seq % max_files : seq);
+}
+
+static bool exists(const char *p)
+{
+  struct stat st;
+  return stat(p, &st) == 0;
+}
+
+/* Follow a running capture: segment N is sealed once N + 1 exists. With
+   -a the newest segment is compressed too on SIGINT/SIGTERM (stop the
+   capture first). */
+static int run_watch(const char *path, uint32_t max_files, unsigned poll_ms, bool all)
+{
+  char raw[CAPZ_MAX_PATH], next[CAPZ_MAX_PATH], out[CAPZ_MAX_PATH + 8];
+  uint64_t seq = 0;
+
+  /* skip segments compressed by an earlier run */
+  for (;;) {
+    seg_name(raw, sizeof(raw), path, seq, max_files);
+    seg_name(next, sizeof(next), path, seq + 1, max_files);
+    if (exists(raw) || !exists(next)) break;
+    if (max_files && seq + 1 >= max_files) break;
+    seq++;
+  }
+  printf("capz: watching %s.N from %" PRIu64 ", %u threads, level %d, %u KB blocks\n",
+         path, seq, q.threads, q.level, q.block_bytes >> 10);
+
+  while (!stop_flag) {
+    seg_name(raw, sizeof(raw), path, seq, max_files);
+    seg_name(next, sizeof(next), path, seq + 1, max_files);
+    if (exists(raw) && exists(next)) {
+      snprintf(out, sizeof(out), "%s%s", raw, CAPZ_EXT);
+      if (segment_submit(raw, out, true) != 0) q.errors++;
+      seq++;
+      continue;
+    }
+    usleep(poll_ms * 1000);
+  }
+  if (all) {
+    seg_name(raw, sizeof(raw), path, seq, max_files);
+    snprintf(out, sizeof(out), "%s%s", raw, CAPZ_EXT);
+    if (exists(raw) && segment_submit(raw, out, true) != 0) q.errors++;
+  }
+  return 0;
+}
+
+/* Print the records of one compressed file whose ts_ns is in [from, to],
+   skipping blocks outside the range without decompressing them */
+static int decode_file(const char *name, uint64_t from, uint64_t to, uint64_t *skipped)
+{
+  int fd = open(name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "capz: %s: %s\n", name, strerror(errno));
+    return -1;
+  }
+  FILE *f = fdopen(fd, "rb");
+  void *in = NULL, *raw = NULL;
+  size_t in_cap = 0, raw_cap = 0;
+  int ret = 0;
+  struct capz_block h;
+
+  while (fread(&h, sizeof(h), 1, f) == 1) {
+    if (h.magic != CAPZ_MAGIC || h.codec != CAPZ_CODEC) {
+      fprintf(stderr, "capz: %s: not a capz file for this codec\n", name);
+      ret = -1;
+      break;
+    }
+    if (h.records && (h.max_ts < from || h.min_ts > to)) {
+      if (fseeko(f, h.comp_len, SEEK_CUR) != 0) { ret = -1; break; }
+      (*skipped)++;
+      continue;
+    }
+    if (h.comp_len > in_cap) {
+      free(in);
+      in = malloc(in_cap = h.comp_len);
+    }
+    if (h.raw_len > raw_cap) {
+      free(raw);
+      raw = malloc(raw_cap = h.raw_len);
+    }
+    if (!in || !raw || fread(in, 1, h.comp_len, f) != h.comp_len ||
+        codec_decompress(raw, h.raw_len, in, h.comp_len) != 0) {
+      fprintf(stderr, "capz: %s: bad block\n", name);
+      ret = -1;
+      break;
+    }
+    if (from == 0 && to == UINT64_MAX) {
+      fwrite(raw, 1, h.raw_len, stdout);
+      continue;
+    }
+    /* the block straddles the range: filter record by record */
+    const uint8_t *p = raw;
+    for (uint64_t pos = 0; pos + sizeof(struct myring_rec_hdr) <= h.raw_len; ) {
+      struct myring_rec_hdr rh;
+      memcpy(&rh, p + pos, sizeof(rh));
+      uint64_t len = h.slot_size ? h.slot_size : sizeof(rh) + (uint64_t)rh.len;
+      if (len > h.raw_len - pos) break;
+      if (rh.ts_ns >= from && rh.ts_ns <= to) fwrite(p + pos, 1, len, stdout);
+      pos += len;
+    }
+  }
+  free(in);
+  free(raw);
+  fclose(f);
+  return ret;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [-t threads] [-l level] [-b block_kb] [-S slot_size] [-m max_files] [-i poll_ms] [-a] [-q] path\n"
+          "       %s -1 [-t threads] [-l level] [-b block_kb] [-S slot_size] path.N...\n"
+          "       %s -L level,level,.. [-t threads] [-b block_kb] [-S slot_size] file...\n"
+          "       %s -d [-T from_ns:to_ns] file" CAPZ_EXT "... > records\n",
+          argv0, argv0, argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned poll_ms = 100;
+  uint32_t max_files = 0;
+  bool once = false, all = false, decode = false;
+  char *levels = NULL;
+  uint64_t from = 0, to = UINT64_MAX;
+  int opt;
+
+  q.level = CAPZ_LEVEL;
+  q.block_bytes = 1u << 20;
+  q.threads = ncpu > 1 ? (unsigned)(ncpu / 2) : 1;
+  while ((opt = getopt(argc, argv, "t:l:b:S:m:i:a1L:dT:qh")) != -1) {
+    switch (opt) {
+      case 't': q.threads = (unsigned)atoi(optarg); break;
+      case 'l': q.level = atoi(optarg); break;
+      case 'b': q.block_bytes = (uint32_t)strtoul(optarg, NULL, 0) << 10; break;
+      case 'S': q.slot_size = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'm': max_files = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'i': poll_ms = (unsigned)atoi(optarg); break;
+      case 'a': all = true; break;
+      case '1': once = true; break;
+      case 'L': levels = optarg; break;
+      case 'd': decode = true; break;
+      case 'T':
+        if (sscanf(optarg, "%" SCNu64 ":%" SCNu64, &from, &to) != 2) { usage(argv[0]); return 2; }
+        break;
+      case 'q': q.quiet = true; break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+  if (optind >= argc || !q.threads || q.threads > CAPZ_MAX_THREADS || !q.block_bytes ||
+      max_files == 1 || (q.slot_size && q.slot_size < sizeof(struct myring_rec_hdr))) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (decode) {
+    uint64_t skipped = 0;
+    int ret = 0;
+    for (int i = optind; i < argc; i++) ret |= decode_file(argv[i], from, to, &skipped);
+    if (from != 0 || to != UINT64_MAX) fprintf(stderr, "capz: %" PRIu64 " blocks skipped\n", skipped);
+    return ret ? 1 : 0;
+  }
+
+  pthread_t tids[CAPZ_MAX_THREADS];
+  pthread_mutex_init(&q.mu, NULL);
+  pthread_cond_init(&q.work, NULL);
+  pthread_cond_init(&q.room, NULL);
+
+  if (levels) {
+    /* the same files at each level, nothing written */
+    q.quiet = true;
+    printf("capz: %u threads, %u KB blocks\n", q.threads, q.block_bytes >> 10);
+    for (char *tok = strtok(levels, ","); tok; tok = strtok(NULL, ",")) {
+      char name[32];
+      q.raw_bytes = q.comp_bytes = q.busy_ns = q.segments = q.errors = 0;
+      q.level = atoi(tok);
+      pool_start(tids);
+      uint64_t t0 = now_ns();
+      for (int i = optind; i < argc; i++) segment_submit(argv[i], NULL, false);
+      drain_segments();
+      snprintf(name, sizeof(name), "level %d", q.level);
+      report_totals(name, now_ns() - t0);
+      pool_stop(tids);
+    }
+    return 0;
+  }
+
+  pool_start(tids);
+  uint64_t t0 = now_ns();
+  if (once) {
+    char out[CAPZ_MAX_PATH + 8];
+    for (int i = optind; i < argc; i++) {
+      snprintf(out, sizeof(out), "%s%s", argv[i], CAPZ_EXT);
+      if (segment_submit(argv[i], out, true) != 0) q.errors++;
+    }
+  } else {
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    run_watch(argv[optind], max_files, poll_ms, all);
+  }
+  pool_stop(tids);
+  report_totals("capz", now_ns() - t0);
+  return q.errors ? 1 : 0;
+}
@@ -12,8 +12,18 @@
 /* Kernel version compatibility */
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
 #define COMPAT_VM_FLAGS_SET(vma, flags) vm_flags_set(vma, flags)
+#define COMPAT_VM_FLAGS_CLEAR(vma, flags) vm_flags_clear(vma, flags)
 #else
 #define COMPAT_VM_FLAGS_SET(vma, flags) do { (vma)->vm_flags |= (flags); } while(0)
+#define COMPAT_VM_FLAGS_CLEAR(vma, flags) do { (vma)->vm_flags &= ~(flags); } while(0)
+#endif
+/* shrinkers: shrinker_alloc() from 6.7, named register_shrinker() 6.0..6.6 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+#define COMPAT_SHRINKER_ALLOC 1
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+#define COMPAT_REGISTER_SHRINKER(s) register_shrinker(s, DRV_NAME)
+#else
+#define COMPAT_REGISTER_SHRINKER(s) register_shrinker(s)
 #endif
 #include <linux/miscdevice.h>
 #include <linux/fs.h>
@@ -28,14 +38,53 @@
 #include <linux/ktime.h>
 #include <linux/workqueue.h>
 #include <linux/smp.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/sched.h>
+#include <linux/cred.h>
+#include <linux/capability.h>
+#include <uapi/linux/sched/types.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/skbuff.h>
 #include <linux/dma-mapping.h>
+#include <linux/shrinker.h>
+#include <linux/pagemap.h>
 #include <linux/platform_device.h>
 
 // #define USE_NETFILTER 1
 #ifdef USE_NETFILTER
 #include <linux/netfilter.h>
 #include <linux/netfilter_ipv4.h>
+#include <linux/netfilter_ipv6.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/ipv6.h>
+#include <net/net_namespace.h>
+#endif
+
+// #define USE_BPF_KFUNC 1
+#ifdef USE_BPF_KFUNC
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,3,0)
+#error "USE_BPF_KFUNC needs Linux 6.3 or later (__bpf_kfunc)"
+#endif
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/btf_ids.h>
+#include <net/xdp.h>
+/* kfunc definition helpers: BTF_KFUNCS_* from 6.9, __bpf_kfunc_*_defs from 6.7 */
+#ifndef BTF_KFUNCS_START
+#define BTF_KFUNCS_START BTF_SET8_START
+#define BTF_KFUNCS_END BTF_SET8_END
+#endif
+#ifndef __bpf_kfunc_start_defs
+#define __bpf_kfunc_start_defs() \
+  __diag_push(); __diag_ignore_all("-Wmissing-prototypes", "kfuncs are called from BPF only")
+#define __bpf_kfunc_end_defs() __diag_pop()
+#endif
 #endif
 
 #include "myring_uapi.h"
@@ -47,22 +96,146 @@ static unsigned int ring_order = 20; /* ring data size = 1<<order bytes (default
 module_param(ring_order, uint, 0444);
 MODULE_PARM_DESC(ring_order, "log2 of ring data bytes (default 20 -> 1MB)");
 
+static unsigned int nr_rings = 1; /* ring instances, see MYRING_IOC_SET_ROUTE */
+module_param(nr_rings, uint, 0444);
+MODULE_PARM_DESC(nr_rings, "ring instances /dev/myring, /dev/myring1.. (default 1, max 8)");
+
+static unsigned int slot_size; /* 0 = variable-length records */
+module_param(slot_size, uint, 0444);
+MODULE_PARM_DESC(slot_size, "fixed record slot bytes, power of two >= 64 (default 0 = variable-length records)");
+
+static unsigned int flip_pages; /* zero-copy page slots per ring */
+module_param(flip_pages, uint, 0444);
+MODULE_PARM_DESC(flip_pages, "page slots per ring for zero-copy page flipping, mapped at MYRING_OFF_FLIP (default 0 = off, max 65536)");
+
 static unsigned int rate_hz = 2000; /* synthetic producer rate */
 module_param(rate_hz, uint, 0644);
 MODULE_PARM_DESC(rate_hz, "synthetic producer rate in Hz (default 2000)");
 
-/* Device state */
+static int prod_cpu = -1; /* CPU the synthetic producer runs on, see c2c.c */
+module_param(prod_cpu, int, 0644);
+MODULE_PARM_DESC(prod_cpu, "CPU for the synthetic producer (default -1 = any)");
+
+/* Producer as a dedicated kthread (instead of system workqueue) with an
+   optional real-time policy */
+static bool prod_kthread;
+module_param(prod_kthread, bool, 0444);
+MODULE_PARM_DESC(prod_kthread, "run the synthetic producer in its own kthread (default 0 = workqueue)");
+
+static unsigned int prod_policy = SCHED_NORMAL;
+module_param(prod_policy, uint, 0444);
+MODULE_PARM_DESC(prod_policy, "producer kthread policy: 0=SCHED_NORMAL 1=SCHED_FIFO 6=SCHED_DEADLINE");
+
+static unsigned int prod_prio = 50;
+module_param(prod_prio, uint, 0444);
+MODULE_PARM_DESC(prod_prio, "SCHED_FIFO priority 1..99 (default 50)");
+
+static unsigned int prod_runtime_us = 50;
+module_param(prod_runtime_us, uint, 0444);
+MODULE_PARM_DESC(prod_runtime_us, "SCHED_DEADLINE runtime budget in us (default 50)");
+
+static unsigned int prod_period_us = 500;
+module_param(prod_period_us, uint, 0444);
+MODULE_PARM_DESC(prod_period_us, "SCHED_DEADLINE period (= deadline) in us (default 500)");
+
+/* Per-CPU staging for softirq producers */
+static unsigned int stage_kb = 64;
+module_param(stage_kb, uint, 0444);
+MODULE_PARM_DESC(stage_kb, "per-CPU staging buffer for softirq producers in KB (default 64, 0 = off)");
+
+static unsigned int stage_budget = 64;
+module_param(stage_budget, uint, 0644);
+MODULE_PARM_DESC(stage_budget, "records staged per CPU before an inline burst flush (default 64)");
+
+/* Page-array backing, reclaimable under memory pressure */
+static bool ring_pages;
+module_param(ring_pages, bool, 0444);
+MODULE_PARM_DESC(ring_pages, "back ring data with single pages, allocated on use and reclaimable (default 0)");
+
+static unsigned int reclaim_pct = 10;
+module_param(reclaim_pct, uint, 0644);
+MODULE_PARM_DESC(reclaim_pct, "ring_pages: occupancy at or below which a ring counts as idle (default 10)");
+
+static unsigned int reclaim_idle_ms = 5000;
+module_param(reclaim_idle_ms, uint, 0644);
+MODULE_PARM_DESC(reclaim_idle_ms, "ring_pages: idle time before the shrinker may free pages (default 5000)");
+
+#ifdef USE_NETFILTER
+static unsigned int nf_snaplen = 256;
+module_param(nf_snaplen, uint, 0644);
+MODULE_PARM_DESC(nf_snaplen, "bytes captured per packet by the netfilter hook (default 256)");
+static unsigned int nf_hooks = MYRING_NF_IPV4(MYRING_NF_PRE_ROUTING);
+module_param(nf_hooks, uint, 0444);
+MODULE_PARM_DESC(nf_hooks, "netfilter hooks to capture at, MYRING_NF_* mask (default 0x1 = IPv4 PRE_ROUTING); MYRING_IOC_SET_NF_HOOKS changes it");
+static bool nf_meta;
+module_param(nf_meta, bool, 0644);
+MODULE_PARM_DESC(nf_meta, "netfilter source emits REC_TYPE_PKT_META (parsed headers + nf_snaplen bytes of L4 payload) instead of raw PKT records");
+#endif
+
+struct myring_dev;
+
+/* One CPU's staged records, see myring_stage_flush() */
+struct myring_stage {
+  uint8_t *buf;               /* stage_size bytes of header+payload records */
+  uint32_t len;               /* bytes staged */
+  uint32_t nrec;              /* records staged */
+  bool queued;                /* flush_work pending */
+  bool urgent;                /* holds a REC_FLAG_URGENT record */
+  uint32_t gen;               /* d->reset_gen when the first record was staged */
+  struct work_struct flush_work;
+  struct myring_dev *d;
+};
+
+/* Device state, one per ring instance */
 struct myring_dev {
   struct miscdevice misc;
+  char name[16];
+  uint32_t id;
   struct myring_ctrl *ctrl;   /* first PAGE_SIZE */
   void *vmem;                 /* DMA coherent block (ctrl + data) */
   dma_addr_t dma_handle;      /* DMA physical address */
   size_t vmem_len;
   void *data;                 /* start of ring data region */
   uint64_t size;              /* ring data bytes (power-of-two) */
+  uint32_t slot_size;         /* slot mode: bytes per record, else 0 */
   struct device *dev;         /* device for DMA allocation */
   bool use_free_pages;        /* true if allocated with __get_free_pages */
 
+  /* ring_pages=1: data is pages[], slots NULL until written, see
+     myring_reclaim(). Slots change under prod_lock. */
+  struct page **pages;
+  unsigned long nr_pages;
+  unsigned long nr_present;
+  uint64_t low_since_ns;      /* occupancy <= reclaim_pct since, 0 = busy */
+  struct address_space *mapping;  /* of the mmap'd device file */
+
+  /* flip_pages: slots handed to the consumer by PAGE records, see myring_flip() */
+  struct page **flip;         /* page in each slot */
+  uint64_t *flip_busy;        /* slot is the consumer's while tail < this */
+  struct page *flip_spare;    /* next page a producer fills */
+  uint32_t nr_flip;
+  uint32_t flip_next;         /* slots are used round robin */
+  struct mutex flip_mu;       /* serialises flips, which sleep */
+
+  spinlock_t prod_lock;       /* serialises producers (workqueue/kthread/softirq) */
+  bool selftest;              /* MYRING_IOC_SELFTEST owns the ring, producers drop */
+  struct file *user_prod;     /* MYRING_IOC_SET_USER_PROD owner, producers drop */
+
+  /* MYRING_IOC_CAPTURE: kernel consumer writing to files, see myring_capture_thread() */
+  struct task_struct *cap_task;
+  struct file *cap_file;
+  struct myring_capture cap;  /* settings as started */
+  uint64_t cap_chunk;         /* bytes queued before the thread writes */
+  const struct cred *cap_cred;  /* starter's credentials, every file is opened with them */
+  uint64_t cap_rec;           /* next record header, at or past tail */
+  loff_t cap_pos;             /* write offset in cap_file */
+  uint64_t cap_bytes;         /* written, all files */
+  uint32_t cap_files;         /* files opened */
+  int cap_err;
+  struct myring_stage __percpu *stage;  /* NULL when stage_kb=0 */
+  uint32_t stage_size;
+  uint32_t reset_gen;         /* bumped by RESET under prod_lock: older stages are stale */
+
   struct eventfd_ctx *evt;
   bool above_hi;
   wait_queue_head_t wq;
@@ -72,18 +245,39 @@ struct myring_dev {
   uint64_t records;
   uint64_t bytes;
   uint64_t drops;
+};
 
+static struct myring_dev myring_devs[MYRING_MAX_RINGS];
+
+/* Record sources feed whichever ring myring_route() picks */
+static struct {
   /* synthetic producer */
   struct delayed_work prod_work;
+  struct task_struct *prod_task;  /* set when prod_kthread=1 */
   bool stopping;
   uint64_t seq_number;        /* monotonic sequence number for packets */
 
 #ifdef USE_NETFILTER
-  struct nf_hook_ops nfops;
+  struct nf_hook_ops nfops[2 * MYRING_NF_IPV6_SHIFT];  /* by hook mask bit */
+  uint32_t nf_mask;           /* registered hooks, under myring_nf_mu */
 #endif
-};
+} _src;
 
-static struct myring_dev __attribute__((aligned(PAGE_SIZE))) _this_dev;
+#ifdef USE_NETFILTER
+static DEFINE_MUTEX(myring_nf_mu);
+#endif
+
+/* Route table, see struct myring_route. Entries are packed into one u64
+   (valid | type | source | ring) so the producer fast path can read them
+   with READ_ONCE while an ioctl rewrites the table under myring_route_mu;
+   a lookup racing with an update sees either the old or the new entry. */
+#define ROUTE_VALID      (1ull << 63)
+#define ROUTE_TYPE(e)    ((uint16_t)((e) >> 32))
+#define ROUTE_SRC(e)     ((uint16_t)((e) >> 16))
+#define ROUTE_RING(e)    ((uint16_t)(e))
+#define ROUTE_PACK(t, s, r) (ROUTE_VALID | (uint64_t)(t) << 32 | (uint64_t)(s) << 16 | (uint16_t)(r))
+static uint64_t myring_routes[MYRING_MAX_ROUTES];
+static DEFINE_MUTEX(myring_route_mu);
 
 /* Helpers */
 static inline uint64_t rb_used(struct myring_ctrl *c)
@@ -98,8 +292,49 @@ static inline uint64_t rb_free(struct myring_ctrl *c)
   return c->size - rb_used(c);
 }
 
+/* ctrl->flags is shared with user space, which sets and clears its wait
+   bits (CTRL_FLAG_NEED_WAKEUP, CTRL_FLAG_PROD_WAIT) with atomic RMWs on
+   the same 32-bit word. The kernel must do the same, or a plain |= / &=
+   racing with them loses one side's update. */
+static inline void rb_flags_set(struct myring_ctrl *c, uint32_t bits)
+{
+  atomic_or(bits, (atomic_t *)&c->flags);
+}
+
+static inline void rb_flags_clear(struct myring_ctrl *c, uint32_t bits)
+{
+  atomic_andnot(bits, (atomic_t *)&c->flags);
+}
+
+/* Log the commit of [head, new_head) for the latency breakdown: extend the
+   open entry while it is unread and small, else open the next one. See
+   CTRL_FLAG_STAMPS. Caller is the ring's only producer (prod_lock). */
+static void rb_stamp(struct myring_ctrl *c, uint64_t new_head)
+{
+  /* ctrl is user-writable: only the index is trusted, modulo */
+  uint64_t seq = READ_ONCE(c->stamp_seq);
+  uint64_t head = READ_ONCE(c->head);
+  uint64_t now = ktime_get_ns();
+  uint64_t i = (seq - 1) % MYRING_STAMPS;
+
+  if (seq && READ_ONCE(c->stamp[i].head) == head && head > READ_ONCE(c->tail) &&
+      new_head - READ_ONCE(c->stamp[i].start) <= c->size / (MYRING_STAMPS / 2)) {
+    /* last_ns before head: a reader that sees the new head sees its time */
+    WRITE_ONCE(c->stamp[i].last_ns, now);
+    smp_store_release(&c->stamp[i].head, new_head);
+    return;
+  }
+  i = seq % MYRING_STAMPS;
+  WRITE_ONCE(c->stamp[i].start, head);
+  WRITE_ONCE(c->stamp[i].head, new_head);
+  WRITE_ONCE(c->stamp[i].first_ns, now);
+  WRITE_ONCE(c->stamp[i].last_ns, now);
+  smp_store_release(&c->stamp_seq, seq + 1);
+}
+
 static inline void rb_commit_head(struct myring_ctrl *c, uint64_t new_head)
 {
+  if (unlikely(READ_ONCE(c->flags) & CTRL_FLAG_STAMPS)) rb_stamp(c, new_head);
   smp_store_release(&c->head, new_head);
 }
 
@@ -109,19 +344,108 @@ static inline uint32_t rb_pct(uint64_t used, uint64_t size)
   return (uint32_t)((used * 100) / size);
 }
 
+/* The ring is someone else's (self-test or a user producer): kernel
+   producers count their records as drops without touching head or flags */
+static inline bool rb_prod_off(const struct myring_dev *d)
+{
+  return READ_ONCE(d->selftest) || READ_ONCE(d->user_prod);
+}
+
+/* Ring bytes a record with len payload bytes takes. In slot mode every
+   record takes one slot, whatever its length, so positions stay slot
+   aligned and no record wraps the end of the ring. */
+static inline uint32_t rb_rec_bytes(const struct myring_dev *d, uint32_t len)
+{
+  return d->slot_size ? d->slot_size : sizeof(struct myring_rec_hdr) + len;
+}
+
+/* Longest payload one record can carry; longer ones are cut to it */
+static inline uint32_t rb_max_payload(const struct myring_dev *d)
+{
+  return d->slot_size ? d->slot_size - sizeof(struct myring_rec_hdr) : U32_MAX;
+}
+
+/* Ring for a record of (type, src): the most specific matching route,
+   exact type and source first, then type only, then source only. */
+static struct myring_dev *myring_route(uint16_t type, uint16_t src)
+{
+  uint32_t ring = 0;
+  int best = -1;
+
+  for (int i = 0; i < MYRING_MAX_ROUTES; i++) {
+    uint64_t e = READ_ONCE(myring_routes[i]);
+    int score;
+
+    if (!(e & ROUTE_VALID)) continue;
+    if (ROUTE_TYPE(e) && ROUTE_TYPE(e) != type) continue;
+    if (ROUTE_SRC(e) && ROUTE_SRC(e) != src) continue;
+    score = (ROUTE_TYPE(e) ? 2 : 0) + (ROUTE_SRC(e) ? 1 : 0);
+    if (score > best) {
+      best = score;
+      ring = ROUTE_RING(e);
+    }
+  }
+  return &myring_devs[ring];
+}
+
+static int myring_set_route(const struct myring_route *r)
+{
+  int slot = -1;
+
+  if (r->ring != MYRING_ROUTE_DEL && r->ring >= nr_rings) return -EINVAL;
+
+  mutex_lock(&myring_route_mu);
+  for (int i = 0; i < MYRING_MAX_ROUTES; i++) {
+    uint64_t e = myring_routes[i];
+    if ((e & ROUTE_VALID) && ROUTE_TYPE(e) == r->type && ROUTE_SRC(e) == r->source) {
+      slot = i;
+      break;
+    }
+    if (!(e & ROUTE_VALID) && slot < 0) slot = i;
+  }
+  if (slot >= 0) {
+    uint64_t e = myring_routes[slot];
+    if (r->ring != MYRING_ROUTE_DEL)
+      WRITE_ONCE(myring_routes[slot], ROUTE_PACK(r->type, r->source, r->ring));
+    else if ((e & ROUTE_VALID) && ROUTE_TYPE(e) == r->type && ROUTE_SRC(e) == r->source)
+      WRITE_ONCE(myring_routes[slot], 0);
+  }
+  mutex_unlock(&myring_route_mu);
+
+  if (slot < 0 && r->ring != MYRING_ROUTE_DEL) return -ENOSPC;
+  return 0;
+}
+
 static void myring_signal(struct myring_dev *d)
 {
+  struct myring_ctrl *c = d->ctrl;
+
+  /* latency stamps: the first signal since the consumer last moved tail */
+  if (unlikely(READ_ONCE(c->flags) & CTRL_FLAG_STAMPS) &&
+      READ_ONCE(c->notify_head) <= READ_ONCE(c->tail)) {
+    WRITE_ONCE(c->notify_ns, ktime_get_ns());
+    smp_store_release(&c->notify_head, READ_ONCE(c->head));
+  }
   if (d->evt) eventfd_signal(d->evt, 1);
   wake_up_interruptible(&d->wq);
 }
 
-static void myring_maybe_notify(struct myring_dev *d)
+/* Wake the consumer when the ring crosses hi_pct, or right away for an
+   urgent record (REC_FLAG_URGENT), which must not wait for the batch.
+   A capture thread is also woken once a chunk is queued. */
+static void myring_maybe_notify(struct myring_dev *d, bool urgent)
 {
   struct myring_ctrl *c = d->ctrl;
   uint64_t used = rb_used(c);
   uint32_t pct  = rb_pct(used, c->size);
 
-  if (!d->above_hi && pct >= c->hi_pct) {
+  if (READ_ONCE(d->cap_task) && used >= d->cap_chunk && wq_has_sleeper(&d->wq))
+    wake_up_interruptible(&d->wq);
+
+  if (urgent) {
+    if (pct >= c->hi_pct) d->above_hi = true;
+    myring_signal(d);
+  } else if (!d->above_hi && pct >= c->hi_pct) {
     d->above_hi = true;
     // record timestamp
     // not exposed directly; GET_STATS reads ctrl's last_* stamped here
@@ -130,146 +454,1408 @@ static void myring_maybe_notify(struct myring_dev *d)
   } else if (d->above_hi && pct <= c->lo_pct) {
     d->above_hi = false;
   }
+
+  if (d->pages) {
+    if (pct > READ_ONCE(reclaim_pct)) WRITE_ONCE(d->low_since_ns, 0);
+    else if (!READ_ONCE(d->low_since_ns)) WRITE_ONCE(d->low_since_ns, ktime_get_ns());
+  }
+}
+
+/* Page slot being zapped from user mappings by myring_reclaim() */
+#define MYRING_PAGE_RECLAIMING ((struct page *)1)
+
+/* ring_pages: make sure [pos, pos+len) is backed, allocating pages the
+   shrinker took (or that were never touched). Caller holds prod_lock. */
+static bool myring_pages_ready(struct myring_dev *d, uint64_t pos, uint64_t len)
+{
+  uint64_t first = pos >> PAGE_SHIFT, last = (pos + len - 1) >> PAGE_SHIFT;
+
+  for (uint64_t pg = first; pg <= last; pg++) {
+    unsigned long idx = pg & (d->nr_pages - 1);
+    if (d->pages[idx] == MYRING_PAGE_RECLAIMING) return false;
+    if (!d->pages[idx]) {
+      struct page *page = alloc_page(GFP_ATOMIC | __GFP_ZERO | __GFP_NOWARN);
+      if (!page) return false;
+      d->pages[idx] = page;
+      d->nr_present++;
+    }
+  }
+  return true;
+}
+
+static bool myring_reserve(struct myring_dev *d, uint64_t need, uint64_t *pos_out)
+{
+  struct myring_ctrl *c = d->ctrl;
+  uint64_t head = smp_load_acquire(&c->head);
+  uint64_t tail = smp_load_acquire(&c->tail);
+  uint64_t free = c->size - (head - tail);
+  if (free < need) return false;
+  if (d->pages && !myring_pages_ready(d, head, need)) return false;
+  *pos_out = head;
+  return true;
+}
+
+static void myring_write_bytes(struct myring_dev *d, uint64_t pos, const void *src, uint64_t len)
+{
+  uint64_t mask = d->size - 1; /* size is power-of-two */
+  uint64_t off = pos & mask;
+
+  if (d->pages) {
+    /* reserved range, so every page is present */
+    while (len) {
+      uint64_t in = off & ~PAGE_MASK;
+      uint64_t n = min_t(uint64_t, len, PAGE_SIZE - in);
+      memcpy(page_address(d->pages[off >> PAGE_SHIFT]) + in, src, n);
+      src += n;
+      len -= n;
+      off = (off + n) & mask;
+    }
+    return;
+  }
+
+  uint64_t first = min_t(uint64_t, len, d->size - off);
+  memcpy(d->data + off, src, first);
+  if (len > first) memcpy(d->data, src + first, len - first);
+}
+
+static void myring_read_bytes(struct myring_dev *d, uint64_t pos, void *dst, uint64_t len)
+{
+  uint64_t mask = d->size - 1;
+  uint64_t off = pos & mask;
+
+  if (d->pages) {
+    /* inside [tail, head], so every page is present */
+    while (len) {
+      uint64_t in = off & ~PAGE_MASK;
+      uint64_t n = min_t(uint64_t, len, PAGE_SIZE - in);
+      memcpy(dst, page_address(d->pages[off >> PAGE_SHIFT]) + in, n);
+      dst += n;
+      len -= n;
+      off = (off + n) & mask;
+    }
+    return;
+  }
+
+  uint64_t first = min_t(uint64_t, len, d->size - off);
+  memcpy(dst, d->data + off, first);
+  if (len > first) memcpy(dst + first, d->data, len - first);
+}
+
+static void myring_on_full(struct myring_ctrl *c)
+{
+  if (!(READ_ONCE(c->flags) & CTRL_FLAG_DROPPING)) {
+    rb_flags_set(c, CTRL_FLAG_DROPPING);
+    c->drop_start_ns = ktime_get_ns();
+    c->lost_in_drop = 0;
+  }
+  c->lost_in_drop++;
+}
+
+/* Write d's drop record into ring t (t's prod_lock held) and leave drop
+   mode on d. Returns false if t has no room. */
+static bool myring_emit_drop(struct myring_dev *t, struct myring_dev *d)
+{
+  struct myring_ctrl *c = d->ctrl;
+  struct myring_rec_hdr hdr = {
+    .type = REC_TYPE_DROP,
+    .flags = REC_FLAG_URGENT,
+    .len = sizeof(struct myring_rec_drop),
+    .ts_ns = ktime_get_ns(),
+  };
+  struct myring_rec_drop drop = {
+    .lost = (uint32_t)c->lost_in_drop,
+    .start_ns = c->drop_start_ns,
+    .end_ns = ktime_get_ns(),
+    .ring = d->id,
+  };
+  uint64_t pos;
+  uint64_t need = rb_rec_bytes(t, sizeof(drop));
+
+  if (rb_prod_off(t) || !myring_reserve(t, need, &pos)) return false;
+  myring_write_bytes(t, pos, &hdr, sizeof(hdr));
+  myring_write_bytes(t, pos + sizeof(hdr), &drop, sizeof(drop));
+  rb_commit_head(t->ctrl, pos + need);
+  rb_flags_clear(c, CTRL_FLAG_DROPPING);
+  t->records++;
+  t->bytes += need;
+  myring_maybe_notify(t, true);
+  return true;
+}
+
+/* Emit d's pending drop record, caller holds d->prod_lock. The record goes
+   to the ring DROP records are routed to; d stays in drop mode (and keeps
+   dropping) until it has been written, so the gap is never unreported.
+   Another ring's lock is only try-locked: two rings flushing into each
+   other while the route changes must not deadlock, and a missed flush is
+   retried on d's next push. */
+static void myring_flush_drop_record(struct myring_dev *d)
+{
+  struct myring_dev *t;
+
+  if (!(d->ctrl->flags & CTRL_FLAG_DROPPING)) return;
+
+  t = myring_route(REC_TYPE_DROP, MYRING_SRC_RING);
+  if (t == d) {
+    myring_emit_drop(d, d);
+    return;
+  }
+  if (!spin_trylock(&t->prod_lock)) return;
+  /* t's own gap comes first in t's stream */
+  if (t->ctrl->flags & CTRL_FLAG_DROPPING) myring_emit_drop(t, t);
+  if (!(t->ctrl->flags & CTRL_FLAG_DROPPING)) myring_emit_drop(t, d);
+  spin_unlock(&t->prod_lock);
+}
+
+#if defined(USE_NETFILTER) || defined(USE_BPF_KFUNC)
+/* A record a producer had to give up on although the ring had room (e.g.
+   a payload it can't copy): counted and reported in a DROP record like a
+   full ring, so no loss goes unreported */
+static void myring_drop_rec(struct myring_dev *d)
+{
+  spin_lock_bh(&d->prod_lock);
+  d->drops++;
+  if (!rb_prod_off(d)) {
+    myring_on_full(d->ctrl);
+    myring_flush_drop_record(d);
+  }
+  spin_unlock_bh(&d->prod_lock);
+}
+#endif
+
+/* Push one record into the ring (type/flags/ts from hdr, ts 0 = now).
+   Returns false if it was dropped. */
+static bool myring_push_rec(struct myring_dev *d, const struct myring_rec_hdr *h, const void *payload)
+{
+  struct myring_ctrl *c = d->ctrl;
+  struct myring_rec_hdr hdr = *h;
+  uint32_t len = min_t(uint32_t, hdr.len, rb_max_payload(d));
+  uint64_t pos;
+  uint64_t need = rb_rec_bytes(d, len);
+  bool pushed = false;
+
+  hdr.len = len;
+
+  if (!hdr.ts_ns) hdr.ts_ns = ktime_get_ns();
+
+  spin_lock_bh(&d->prod_lock);
+  if (rb_prod_off(d)) {
+    d->drops++;
+    goto out;
+  }
+
+  /* If we were dropping, emit the drop record first. This has to happen
+     before reserving: the drop record is written at the current head. */
+  myring_flush_drop_record(d);
+
+  if ((c->flags & CTRL_FLAG_DROPPING) || !myring_reserve(d, need, &pos)) {
+    printk_ratelimited(KERN_WARNING "myring_push_packet: FULL - need=%llu > free=%llu, dropping packet\n",
+                       need, rb_free(c));
+    myring_on_full(c);
+    d->drops++;
+    goto out;
+  }
+
+  myring_write_bytes(d, pos, &hdr, sizeof(hdr));
+  myring_write_bytes(d, pos + sizeof(hdr), payload, len);
+  rb_commit_head(c, pos + need);
+
+  d->records++;
+  d->bytes += need;
+
+  myring_maybe_notify(d, hdr.flags & REC_FLAG_URGENT);
+  pushed = true;
+out:
+  spin_unlock_bh(&d->prod_lock);
+  return pushed;
+}
+
+/* Push a "packet" record into the ring (payload=payload,len) */
+static void myring_push_packet(struct myring_dev *d, const void *payload, uint32_t len)
+{
+  struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = len };
+
+  myring_push_rec(d, &hdr, payload);
+}
+
+/* Per-CPU staging for softirq producers.
+   Each CPU appends pre-formed records (header + payload, exactly as they
+   will sit in the ring) to its own buffer with BH disabled and no atomics.
+   The stage is copied into the ring as one burst under prod_lock when it
+   holds stage_budget records or runs out of room, and otherwise by a
+   per-CPU flush work item queued on the first append. The ring then sees
+   a few large sequential writes instead of interleaved single records. */
+
+/* Copy a stage into the ring. Caller has BH disabled on the stage's CPU. */
+static void myring_stage_flush(struct myring_dev *d, struct myring_stage *s)
+{
+  struct myring_ctrl *c = d->ctrl;
+  uint32_t fit = 0, nfit = 0;
+  uint64_t pos;
+
+  if (!s->len) return;
+
+  spin_lock(&d->prod_lock);
+  if (s->gen != d->reset_gen) goto out;  /* staged before a RESET: discard */
+  if (rb_prod_off(d)) {
+    d->drops += s->nrec;
+    goto out;
+  }
+  myring_flush_drop_record(d);
+
+  if (!(c->flags & CTRL_FLAG_DROPPING)) {
+    uint64_t room = rb_free(c);
+    if (room >= s->len) {
+      fit = s->len;
+      nfit = s->nrec;
+    } else {
+      /* partial burst: the longest prefix of whole records that fits */
+      while (fit < s->len) {
+        const struct myring_rec_hdr *h = (const struct myring_rec_hdr *)(s->buf + fit);
+        uint32_t rl = rb_rec_bytes(d, h->len);
+        if (fit + rl > room) break;
+        fit += rl;
+        nfit++;
+      }
+    }
+  }
+
+  if (fit && !myring_reserve(d, fit, &pos)) fit = nfit = 0;  /* ring_pages: no page */
+  if (fit) {
+    myring_write_bytes(d, pos, s->buf, fit);
+    rb_commit_head(c, pos + fit);
+    d->records += nfit;
+    d->bytes += fit;
+  }
+  for (uint32_t i = nfit; i < s->nrec; i++) {
+    myring_on_full(c);
+    d->drops++;
+  }
+  if (fit) myring_maybe_notify(d, s->urgent);
+out:
+  spin_unlock(&d->prod_lock);
+
+  s->len = 0;
+  s->nrec = 0;
+  s->urgent = false;
+}
+
+static void myring_stage_work(struct work_struct *w)
+{
+  struct myring_stage *s = container_of(w, struct myring_stage, flush_work);
+
+  local_bh_disable();
+  /* only the owning CPU may touch the stage; after a hotplug migration the
+     leftovers go out with that CPU's next flush */
+  if (s == this_cpu_ptr(s->d->stage)) {
+    s->queued = false;
+    myring_stage_flush(s->d, s);
+  }
+  local_bh_enable();
+}
+
+/* Reserve room for one record in this CPU's stage and return its payload
+   area (stamped with type/len/ts), or NULL if staging is off or the record
+   can't be staged. Call with BH disabled (softirq context), then finish
+   with myring_stage_commit(). */
+static void *myring_stage_alloc(struct myring_dev *d, uint16_t type, uint16_t flags, uint32_t len)
+{
+  struct myring_stage *s;
+  struct myring_rec_hdr *h;
+  uint32_t need = rb_rec_bytes(d, len);
+
+  if (!d->stage || need > d->stage_size || len > rb_max_payload(d)) return NULL;
+  s = this_cpu_ptr(d->stage);
+  if (s->len + need > d->stage_size) myring_stage_flush(d, s);
+  if (!s->len) s->gen = READ_ONCE(d->reset_gen);
+
+  h = (struct myring_rec_hdr *)(s->buf + s->len);
+  h->type = type;
+  h->flags = flags;
+  h->len = len;
+  h->ts_ns = ktime_get_ns();
+  /* slot mode: the slot goes to the ring whole, and this part of the stage
+     may still hold an earlier, longer record */
+  if (d->slot_size) memset((uint8_t *)(h + 1) + len, 0, need - sizeof(*h) - len);
+  return h + 1;
+}
+
+static void myring_stage_commit(struct myring_dev *d, uint32_t len)
+{
+  struct myring_stage *s = this_cpu_ptr(d->stage);
+  const struct myring_rec_hdr *h = (const struct myring_rec_hdr *)(s->buf + s->len);
+
+  s->len += rb_rec_bytes(d, len);
+  s->nrec++;
+  /* an urgent record goes out now, with whatever was staged before it */
+  if (h->flags & REC_FLAG_URGENT) s->urgent = true;
+  if (s->nrec >= stage_budget || s->urgent) {
+    myring_stage_flush(d, s);
+  } else if (!s->queued) {
+    s->queued = true;
+    queue_work_on(smp_processor_id(), system_highpri_wq, &s->flush_work);
+  }
+}
+
+static int myring_stage_init(struct myring_dev *d)
+{
+  int cpu;
+
+  if (!stage_kb) return 0;
+  d->stage_size = stage_kb * 1024;
+  d->stage = alloc_percpu(struct myring_stage);
+  if (!d->stage) return -ENOMEM;
+  for_each_possible_cpu(cpu) {
+    struct myring_stage *s = per_cpu_ptr(d->stage, cpu);
+    s->buf = kzalloc_node(d->stage_size, GFP_KERNEL, cpu_to_node(cpu));
+    if (!s->buf) return -ENOMEM;  /* caller runs myring_stage_free() */
+    s->d = d;
+    INIT_WORK(&s->flush_work, myring_stage_work);
+  }
+  return 0;
+}
+
+static void myring_stage_free(struct myring_dev *d)
+{
+  int cpu;
+
+  if (!d->stage) return;
+  for_each_possible_cpu(cpu) {
+    struct myring_stage *s = per_cpu_ptr(d->stage, cpu);
+    if (s->buf) cancel_work_sync(&s->flush_work);
+    kfree(s->buf);
+  }
+  free_percpu(d->stage);
+  d->stage = NULL;
+}
+
+#ifdef USE_NETFILTER
+/* Fill m from the packet's L3/L4 headers. skb->data is the network header
+   at every inet hook; headers are read through skb_header_pointer(), so
+   nonlinear skbs work. Whatever isn't there (truncated packet, non-first
+   fragment, other L4 protocol) is left 0. */
+static void myring_nf_parse(struct sk_buff *skb, const struct nf_hook_state *state,
+                            uint16_t tag, struct myring_pkt_meta *m)
+{
+  const struct net_device *dev = state->in ? state->in : state->out;
+  uint32_t l4off;
+  bool first_frag;
+
+  memset(m, 0, sizeof(*m));
+  m->hook = REC_NF_BIT(tag);
+  m->ifindex = dev ? dev->ifindex : 0;
+  m->pkt_len = skb->len;
+  m->cpu = raw_smp_processor_id();  /* LOCAL_OUT may be preemptible: a hint */
+
+  if (state->pf == NFPROTO_IPV4) {
+    struct iphdr _iph;
+    const struct iphdr *iph = skb_header_pointer(skb, 0, sizeof(_iph), &_iph);
+    if (!iph) return;
+    m->ip_version = 4;
+    m->proto = iph->protocol;
+    memcpy(m->saddr, &iph->saddr, 4);
+    memcpy(m->daddr, &iph->daddr, 4);
+    l4off = iph->ihl * 4;
+    first_frag = !(iph->frag_off & htons(IP_OFFSET));
+  } else {
+    struct ipv6hdr _ip6h;
+    const struct ipv6hdr *ip6h = skb_header_pointer(skb, 0, sizeof(_ip6h), &_ip6h);
+    uint8_t nexthdr;
+    __be16 frag_off = 0;
+    int off;
+    if (!ip6h) return;
+    m->ip_version = 6;
+    memcpy(m->saddr, &ip6h->saddr, 16);
+    memcpy(m->daddr, &ip6h->daddr, 16);
+    nexthdr = ip6h->nexthdr;
+    off = ipv6_skip_exthdr(skb, sizeof(*ip6h), &nexthdr, &frag_off);
+    if (off < 0) return;
+    m->proto = nexthdr;
+    l4off = off;
+    first_frag = !(frag_off & htons(IP6_OFFSET));
+  }
+  m->l4_off = l4off;
+  m->payload_off = l4off;
+  if (!first_frag) return;
+
+  switch (m->proto) {
+    case IPPROTO_TCP: {
+      struct tcphdr _th;
+      const struct tcphdr *th = skb_header_pointer(skb, l4off, sizeof(_th), &_th);
+      if (!th) break;
+      m->sport = ntohs(th->source);
+      m->dport = ntohs(th->dest);
+      m->tcp_flags = tcp_flag_byte(th);
+      m->payload_off = l4off + th->doff * 4;
+      break;
+    }
+    case IPPROTO_UDP:
+    case IPPROTO_UDPLITE: {
+      struct udphdr _uh;
+      const struct udphdr *uh = skb_header_pointer(skb, l4off, sizeof(_uh), &_uh);
+      if (!uh) break;
+      m->sport = ntohs(uh->source);
+      m->dport = ntohs(uh->dest);
+      m->payload_off = l4off + sizeof(*uh);
+      break;
+    }
+  }
+}
+
+/* Netfilter capture, tagged with the hook the packet was seen at: either
+   the first nf_snaplen bytes of the packet (PKT), or with nf_meta the
+   parsed headers and the first nf_snaplen bytes of L4 payload (PKT_META).
+   Staged per CPU, or pushed directly when stage_kb=0; a direct PKT_META
+   push carries the metadata only. Never alters the verdict. LOCAL_OUT and
+   POST_ROUTING can run in process context, hence the BH section around
+   the per-CPU stage. */
+static unsigned int myring_nf_hook(void *priv, struct sk_buff *skb,
+                                   const struct nf_hook_state *state)
+{
+  bool meta = READ_ONCE(nf_meta);
+  uint16_t type = meta ? REC_TYPE_PKT_META : REC_TYPE_PKT;
+  struct myring_dev *d = myring_route(type, MYRING_SRC_NETFILTER);
+  uint16_t tag = REC_FLAG_NF | state->hook |
+                 (state->pf == NFPROTO_IPV6 ? MYRING_NF_IPV6_SHIFT : 0);
+  struct myring_pkt_meta m;
+  uint32_t off = 0, mlen = 0, len, room = rb_max_payload(d);
+  void *p;
+
+  if (meta) {
+    myring_nf_parse(skb, state, tag, &m);
+    off = m.payload_off;
+    mlen = sizeof(m);
+  }
+  len = off < skb->len ? min_t(uint32_t, skb->len - off, nf_snaplen) : 0;
+  len = min_t(uint32_t, len, room > mlen ? room - mlen : 0);  /* slot mode */
+  if (meta) m.cap_len = len;
+
+  local_bh_disable();
+  p = myring_stage_alloc(d, type, tag, mlen + len);
+  if (p) {
+    if (meta) memcpy(p, &m, mlen);
+    if (!len || skb_copy_bits(skb, off, p + mlen, len) == 0)
+      myring_stage_commit(d, mlen + len);
+    else
+      myring_drop_rec(d);
+  } else if (meta) {
+    struct myring_rec_hdr hdr = { .type = type, .flags = tag, .len = mlen };
+    m.cap_len = 0;
+    myring_push_rec(d, &hdr, &m);
+  } else if (len <= skb_headlen(skb)) {
+    struct myring_rec_hdr hdr = { .type = type, .flags = tag, .len = len };
+    myring_push_rec(d, &hdr, skb->data);
+  } else {
+    /* direct pushes copy from linear memory; paged data needs the stage */
+    myring_drop_rec(d);
+  }
+  local_bh_enable();
+  return NF_ACCEPT;
+}
+
+/* Register the hooks in mask that aren't yet and unregister the ones no
+   longer in it; hooks outside the mask cost nothing on the packet path.
+   If a registration fails (e.g. IPv6 disabled) the old set stays. */
+static int myring_nf_set(uint32_t mask)
+{
+  uint32_t added = 0;
+  int ret = 0;
+
+  if (mask & ~MYRING_NF_ALL) return -EINVAL;
+
+  mutex_lock(&myring_nf_mu);
+  for (int bit = 0; bit < ARRAY_SIZE(_src.nfops); bit++) {
+    struct nf_hook_ops *ops = &_src.nfops[bit];
+    bool v6 = bit >= MYRING_NF_IPV6_SHIFT;
+
+    if (!(mask & BIT(bit)) || (_src.nf_mask & BIT(bit))) continue;
+    ops->hook = myring_nf_hook;
+    ops->pf = v6 ? NFPROTO_IPV6 : NFPROTO_IPV4;
+    ops->hooknum = bit % MYRING_NF_IPV6_SHIFT;
+    ops->priority = v6 ? NF_IP6_PRI_FIRST : NF_IP_PRI_FIRST;
+    ret = nf_register_net_hook(&init_net, ops);
+    if (ret) {
+      printk(KERN_ERR "myring: nf hook %s/%u failed, ret=%d\n",
+             v6 ? "ipv6" : "ipv4", ops->hooknum, ret);
+      break;
+    }
+    added |= BIT(bit);
+  }
+
+  uint32_t drop = ret ? added : _src.nf_mask & ~mask;
+  for (int bit = 0; bit < ARRAY_SIZE(_src.nfops); bit++)
+    if (drop & BIT(bit)) nf_unregister_net_hook(&init_net, &_src.nfops[bit]);
+  if (!ret) {
+    _src.nf_mask = mask;
+    nf_hooks = mask;
+  }
+  mutex_unlock(&myring_nf_mu);
+  return ret;
+}
+#endif
+
+#ifdef USE_BPF_KFUNC
+/* BPF ingest source: kfuncs an XDP or tc (SCHED_CLS) program calls to copy
+   the first snaplen bytes of a packet into the ring before the stack has
+   built (XDP) or processed (tc ingress) it. They use the per-CPU staging
+   like the netfilter hook, and like it take a BH section around it:
+   BPF_PROG_TEST_RUN and tc egress on the send path call them from process
+   context, where a softirq producer could interrupt the stage. Return 0 when
+   the record was staged or pushed, -ENOSPC when it was dropped. See
+   myring_xdp.bpf.c. */
+static int myring_bpf_push(uint16_t src, const void *data, uint32_t len)
+{
+  struct myring_dev *d = myring_route(REC_TYPE_PKT, src);
+  struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT };
+  int ret = 0;
+  void *p;
+
+  len = min_t(uint32_t, len, rb_max_payload(d));
+  local_bh_disable();
+  p = myring_stage_alloc(d, REC_TYPE_PKT, 0, len);
+  if (p) {
+    memcpy(p, data, len);
+    myring_stage_commit(d, len);
+  } else {
+    hdr.len = len;
+    if (!myring_push_rec(d, &hdr, data)) ret = -ENOSPC;
+  }
+  local_bh_enable();
+  return ret;
+}
+
+__bpf_kfunc_start_defs();
+
+/* linear part only; the frags of a multi-buffer frame are not captured */
+__bpf_kfunc int bpf_myring_push_xdp(struct xdp_md *ctx, u32 snaplen)
+{
+  struct xdp_buff *xdp = (struct xdp_buff *)ctx;
+  uint32_t len = min_t(uint32_t, xdp->data_end - xdp->data, snaplen);
+
+  return myring_bpf_push(MYRING_SRC_XDP, xdp->data, len);
+}
+
+__bpf_kfunc int bpf_myring_push_skb(struct __sk_buff *skb_ctx, u32 snaplen)
+{
+  struct sk_buff *skb = (struct sk_buff *)skb_ctx;
+  struct myring_dev *d = myring_route(REC_TYPE_PKT, MYRING_SRC_TC);
+  struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT };
+  uint32_t len = min3(skb->len, snaplen, rb_max_payload(d));
+  int ret = 0;
+  void *p;
+
+  local_bh_disable();
+  p = myring_stage_alloc(d, REC_TYPE_PKT, 0, len);
+  if (p) {
+    if (skb_copy_bits(skb, 0, p, len) == 0) {
+      myring_stage_commit(d, len);
+    } else {
+      myring_drop_rec(d);
+      ret = -EFAULT;
+    }
+  } else if (len > skb_headlen(skb)) {
+    /* direct pushes copy from linear memory, as in myring_nf_hook() */
+    myring_drop_rec(d);
+    ret = -ENOSPC;
+  } else {
+    hdr.len = len;
+    if (!myring_push_rec(d, &hdr, skb->data)) ret = -ENOSPC;
+  }
+  local_bh_enable();
+  return ret;
+}
+
+__bpf_kfunc_end_defs();
+
+BTF_KFUNCS_START(myring_kfunc_ids)
+BTF_ID_FLAGS(func, bpf_myring_push_xdp)
+BTF_ID_FLAGS(func, bpf_myring_push_skb)
+BTF_KFUNCS_END(myring_kfunc_ids)
+
+static const struct btf_kfunc_id_set myring_kfunc_set = {
+  .owner = THIS_MODULE,
+  .set = &myring_kfunc_ids,
+};
+
+/* kfunc sets can't be unregistered; they go away with the module's BTF */
+static int myring_register_kfuncs(void)
+{
+  int ret = register_btf_kfunc_id_set(BPF_PROG_TYPE_XDP, &myring_kfunc_set);
+  if (!ret) ret = register_btf_kfunc_id_set(BPF_PROG_TYPE_SCHED_CLS, &myring_kfunc_set);
+  return ret;
+}
+#endif
+
+/* Queue the producer on prod_cpu if it names an online CPU, else anywhere.
+   prod_cpu is writable at runtime and takes effect on the next cycle. */
+static void myring_schedule_prod(unsigned long delay)
+{
+  int cpu = READ_ONCE(prod_cpu);
+
+  if (cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu))
+    schedule_delayed_work_on(cpu, &_src.prod_work, delay);
+  else
+    schedule_delayed_work(&_src.prod_work, delay);
+}
+
+/* Generate and push one synthetic record */
+static void myring_prod_one(void)
+{
+  /* Generate monotonic pattern payload */
+  uint8_t buf[256];
+  uint64_t *payload_u64 = (uint64_t*)buf;
+  
+  /* Header: timestamp + sequence number */
+  payload_u64[0] = ktime_get_ns();      /* timestamp */
+  payload_u64[1] = ++_src.seq_number;     /* monotonic sequence */
+  
+  /* Generate predictable pattern based on sequence number */
+  for (int i = 2; i < sizeof(buf) / sizeof(uint64_t); i++) {
+    payload_u64[i] = _src.seq_number * 0x123456789ABCDEF0ULL + i;
+  }
+  
+  /* Fill remaining bytes with sequence-based pattern */
+  for (int i = (sizeof(buf) / sizeof(uint64_t)) * sizeof(uint64_t); i < sizeof(buf); i++) {
+    buf[i] = (uint8_t)(_src.seq_number + i);
+  }
+  
+  printk(KERN_DEBUG "myring_prod_fn: generating packet #%llu, timestamp=%llu\n",
+         _src.seq_number, payload_u64[0]);
+  
+  myring_push_packet(myring_route(REC_TYPE_PKT, MYRING_SRC_SYNTH), buf, sizeof(buf));
+}
+
+/* Synthetic producer work */
+static void myring_prod_fn(struct work_struct *w)
+{
+  if (_src.stopping) return;
+
+  myring_prod_one();
+
+  if (!_src.stopping) {
+    unsigned long interval_ms = rate_hz ? max(1u, 1000u / rate_hz) : 1u;
+    myring_schedule_prod(msecs_to_jiffies(interval_ms));
+  }
+}
+
+/* Apply prod_policy/prod_prio/prod_runtime_us/prod_period_us to the
+   producer kthread. SCHED_DEADLINE uses deadline == period. */
+static int myring_prod_set_sched(struct task_struct *t)
+{
+  struct sched_attr attr = {
+    .size = sizeof(attr),
+    .sched_policy = prod_policy,
+  };
+
+  switch (prod_policy) {
+    case SCHED_NORMAL:
+      return 0;
+    case SCHED_FIFO:
+      if (prod_prio < 1 || prod_prio > MAX_RT_PRIO - 1) return -EINVAL;
+      attr.sched_priority = prod_prio;
+      break;
+    case SCHED_DEADLINE:
+      if (!prod_runtime_us || prod_runtime_us > prod_period_us) return -EINVAL;
+      attr.sched_runtime = (u64)prod_runtime_us * NSEC_PER_USEC;
+      attr.sched_deadline = (u64)prod_period_us * NSEC_PER_USEC;
+      attr.sched_period = (u64)prod_period_us * NSEC_PER_USEC;
+      break;
+    default:
+      return -EINVAL;
+  }
+  return sched_setattr_nocheck(t, &attr);
+}
+
+/* Synthetic producer kthread: same records as the work item, but paced by
+   an absolute hrtimer and eligible for SCHED_FIFO/SCHED_DEADLINE, so it is
+   not queued behind other system workqueue items. */
+static int myring_prod_thread(void *arg)
+{
+  ktime_t next = ktime_get();
+
+  while (!kthread_should_stop()) {
+    myring_prod_one();
+
+    /* pace at rate_hz; if we fell behind, restart from now rather than burst */
+    next = ktime_add_ns(next, NSEC_PER_SEC / max(1u, READ_ONCE(rate_hz)));
+    if (ktime_before(next, ktime_get())) next = ktime_get();
+
+    set_current_state(TASK_INTERRUPTIBLE);
+    if (!kthread_should_stop())
+      schedule_hrtimeout(&next, HRTIMER_MODE_ABS);
+    __set_current_state(TASK_RUNNING);
+  }
+  return 0;
+}
+
+static int myring_start_prod_thread(void)
+{
+  struct task_struct *t = kthread_create(myring_prod_thread, NULL, DRV_NAME "-prod");
+  int cpu = READ_ONCE(prod_cpu);
+  int ret;
+
+  if (IS_ERR(t)) return PTR_ERR(t);
+
+  /* SCHED_DEADLINE admission needs the task's affinity to span its root
+     domain, so a deadline producer is never bound to prod_cpu */
+  if (cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu) && prod_policy != SCHED_DEADLINE)
+    kthread_bind(t, cpu);
+
+  ret = myring_prod_set_sched(t);
+  if (ret) {
+    printk(KERN_ERR "myring: producer sched policy=%u prio=%u runtime=%uus period=%uus rejected, ret=%d\n",
+           prod_policy, prod_prio, prod_runtime_us, prod_period_us, ret);
+    kthread_stop(t);
+    return ret;
+  }
+
+  _src.prod_task = t;
+  wake_up_process(t);
+  printk(KERN_INFO "myring: producer kthread started, policy=%u prio=%u cpu=%d\n",
+         prod_policy, prod_prio, cpu);
+  return 0;
+}
+
+/* flip_pages: zero-copy handover of page-sized payloads.
+   A producer fills d->flip_spare, then myring_flip() swaps it into the next
+   slot and zaps that slot from user mappings, so the consumer's next access
+   faults the new page in (myring_flip_fault()). The slot's previous page
+   becomes the spare. Slots are reused round robin, each only once the
+   consumer's tail has passed the PAGE record that handed it out. Zapping
+   sleeps, so flips run in process context under flip_mu. */
+
+static bool myring_flip_ready(struct myring_dev *d)
+{
+  return smp_load_acquire(&d->ctrl->tail) >= d->flip_busy[d->flip_next];
+}
+
+/* Exchange slot i's page with the spare and zap the slot from user
+   mappings. Its own inverse: a second call undoes the first. Same page lock
+   handshake as myring_reclaim(): a racing fault either maps the new page
+   or finds its PTE zapped and retries. */
+static void myring_flip_swap(struct myring_dev *d, uint32_t i)
+{
+  struct page *old = d->flip[i];
+
+  lock_page(old);
+  WRITE_ONCE(d->flip[i], d->flip_spare);
+  if (d->mapping)
+    unmap_mapping_range(d->mapping, MYRING_OFF_FLIP + ((loff_t)i << PAGE_SHIFT), PAGE_SIZE, 1);
+  unlock_page(old);
+  d->flip_spare = old;
+}
+
+/* Hand the filled spare over as a PAGE record of len bytes. Returns false
+   (the record is dropped, the slot left as it was) if the next slot is
+   still the consumer's or the record can't be pushed. Caller holds
+   flip_mu. */
+static bool myring_flip(struct myring_dev *d, uint32_t len)
+{
+  uint32_t i = d->flip_next;
+  struct myring_rec_page rp = { .slot = i, .len = len };
+  struct myring_rec_hdr hdr = { .type = REC_TYPE_PAGE, .len = sizeof(rp) };
+  struct myring_ctrl *c = d->ctrl;
+
+  if (!myring_flip_ready(d)) return false;
+  /* zapping sleeps, so the ring can't be reserved across it: skip the
+     swap when the push would fail now, and undo it if it fails anyway */
+  if (rb_prod_off(d) || (READ_ONCE(c->flags) & CTRL_FLAG_DROPPING) ||
+      rb_free(c) < rb_rec_bytes(d, sizeof(rp)))
+    return false;
+
+  myring_flip_swap(d, i);
+  if (!myring_push_rec(d, &hdr, &rp)) {
+    myring_flip_swap(d, i);
+    return false;
+  }
+  d->flip_next = (i + 1) % d->nr_flip;
+  /* the record ends at or before the current head */
+  d->flip_busy[i] = smp_load_acquire(&c->head);
+  return true;
+}
+
+/* head and tail went back to 0: every slot is free again */
+static void myring_flip_reset(struct myring_dev *d)
+{
+  if (!d->nr_flip) return;
+  mutex_lock(&d->flip_mu);
+  memset(d->flip_busy, 0, d->nr_flip * sizeof(*d->flip_busy));
+  mutex_unlock(&d->flip_mu);
+}
+
+static int myring_flip_init(struct myring_dev *d)
+{
+  if (!flip_pages) return 0;
+  mutex_init(&d->flip_mu);
+  d->nr_flip = flip_pages;
+  d->flip = kvcalloc(d->nr_flip, sizeof(*d->flip), GFP_KERNEL);
+  d->flip_busy = kvcalloc(d->nr_flip, sizeof(*d->flip_busy), GFP_KERNEL);
+  d->flip_spare = alloc_page(GFP_KERNEL | __GFP_ZERO);
+  if (!d->flip || !d->flip_busy || !d->flip_spare) return -ENOMEM;  /* caller runs myring_flip_free() */
+  for (uint32_t i = 0; i < d->nr_flip; i++) {
+    d->flip[i] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if (!d->flip[i]) return -ENOMEM;
+  }
+  d->ctrl->flip_pages = d->nr_flip;
+  return 0;
+}
+
+static void myring_flip_free(struct myring_dev *d)
+{
+  if (d->flip) {
+    for (uint32_t i = 0; i < d->nr_flip; i++)
+      if (d->flip[i]) put_page(d->flip[i]);
+  }
+  if (d->flip_spare) put_page(d->flip_spare);
+  kvfree(d->flip);
+  kvfree(d->flip_busy);
+  d->flip = NULL;
+  d->flip_busy = NULL;
+  d->flip_spare = NULL;
+  d->nr_flip = 0;
+}
+
+/* Loopback self-test, see struct myring_selftest. Both sides run the
+   same protocol as the module's producer and a user consumer: the
+   producer publishes head per record with a cached tail, the consumer
+   reads every record header, touches each payload cache line and
+   publishes tail once per batch. Record ts_ns is the sequence number,
+   so the clock read doesn't count against the ring. */
+struct myring_selftest_run {
+  struct myring_dev *d;
+  uint32_t rec_size;
+  uint64_t duration_ns;
+  void *payload;
+  atomic_t ready;
+  uint64_t end_head;          /* valid once prod_done */
+  bool prod_done;
+  uint64_t records, bytes;
+  uint64_t start_ns, end_ns;
+  struct completion done[2];  /* producer, consumer */
+};
+
+static void myring_selftest_barrier(struct myring_selftest_run *r)
+{
+  atomic_inc(&r->ready);
+  while (atomic_read(&r->ready) < 2) cpu_relax();
+}
+
+/* Park until the ioctl reaps us with kthread_stop() */
+static int myring_selftest_park(void)
+{
+  set_current_state(TASK_INTERRUPTIBLE);
+  while (!kthread_should_stop()) {
+    schedule();
+    set_current_state(TASK_INTERRUPTIBLE);
+  }
+  __set_current_state(TASK_RUNNING);
+  return 0;
+}
+
+static int myring_selftest_prod(void *arg)
+{
+  struct myring_selftest_run *r = arg;
+  struct myring_dev *d = r->d;
+  struct myring_ctrl *c = d->ctrl;
+  struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = r->rec_size };
+  uint64_t need = rb_rec_bytes(d, r->rec_size);
+  uint64_t head = c->head, tail_cache = c->tail;
+  uint64_t n = 0, deadline;
+
+  myring_selftest_barrier(r);
+  deadline = ktime_get_ns() + r->duration_ns;
+
+  for (;;) {
+    if (d->size - (head - tail_cache) < need) {
+      tail_cache = smp_load_acquire(&c->tail);
+      if (d->size - (head - tail_cache) < need) {
+        if (ktime_get_ns() >= deadline) break;
+        cpu_relax();
+        continue;
+      }
+    }
+    hdr.ts_ns = n;
+    myring_write_bytes(d, head, &hdr, sizeof(hdr));
+    myring_write_bytes(d, head + sizeof(hdr), r->payload, r->rec_size);
+    head += need;
+    rb_commit_head(c, head);
+    if (++n % 256 == 0) {
+      if (ktime_get_ns() >= deadline) break;
+      cond_resched();
+    }
+  }
+
+  r->end_head = head;
+  smp_store_release(&r->prod_done, true);
+  complete(&r->done[0]);
+  return myring_selftest_park();
+}
+
+static int myring_selftest_cons(void *arg)
+{
+  struct myring_selftest_run *r = arg;
+  struct myring_dev *d = r->d;
+  struct myring_ctrl *c = d->ctrl;
+  const uint8_t *data = d->data;
+  uint64_t mask = d->size - 1;
+  uint64_t tail = c->tail, n = 0, bytes = 0;
+  unsigned int idle = 0;
+
+  myring_selftest_barrier(r);
+  r->start_ns = ktime_get_ns();
+
+  for (;;) {
+    uint64_t head = smp_load_acquire(&c->head);
+
+    if (head == tail) {
+      if (smp_load_acquire(&r->prod_done) && tail == r->end_head) break;
+      cpu_relax();
+      if (++idle % 4096 == 0) cond_resched();
+      continue;
+    }
+    while (tail != head) {
+      struct myring_rec_hdr hdr;
+      uint64_t off = tail & mask;
+
+      if (off + sizeof(hdr) <= d->size) {
+        memcpy(&hdr, data + off, sizeof(hdr));
+      } else {
+        uint64_t first = d->size - off;
+        memcpy(&hdr, data + off, first);
+        memcpy((uint8_t *)&hdr + first, data, sizeof(hdr) - first);
+      }
+      for (uint32_t i = 0; i < hdr.len; i += L1_CACHE_BYTES)
+        (void)READ_ONCE(data[(tail + sizeof(hdr) + i) & mask]);
+      tail += rb_rec_bytes(d, hdr.len);
+      bytes += rb_rec_bytes(d, hdr.len);
+      n++;
+    }
+    smp_store_release(&c->tail, tail);
+  }
+
+  r->end_ns = ktime_get_ns();
+  r->records = n;
+  r->bytes = bytes;
+  complete(&r->done[1]);
+  return myring_selftest_park();
+}
+
+/* Empty the ring for RESET, the self-test and a producer hand-over.
+   Caller holds prod_lock. Only the drop state leaves ctrl->flags: STAMPS
+   and USER_PROD are settings, and the wait bits belong to parked user
+   processes. Positions restart at 0, so the stamp log goes too, and
+   records still in per-CPU stages are discarded at their flush. */
+static void myring_ring_reset(struct myring_dev *d)
+{
+  struct myring_ctrl *c = d->ctrl;
+
+  d->reset_gen++;
+  d->above_hi = false;
+  WRITE_ONCE(c->head, 0);
+  WRITE_ONCE(c->tail, 0);
+  rb_flags_clear(c, CTRL_FLAG_DROPPING);
+  c->drop_start_ns = 0;
+  c->lost_in_drop = 0;
+  c->notify_head = 0;
+  memset(c->stamp, 0, sizeof(c->stamp));
+}
+
+static void myring_selftest_reset(struct myring_dev *d, bool running)
+{
+  spin_lock_bh(&d->prod_lock);
+  WRITE_ONCE(d->selftest, running);
+  myring_ring_reset(d);
+  spin_unlock_bh(&d->prod_lock);
+}
+
+static int myring_selftest(struct myring_dev *d, struct myring_selftest *st)
+{
+  struct myring_selftest_run *r;
+  struct task_struct *tp, *tc;
+  int ret = 0;
+
+  if (!st->rec_size || st->rec_size > 65536 || st->rec_size > rb_max_payload(d) ||
+      sizeof(struct myring_rec_hdr) + st->rec_size > d->size) return -EINVAL;
+  if (st->prod_cpu == st->cons_cpu ||
+      st->prod_cpu >= nr_cpu_ids || !cpu_online(st->prod_cpu) ||
+      st->cons_cpu >= nr_cpu_ids || !cpu_online(st->cons_cpu)) return -EINVAL;
+  if (st->duration_ms > 10000) return -EINVAL;
+  if (d->pages) return -EOPNOTSUPP;  /* the consumer side reads d->data */
+
+  r = kzalloc(sizeof(*r), GFP_KERNEL);
+  if (!r) return -ENOMEM;
+  r->payload = kvmalloc(st->rec_size, GFP_KERNEL);
+  if (!r->payload) {
+    kfree(r);
+    return -ENOMEM;
+  }
+  memset(r->payload, 0x5a, st->rec_size);
+  r->d = d;
+  r->rec_size = st->rec_size;
+  r->duration_ns = (uint64_t)(st->duration_ms ? st->duration_ms : 1000) * NSEC_PER_MSEC;
+  atomic_set(&r->ready, 0);
+  init_completion(&r->done[0]);
+  init_completion(&r->done[1]);
+
+  tp = kthread_create(myring_selftest_prod, r, DRV_NAME "-st-prod");
+  if (IS_ERR(tp)) {
+    ret = PTR_ERR(tp);
+    goto out;
+  }
+  tc = kthread_create(myring_selftest_cons, r, DRV_NAME "-st-cons");
+  if (IS_ERR(tc)) {
+    ret = PTR_ERR(tc);
+    kthread_stop(tp);
+    goto out;
+  }
+  kthread_bind(tp, st->prod_cpu);
+  kthread_bind(tc, st->cons_cpu);
+
+  myring_selftest_reset(d, true);
+  wake_up_process(tc);
+  wake_up_process(tp);
+  wait_for_completion(&r->done[0]);
+  wait_for_completion(&r->done[1]);
+  kthread_stop(tp);
+  kthread_stop(tc);
+  myring_selftest_reset(d, false);
+  myring_flip_reset(d);
+
+  st->records = r->records;
+  st->bytes = r->bytes;
+  st->ns = r->end_ns - r->start_ns;
+  printk(KERN_INFO "myring: %s selftest rec_size=%u cpu %u->%u: %llu records, %llu bytes in %llu ns\n",
+         d->name, st->rec_size, st->prod_cpu, st->cons_cpu, st->records, st->bytes, st->ns);
+out:
+  kvfree(r->payload);
+  kfree(r);
+  return ret;
+}
+
+/* MYRING_IOC_INJECT: copy the user buffer in chunks and push each record
+   with myring_push_rec(), exactly like an in-kernel producer would. A
+   record split by a chunk boundary is carried over to the next chunk. */
+#define INJECT_CHUNK  (2 * (sizeof(struct myring_rec_hdr) + MYRING_INJECT_MAX_PAYLOAD))
+
+static int myring_inject(struct myring_dev *d, struct myring_inject *inj)
+{
+  const uint8_t __user *ubuf = u64_to_user_ptr(inj->buf);
+  uint32_t done = 0, have = 0;
+  uint8_t *buf;
+  int ret = 0;
+
+  inj->records = inj->dropped = 0;
+  buf = kvmalloc(INJECT_CHUNK, GFP_KERNEL);
+  if (!buf) return -ENOMEM;
+
+  while (done < inj->len || have) {
+    uint32_t n = min_t(uint32_t, inj->len - done, INJECT_CHUNK - have);
+    uint32_t off = 0;
+
+    if (n && copy_from_user(buf + have, ubuf + done, n)) { ret = -EFAULT; break; }
+    done += n;
+    have += n;
+
+    while (have - off >= sizeof(struct myring_rec_hdr)) {
+      struct myring_rec_hdr hdr;
+      memcpy(&hdr, buf + off, sizeof(hdr));
+      if (!hdr.type || hdr.type == REC_TYPE_DROP || hdr.type == REC_TYPE_PAGE ||
+          hdr.len > MYRING_INJECT_MAX_PAYLOAD) {
+        ret = -EINVAL;
+        goto out;
+      }
+      if (have - off < sizeof(hdr) + hdr.len) break;
+      if (myring_push_rec(d, &hdr, buf + off + sizeof(hdr))) inj->records++;
+      else inj->dropped++;
+      off += sizeof(hdr) + hdr.len;
+    }
+    /* a partial record at the end of the buffer is malformed */
+    if (done == inj->len && off == 0 && have) { ret = -EINVAL; break; }
+    memmove(buf, buf + off, have - off);
+    have -= off;
+
+    if (fatal_signal_pending(current)) { ret = -EINTR; break; }
+    cond_resched();
+  }
+out:
+  kvfree(buf);
+  return ret;
+}
+
+static void myring_pages_fill(void *buf, uint32_t len, uint64_t seq)
+{
+  memset(buf, (int)seq, len);
+  if (len >= sizeof(seq)) memcpy(buf, &seq, sizeof(seq));
+}
+
+/* MYRING_IOC_PAGES: the same page-filling producer, then either a copy
+   into the ring or a flip, so the two can be compared record for record.
+   Spins (with cond_resched()) while the ring or the slots are full. */
+static int myring_pages_produce(struct myring_dev *d, struct myring_pages *pg)
+{
+  bool flip = pg->flags & MYRING_PAGES_FLIP;
+  struct myring_rec_hdr hdr = { .type = REC_TYPE_PKT, .len = pg->len };
+  struct page *src = NULL;
+  uint64_t t0;
+  int ret = 0;
+
+  pg->records = 0;
+  pg->ns = 0;
+  if (!pg->len || pg->len > PAGE_SIZE || (pg->flags & ~MYRING_PAGES_FLIP)) return -EINVAL;
+  if (flip && !d->nr_flip) return -EOPNOTSUPP;
+  if (READ_ONCE(d->user_prod)) return -EBUSY;
+  if (!flip) {
+    if (pg->len > rb_max_payload(d) || rb_rec_bytes(d, pg->len) > d->size) return -EINVAL;
+    src = alloc_page(GFP_KERNEL);
+    if (!src) return -ENOMEM;
+  }
+
+  t0 = ktime_get_ns();
+  while (pg->records < pg->count) {
+    uint64_t seq = pg->records + 1;
+    bool ok;
+
+    if (signal_pending(current)) { ret = -EINTR; break; }
+    if (flip) {
+      mutex_lock(&d->flip_mu);
+      ok = myring_flip_ready(d) &&
+           rb_free(d->ctrl) >= rb_rec_bytes(d, sizeof(struct myring_rec_page));
+      if (ok) {
+        myring_pages_fill(page_address(d->flip_spare), pg->len, seq);
+        ok = myring_flip(d, pg->len);
+      }
+      mutex_unlock(&d->flip_mu);
+    } else {
+      ok = rb_free(d->ctrl) >= rb_rec_bytes(d, pg->len);
+      if (ok) {
+        myring_pages_fill(page_address(src), pg->len, seq);
+        ok = myring_push_rec(d, &hdr, page_address(src));
+      }
+    }
+    if (ok) pg->records++;
+    else cond_resched();  /* full: let the consumer catch up */
+  }
+  pg->ns = ktime_get_ns() - t0;
+  if (src) __free_page(src);
+  return ret;
 }
 
-static bool myring_reserve(struct myring_ctrl *c, uint64_t need, uint64_t *pos_out)
+/* User producer (MYRING_IOC_SET_USER_PROD): a process writes records
+   and head through its own mapping, kernel producers drop. The kernel is
+   only on the path for wakeups, when a side that went to sleep asked for
+   one with a ctrl flag, see CTRL_FLAG_NEED_WAKEUP. Claiming and releasing
+   both start from an empty ring. Caller holds ioctl_mu. */
+static int myring_user_prod_set(struct myring_dev *d, struct file *owner)
 {
-  uint64_t head = smp_load_acquire(&c->head);
-  uint64_t tail = smp_load_acquire(&c->tail);
-  uint64_t free = c->size - (head - tail);
-  if (free < need) return false;
-  *pos_out = head;
-  return true;
+  if (owner && d->pages) return -EOPNOTSUPP;  /* user writes would find no pages */
+  if (owner && d->cap_task) return -EBUSY;     /* the kernel is the consumer */
+  if (owner && d->user_prod && d->user_prod != owner) return -EBUSY;
+
+  spin_lock_bh(&d->prod_lock);
+  WRITE_ONCE(d->user_prod, owner);
+  myring_ring_reset(d);
+  if (owner) {
+    /* user space commits head, so there is nothing to stamp */
+    rb_flags_clear(d->ctrl, CTRL_FLAG_STAMPS);
+    rb_flags_set(d->ctrl, CTRL_FLAG_USER_PROD);
+  } else {
+    rb_flags_clear(d->ctrl, CTRL_FLAG_USER_PROD);
+  }
+  spin_unlock_bh(&d->prod_lock);
+  myring_flip_reset(d);
+  printk(KERN_INFO "myring: %s producer is %s\n", d->name, owner ? "user space" : "the kernel");
+  return 0;
 }
 
-static void myring_write_bytes(struct myring_dev *d, uint64_t pos, const void *src, uint64_t len)
+/* Capture-to-file (MYRING_IOC_CAPTURE): a kthread per ring is its only
+   consumer. It sleeps until chunk_kb is queued (producers wake it from
+   myring_maybe_notify()) or flush_ms passes, writes the ring bytes
+   straight from ring memory with kernel_write(), ending each write on a
+   page boundary of the file, then advances tail itself.
+   No user process, copy or wakeup is involved. Record boundaries are
+   tracked by walking headers behind the writes, so a file is only ever
+   cut between records. The device is world-writable, so starting a
+   capture takes CAP_SYS_ADMIN, and every file, rotations included, is
+   opened under the starter's credentials rather than the kthread's. */
+
+static int myring_capture_open(struct myring_dev *d)
 {
-  uint64_t mask = d->size - 1; /* size is power-of-two */
-  uint64_t off = pos & mask;
-  uint64_t first = min_t(uint64_t, len, d->size - off);
-  memcpy(d->data + off, src, first);
-  if (len > first) memcpy(d->data, src + first, len - first);
+  uint32_t n = d->cap.max_files ? d->cap_files % d->cap.max_files : d->cap_files;
+  char *name = kasprintf(GFP_KERNEL, "%s.%u", d->cap.path, n);
+  const struct cred *old;
+  struct file *f;
+
+  if (!name) return -ENOMEM;
+  old = override_creds(d->cap_cred);
+  f = filp_open(name, O_WRONLY | O_CREAT | O_TRUNC | O_LARGEFILE, 0600);
+  revert_creds(old);
+  if (IS_ERR(f)) {
+    printk(KERN_ERR "myring: %s capture: open %s failed, ret=%ld\n", d->name, name, PTR_ERR(f));
+    kfree(name);
+    return PTR_ERR(f);
+  }
+  printk(KERN_INFO "myring: %s capturing to %s\n", d->name, name);
+  kfree(name);
+  d->cap_file = f;
+  d->cap_pos = 0;
+  d->cap_files++;
+  return 0;
 }
 
-static void myring_on_full(struct myring_ctrl *c)
+static void myring_capture_close(struct myring_dev *d)
 {
-  if (!(c->flags & CTRL_FLAG_DROPPING)) {
-    c->flags |= CTRL_FLAG_DROPPING;
-    c->drop_start_ns = ktime_get_ns();
-    c->lost_in_drop = 0;
-  }
-  c->lost_in_drop++;
+  if (!d->cap_file) return;
+  filp_close(d->cap_file, NULL);
+  d->cap_file = NULL;
 }
 
-static void myring_flush_drop_record(struct myring_dev *d)
+/* Write ring bytes [pos, pos + len) to the current file */
+static int myring_capture_write(struct myring_dev *d, uint64_t pos, uint64_t len)
 {
-  struct myring_ctrl *c = d->ctrl;
-  if (!(c->flags & CTRL_FLAG_DROPPING)) return;
+  uint64_t mask = d->size - 1;
 
-  struct myring_rec_hdr hdr = {
-    .type = REC_TYPE_DROP,
-    .flags = 0,
-    .len = sizeof(struct myring_rec_drop),
-    .ts_ns = ktime_get_ns(),
-  };
-  struct myring_rec_drop drop = {
-    .lost = (uint32_t)c->lost_in_drop,
-    .start_ns = c->drop_start_ns,
-    .end_ns = ktime_get_ns(),
-  };
-  uint64_t pos;
-  uint64_t need = sizeof(hdr) + sizeof(drop);
+  while (len) {
+    uint64_t off = pos & mask;
+    uint64_t n = min_t(uint64_t, len, d->size - off);
+    const void *src = d->data + off;
+    ssize_t w;
 
-  if (myring_reserve(c, need, &pos)) {
-    myring_write_bytes(d, pos, &hdr, sizeof(hdr));
-    myring_write_bytes(d, pos + sizeof(hdr), &drop, sizeof(drop));
-    rb_commit_head(c, pos + need);
-    c->flags &= ~CTRL_FLAG_DROPPING;
-    d->records++;
-    d->bytes += need;
+    if (d->pages) {
+      n = min_t(uint64_t, n, PAGE_SIZE - (off & ~PAGE_MASK));
+      src = page_address(d->pages[off >> PAGE_SHIFT]) + (off & ~PAGE_MASK);
+    }
+    w = kernel_write(d->cap_file, src, n, &d->cap_pos);
+    if (w < 0) return w;
+    if (!w) return -EIO;
+    pos += w;
+    len -= w;
+    d->cap_bytes += w;
   }
+  return 0;
 }
 
-/* Push a "packet" record into the ring (payload=payload,len) */
-static void myring_push_packet(struct myring_dev *d, const void *payload, uint32_t len)
+/* Move cap_rec to the first record boundary at or past upto (at most head) */
+static void myring_capture_walk(struct myring_dev *d, uint64_t upto, uint64_t head)
 {
-  struct myring_ctrl *c = d->ctrl;
-  uint64_t head_before = smp_load_acquire(&c->head);
-  uint64_t tail_before = smp_load_acquire(&c->tail);
-  uint64_t used_before = head_before - tail_before;
-  uint64_t free_before = c->size - used_before;
-  
-  struct myring_rec_hdr hdr = {
-    .type = REC_TYPE_PKT,
-    .flags = 0,
-    .len = len,
-    .ts_ns = ktime_get_ns(),
-  };
-  uint64_t pos;
-  uint64_t need = sizeof(hdr) + len;
-
-  printk(KERN_DEBUG "myring_push_packet: len=%u, need=%llu, free=%llu, head=%llu, tail=%llu\n",
-         len, need, free_before, head_before, tail_before);
-
-  if (!myring_reserve(c, need, &pos)) {
-    printk(KERN_WARNING "myring_push_packet: FULL - need=%llu > free=%llu, dropping packet\n",
-           need, free_before);
-    myring_on_full(c);
-    d->drops++;
-    return;
+  while (d->cap_rec < upto && d->cap_rec < head) {
+    struct myring_rec_hdr hdr;
+    myring_read_bytes(d, d->cap_rec, &hdr, sizeof(hdr));
+    d->cap_rec += rb_rec_bytes(d, hdr.len);
   }
+}
 
-  printk(KERN_DEBUG "myring_push_packet: reserved pos=%llu, writing packet\n", pos);
-
-  /* If we were dropping, emit the drop record first */
-  myring_flush_drop_record(d);
-
-  myring_write_bytes(d, pos, &hdr, sizeof(hdr));
-  myring_write_bytes(d, pos + sizeof(hdr), payload, len);
-  rb_commit_head(c, pos + need);
+/* Write out what is queued: at least chunk bytes, cut so the file offset
+   ends page aligned (the rest waits for the next write), or everything up
+   to head when flushing. A write after a flush realigns the file. */
+static int myring_capture_drain(struct myring_dev *d, bool flush)
+{
+  for (;;) {
+    uint64_t head = smp_load_acquire(&d->ctrl->head);
+    uint64_t tail = d->ctrl->tail;
+    uint64_t n = head - tail;
+    int ret;
+
+    if (!n || (!flush && n < d->cap_chunk)) return 0;
+    if (!flush) n = ((d->cap_pos + n) & PAGE_MASK) - d->cap_pos;
+
+    if (d->cap.rotate_bytes && d->cap_pos + n >= d->cap.rotate_bytes) {
+      /* finish this file on the first record boundary past the limit */
+      myring_capture_walk(d, tail + (d->cap.rotate_bytes > d->cap_pos ?
+                                     d->cap.rotate_bytes - d->cap_pos : 0), head);
+      n = d->cap_rec - tail;
+      if (n) {
+        ret = myring_capture_write(d, tail, n);
+        if (ret) return ret;
+      }
+      smp_store_release(&d->ctrl->tail, tail + n);
+      myring_maybe_notify(d, false);
+      myring_capture_close(d);
+      ret = myring_capture_open(d);
+      if (ret) return ret;
+      continue;
+    }
 
-  d->records++;
-  d->bytes += need;
-  
-  uint64_t head_after = pos + need;
-  printk(KERN_DEBUG "myring_push_packet: SUCCESS - head updated %llu->%llu, records=%llu, bytes=%llu\n",
-         head_before, head_after, d->records, d->bytes);
+    ret = myring_capture_write(d, tail, n);
+    if (ret) return ret;
+    myring_capture_walk(d, tail + n, head);  /* before the bytes can be reused */
+    smp_store_release(&d->ctrl->tail, tail + n);
+    myring_maybe_notify(d, false);
+    if (!flush) return 0;
+  }
+}
 
-  myring_maybe_notify(d);
+static int myring_capture_thread(void *arg)
+{
+  struct myring_dev *d = arg;
+  long timeout = msecs_to_jiffies(d->cap.flush_ms);
+
+  while (!kthread_should_stop()) {
+    long left = wait_event_interruptible_timeout(d->wq,
+                  kthread_should_stop() || rb_used(d->ctrl) >= d->cap_chunk, timeout);
+    int ret = myring_capture_drain(d, left == 0 || kthread_should_stop());
+    if (ret) {
+      printk(KERN_ERR "myring: %s capture stopped, ret=%d\n", d->name, ret);
+      d->cap_err = ret;
+      return myring_selftest_park();
+    }
+  }
+  d->cap_err = myring_capture_drain(d, true);
+  return 0;
 }
 
-/* Synthetic producer work */
-static void myring_prod_fn(struct work_struct *w)
+/* Caller holds ioctl_mu */
+static int myring_capture_start(struct myring_dev *d, const struct myring_capture *cap)
 {
-  struct myring_dev *d = container_of(to_delayed_work(w), struct myring_dev, prod_work);
-  if (d->stopping) return;
+  struct task_struct *t;
+  int ret;
 
-  /* Generate monotonic pattern payload */
-  uint8_t buf[256];
-  uint64_t *payload_u64 = (uint64_t*)buf;
-  
-  /* Header: timestamp + sequence number */
-  payload_u64[0] = ktime_get_ns();      /* timestamp */
-  payload_u64[1] = ++d->seq_number;     /* monotonic sequence */
-  
-  /* Generate predictable pattern based on sequence number */
-  for (int i = 2; i < sizeof(buf) / sizeof(uint64_t); i++) {
-    payload_u64[i] = d->seq_number * 0x123456789ABCDEF0ULL + i;
-  }
-  
-  /* Fill remaining bytes with sequence-based pattern */
-  for (int i = (sizeof(buf) / sizeof(uint64_t)) * sizeof(uint64_t); i < sizeof(buf); i++) {
-    buf[i] = (uint8_t)(d->seq_number + i);
+  if (d->cap_task) return -EBUSY;
+  if (d->user_prod) return -EBUSY;
+
+  d->cap = *cap;
+  d->cap.path[sizeof(d->cap.path) - 1] = 0;
+  if (d->cap.path[0] != '/') return -EINVAL;  /* rotation opens files from the kthread's cwd */
+  if (!d->cap.chunk_kb) d->cap.chunk_kb = 1024;
+  if (!d->cap.flush_ms) d->cap.flush_ms = 100;
+  d->cap_chunk = max_t(uint64_t, PAGE_SIZE, (uint64_t)d->cap.chunk_kb * 1024);
+  d->cap_chunk = min_t(uint64_t, d->cap_chunk, d->size / 2);
+  d->cap_files = 0;
+  d->cap_bytes = 0;
+  d->cap_err = 0;
+  d->cap_rec = d->ctrl->tail;
+  d->cap_cred = get_current_cred();
+  ret = myring_capture_open(d);
+  if (ret) goto err_cred;
+
+  t = kthread_run(myring_capture_thread, d, DRV_NAME "-cap%u", d->id);
+  if (IS_ERR(t)) {
+    myring_capture_close(d);
+    ret = PTR_ERR(t);
+    goto err_cred;
   }
-  
-  printk(KERN_DEBUG "myring_prod_fn: generating packet #%llu, timestamp=%llu\n",
-         d->seq_number, payload_u64[0]);
-  
-  myring_push_packet(d, buf, sizeof(buf));
+  WRITE_ONCE(d->cap_task, t);
+  return 0;
 
-  if (!d->stopping) {
-    unsigned long interval_ms = rate_hz ? max(1u, 1000u / rate_hz) : 1u;
-    schedule_delayed_work(&d->prod_work, msecs_to_jiffies(interval_ms));
+err_cred:
+  put_cred(d->cap_cred);
+  d->cap_cred = NULL;
+  return ret;
+}
+
+/* Flush, stop and report the totals in cap. Caller holds ioctl_mu. */
+static void myring_capture_stop(struct myring_dev *d, struct myring_capture *cap)
+{
+  if (!d->cap_task) return;
+  kthread_stop(d->cap_task);
+  WRITE_ONCE(d->cap_task, NULL);
+  myring_capture_close(d);
+  put_cred(d->cap_cred);
+  d->cap_cred = NULL;
+  printk(KERN_INFO "myring: %s capture done: %llu bytes in %u files, ret=%d\n",
+         d->name, d->cap_bytes, d->cap_files, d->cap_err);
+  if (cap) {
+    cap->error = d->cap_err;
+    cap->bytes = d->cap_bytes;
+    cap->files = d->cap_files;
   }
 }
 
@@ -277,13 +1863,21 @@ static void myring_prod_fn(struct work_struct *w)
 
 static int myring_open(struct inode *ino, struct file *f)
 {
-  printk(KERN_INFO "myring: device opened, vmem=%p, vmem_len=%zu\n", _this_dev.vmem, _this_dev.vmem_len);
-  f->private_data = &_this_dev;
+  /* misc_open() leaves the miscdevice in private_data */
+  struct myring_dev *d = container_of(f->private_data, struct myring_dev, misc);
+
+  printk(KERN_INFO "myring: %s opened, vmem=%p, vmem_len=%zu\n", d->name, d->vmem, d->vmem_len);
+  f->private_data = d;
   return 0;
 }
 
 static int myring_release(struct inode *ino, struct file *f)
 {
+  struct myring_dev *d = f->private_data;
+
+  mutex_lock(&d->ioctl_mu);
+  if (d->user_prod == f) myring_user_prod_set(d, NULL);
+  mutex_unlock(&d->ioctl_mu);
   return 0;
 }
 
@@ -294,6 +1888,29 @@ static long myring_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
 
   if (_IOC_TYPE(cmd) != MYRING_IOC_MAGIC) return -ENOTTY;
 
+  /* not under ioctl_mu: a long injection must not hold up ADVANCE_TAIL
+     from the ring's consumer */
+  if (cmd == MYRING_IOC_INJECT) {
+    struct myring_inject inj;
+    if (copy_from_user(&inj, (void __user *)arg, sizeof(inj))) return -EFAULT;
+    ret = myring_inject(d, &inj);
+    if (copy_to_user((void __user *)arg, &inj, sizeof(inj))) ret = -EFAULT;
+    return ret;
+  }
+  /* the user IPC fast path: one wakeup, nothing else */
+  if (cmd == MYRING_IOC_NOTIFY) {
+    if (!READ_ONCE(d->user_prod)) return -EINVAL;
+    myring_signal(d);
+    return 0;
+  }
+  if (cmd == MYRING_IOC_PAGES) {
+    struct myring_pages pg;
+    if (copy_from_user(&pg, (void __user *)arg, sizeof(pg))) return -EFAULT;
+    ret = myring_pages_produce(d, &pg);
+    if (copy_to_user((void __user *)arg, &pg, sizeof(pg))) ret = -EFAULT;
+    return ret;
+  }
+
   mutex_lock(&d->ioctl_mu);
   switch (cmd) {
     case MYRING_IOC_SET_WM: {
@@ -330,23 +1947,26 @@ static long myring_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
     case MYRING_IOC_ADVANCE_TAIL: {
       struct myring_advance adv;
       if (copy_from_user(&adv, (void __user *)arg, sizeof(adv))) { ret = -EFAULT; break; }
+      if (d->cap_task) { ret = -EBUSY; break; }  /* the capture thread consumes */
       /* allow user to advance up to head */
       uint64_t head = smp_load_acquire(&d->ctrl->head);
       uint64_t tail = smp_load_acquire(&d->ctrl->tail);
       if (adv.new_tail > head) { ret = -EINVAL; break; }
       if (adv.new_tail < tail) { ret = -EINVAL; break; }
       smp_store_release(&d->ctrl->tail, adv.new_tail);
-      myring_maybe_notify(d); /* may drop below lo% */
+      myring_maybe_notify(d, false); /* may drop below lo% */
       break;
     }
     case MYRING_IOC_RESET: {
+      if (d->cap_task) { ret = -EBUSY; break; }  /* stop the capture first */
+      /* producers reserve and commit under prod_lock */
+      spin_lock_bh(&d->prod_lock);
       d->drops = d->records = d->bytes = 0;
-      d->above_hi = false;
-      d->ctrl->head = 0;
-      d->ctrl->tail = 0;
-      d->ctrl->flags = 0;
-      d->ctrl->drop_start_ns = 0;
-      d->ctrl->lost_in_drop = 0;
+      myring_ring_reset(d);
+      spin_unlock_bh(&d->prod_lock);
+      myring_flip_reset(d);
+      /* a parked user producer or consumer kept its wait bit: re-check */
+      myring_signal(d);
       break;
     }
     case MYRING_IOC_GET_CONFIG: {
@@ -366,6 +1986,66 @@ static long myring_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
       /* The new rate will take effect on the next work scheduling cycle */
       break;
     }
+    case MYRING_IOC_SELFTEST: {
+      struct myring_selftest st;
+      if (copy_from_user(&st, (void __user *)arg, sizeof(st))) { ret = -EFAULT; break; }
+      if (d->user_prod || d->cap_task) { ret = -EBUSY; break; }
+      ret = myring_selftest(d, &st);
+      if (!ret && copy_to_user((void __user *)arg, &st, sizeof(st))) ret = -EFAULT;
+      break;
+    }
+    case MYRING_IOC_SET_ROUTE: {
+      struct myring_route r;
+      if (copy_from_user(&r, (void __user *)arg, sizeof(r))) { ret = -EFAULT; break; }
+      ret = myring_set_route(&r);
+      break;
+    }
+    case MYRING_IOC_SET_USER_PROD: {
+      uint32_t on;
+      if (copy_from_user(&on, (void __user *)arg, sizeof(on))) { ret = -EFAULT; break; }
+      if (!on && d->user_prod != f) { ret = d->user_prod ? -EPERM : 0; break; }
+      ret = myring_user_prod_set(d, on ? f : NULL);
+      break;
+    }
+    case MYRING_IOC_SET_STAMPS: {
+      uint32_t on;
+      if (copy_from_user(&on, (void __user *)arg, sizeof(on))) { ret = -EFAULT; break; }
+      if (on && d->user_prod) { ret = -EOPNOTSUPP; break; }  /* user space commits head */
+      spin_lock_bh(&d->prod_lock);
+      if (on) {
+        /* stamp_seq only grows: readers may still be walking the log */
+        d->ctrl->notify_ns = 0;
+        d->ctrl->notify_head = 0;
+        rb_flags_set(d->ctrl, CTRL_FLAG_STAMPS);
+      } else {
+        rb_flags_clear(d->ctrl, CTRL_FLAG_STAMPS);
+      }
+      spin_unlock_bh(&d->prod_lock);
+      break;
+    }
+    case MYRING_IOC_CAPTURE: {
+      struct myring_capture cap;
+      if (!capable(CAP_SYS_ADMIN)) { ret = -EPERM; break; }
+      if (copy_from_user(&cap, (void __user *)arg, sizeof(cap))) { ret = -EFAULT; break; }
+      if (cap.path[0]) {
+        ret = myring_capture_start(d, &cap);
+        break;
+      }
+      if (!d->cap_task) { ret = -ENOENT; break; }
+      myring_capture_stop(d, &cap);
+      if (copy_to_user((void __user *)arg, &cap, sizeof(cap))) ret = -EFAULT;
+      break;
+    }
+    case MYRING_IOC_SET_NF_HOOKS: {
+#ifdef USE_NETFILTER
+      uint32_t mask;
+      if (copy_from_user(&mask, (void __user *)arg, sizeof(mask))) { ret = -EFAULT; break; }
+      ret = myring_nf_set(mask);
+#else
+      ret = -EOPNOTSUPP;
+#endif
+      break;
+    }
     default:
       ret = -ENOTTY;
   }
@@ -378,11 +2058,224 @@ static __poll_t myring_poll(struct file *f, poll_table *wait)
   struct myring_dev *d = f->private_data;
   poll_wait(f, &d->wq, wait);
 
+  if (READ_ONCE(d->user_prod)) {
+    /* readable with any record, writable at or below the low watermark */
+    uint64_t used = rb_used(d->ctrl);
+    __poll_t mask = 0;
+    if (used) mask |= EPOLLIN | EPOLLRDNORM;
+    if (rb_pct(used, d->ctrl->size) <= d->ctrl->lo_pct) mask |= EPOLLOUT | EPOLLWRNORM;
+    return mask;
+  }
   if (rb_pct(rb_used(d->ctrl), d->ctrl->size) >= d->ctrl->hi_pct)
     return EPOLLIN | EPOLLRDNORM;
   return 0;
 }
 
+/* ring_pages: mapping and reclaim.
+   User mappings are populated by myring_vm_fault(), one page at a time.
+   Under memory pressure the shrinker frees data pages outside the
+   [tail, head] window of rings that have sat at or below reclaim_pct for
+   reclaim_idle_ms. A page is first marked MYRING_PAGE_RECLAIMING, so the
+   producer treats it as full (drops) and faults retry; it is zapped from
+   user page tables with the page locked, which orders the zap against a
+   concurrent fault; only then is the slot cleared and the page put. The
+   producer allocates a fresh zeroed page when it next writes there. */
+
+/* Pages spanned by [tail, head], always kept */
+static unsigned long myring_window_pages(uint64_t head, uint64_t tail)
+{
+  return (unsigned long)((head >> PAGE_SHIFT) - (tail >> PAGE_SHIFT) + 1);
+}
+
+static bool myring_reclaim_idle(struct myring_dev *d)
+{
+  uint64_t low = READ_ONCE(d->low_since_ns);
+  return low && ktime_get_ns() - low >= (uint64_t)READ_ONCE(reclaim_idle_ms) * NSEC_PER_MSEC;
+}
+
+#define RECLAIM_BATCH 32
+
+static unsigned long myring_reclaim(struct myring_dev *d, unsigned long nr)
+{
+  unsigned long freed = 0;
+
+  while (freed < nr && myring_reclaim_idle(d)) {
+    struct page *victim[RECLAIM_BATCH];
+    unsigned long idx[RECLAIM_BATCH];
+    unsigned int n = 0;
+
+    /* oldest consumed pages first: the producer reaches them last */
+    spin_lock_bh(&d->prod_lock);
+    uint64_t head = d->ctrl->head;
+    uint64_t tail = smp_load_acquire(&d->ctrl->tail);
+    unsigned long window = myring_window_pages(head, tail);
+    for (unsigned long i = 1; window + i <= d->nr_pages && n < RECLAIM_BATCH && freed + n < nr; i++) {
+      unsigned long k = ((tail >> PAGE_SHIFT) - i) & (d->nr_pages - 1);
+      struct page *page = d->pages[k];
+      if (!page || page == MYRING_PAGE_RECLAIMING) continue;
+      d->pages[k] = MYRING_PAGE_RECLAIMING;
+      victim[n] = page;
+      idx[n++] = k;
+    }
+    spin_unlock_bh(&d->prod_lock);
+    if (!n) break;
+
+    for (unsigned int i = 0; i < n; i++) {
+      lock_page(victim[i]);
+      if (d->mapping)
+        unmap_mapping_range(d->mapping, (loff_t)(idx[i] + 1) << PAGE_SHIFT, PAGE_SIZE, 1);
+      unlock_page(victim[i]);
+    }
+
+    spin_lock_bh(&d->prod_lock);
+    for (unsigned int i = 0; i < n; i++) d->pages[idx[i]] = NULL;
+    d->nr_present -= n;
+    spin_unlock_bh(&d->prod_lock);
+
+    for (unsigned int i = 0; i < n; i++) put_page(victim[i]);
+    freed += n;
+  }
+  return freed;
+}
+
+static unsigned long myring_shrink_count(struct shrinker *sh, struct shrink_control *sc)
+{
+  unsigned long count = 0;
+
+  for (unsigned int i = 0; i < nr_rings; i++) {
+    struct myring_dev *d = &myring_devs[i];
+    unsigned long present, window;
+
+    if (!d->pages || !myring_reclaim_idle(d)) continue;
+    present = READ_ONCE(d->nr_present);
+    window = myring_window_pages(READ_ONCE(d->ctrl->head), READ_ONCE(d->ctrl->tail));
+    if (present > window) count += present - window;
+  }
+  return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long myring_shrink_scan(struct shrinker *sh, struct shrink_control *sc)
+{
+  unsigned long freed = 0;
+
+  /* lock_page() and unmap_mapping_range() sleep */
+  if (!gfpflags_allow_blocking(sc->gfp_mask)) return SHRINK_STOP;
+  for (unsigned int i = 0; i < nr_rings && freed < sc->nr_to_scan; i++) {
+    if (myring_devs[i].pages)
+      freed += myring_reclaim(&myring_devs[i], sc->nr_to_scan - freed);
+  }
+  return freed ? freed : SHRINK_STOP;
+}
+
+#ifdef COMPAT_SHRINKER_ALLOC
+static struct shrinker *myring_shrinker;
+#else
+static struct shrinker myring_shrinker_s = {
+  .count_objects = myring_shrink_count,
+  .scan_objects = myring_shrink_scan,
+  .seeks = DEFAULT_SEEKS,
+};
+#endif
+
+static int myring_shrinker_register(void)
+{
+#ifdef COMPAT_SHRINKER_ALLOC
+  myring_shrinker = shrinker_alloc(0, DRV_NAME);
+  if (!myring_shrinker) return -ENOMEM;
+  myring_shrinker->count_objects = myring_shrink_count;
+  myring_shrinker->scan_objects = myring_shrink_scan;
+  shrinker_register(myring_shrinker);
+  return 0;
+#else
+  return COMPAT_REGISTER_SHRINKER(&myring_shrinker_s);
+#endif
+}
+
+static void myring_shrinker_unregister(void)
+{
+#ifdef COMPAT_SHRINKER_ALLOC
+  shrinker_free(myring_shrinker);
+#else
+  unregister_shrinker(&myring_shrinker_s);
+#endif
+}
+
+static vm_fault_t myring_vm_fault(struct vm_fault *vmf)
+{
+  struct myring_dev *d = vmf->vma->vm_private_data;
+  struct page *page, *fresh = NULL;
+  unsigned long idx;
+
+  if (vmf->pgoff == 0) {
+    page = virt_to_page(d->ctrl);
+    get_page(page);
+    vmf->page = page;
+    return 0;
+  }
+  idx = vmf->pgoff - 1;
+  if (idx >= d->nr_pages) return VM_FAULT_SIGBUS;
+
+  /* outside [tail, head] a page may be missing; map a zeroed one */
+  if (!READ_ONCE(d->pages[idx])) {
+    fresh = alloc_page(GFP_KERNEL | __GFP_ZERO);
+    if (!fresh) return VM_FAULT_OOM;
+  }
+  spin_lock_bh(&d->prod_lock);
+  page = d->pages[idx];
+  if (!page && fresh) {
+    d->pages[idx] = page = fresh;
+    d->nr_present++;
+    fresh = NULL;
+  }
+  if (page && page != MYRING_PAGE_RECLAIMING) get_page(page);
+  spin_unlock_bh(&d->prod_lock);
+  if (fresh) __free_page(fresh);
+
+  if (!page || page == MYRING_PAGE_RECLAIMING)
+    return VM_FAULT_NOPAGE;  /* being reclaimed: retry the access */
+
+  /* recheck under the page lock myring_reclaim() zaps with */
+  lock_page(page);
+  if (READ_ONCE(d->pages[idx]) != page) {
+    unlock_page(page);
+    put_page(page);
+    return VM_FAULT_NOPAGE;
+  }
+  vmf->page = page;
+  return VM_FAULT_LOCKED;
+}
+
+static const struct vm_operations_struct myring_vm_ops = {
+  .fault = myring_vm_fault,
+};
+
+/* Flip window: slot i at MYRING_OFF_FLIP + i pages, see myring_flip() */
+static vm_fault_t myring_flip_fault(struct vm_fault *vmf)
+{
+  struct myring_dev *d = vmf->vma->vm_private_data;
+  unsigned long idx = vmf->pgoff - (MYRING_OFF_FLIP >> PAGE_SHIFT);
+  struct page *page;
+
+  if (idx >= d->nr_flip) return VM_FAULT_SIGBUS;
+
+  /* slot pages only change places with the spare and are freed at
+     unload, so the reference can't go stale */
+  page = READ_ONCE(d->flip[idx]);
+  get_page(page);
+  lock_page(page);
+  if (READ_ONCE(d->flip[idx]) != page) {
+    unlock_page(page);
+    put_page(page);
+    return VM_FAULT_NOPAGE;
+  }
+  vmf->page = page;
+  return VM_FAULT_LOCKED;
+}
+
+static const struct vm_operations_struct myring_flip_vm_ops = {
+  .fault = myring_flip_fault,
+};
+
 static int myring_mmap(struct file *f, struct vm_area_struct *vma)
 {
   struct myring_dev *d = f->private_data;
@@ -407,11 +2300,38 @@ static int myring_mmap(struct file *f, struct vm_area_struct *vma)
     return -ENOMEM;
   }
 
+  if (vma->vm_pgoff == MYRING_OFF_FLIP >> PAGE_SHIFT) {
+    /* flips zap through one address_space, like reclaim */
+    if (!d->nr_flip || len > (size_t)d->nr_flip << PAGE_SHIFT) return -EINVAL;
+    if (d->mapping && d->mapping != f->f_mapping) return -EBUSY;
+    /* read-only for good: mprotect(PROT_WRITE) must not reach the pages */
+    if (vma->vm_flags & VM_WRITE) return -EPERM;
+    d->mapping = f->f_mapping;
+    COMPAT_VM_FLAGS_SET(vma, VM_DONTEXPAND | VM_DONTDUMP);
+    COMPAT_VM_FLAGS_CLEAR(vma, VM_MAYWRITE);
+    vma->vm_ops = &myring_flip_vm_ops;
+    vma->vm_private_data = d;
+    printk(KERN_INFO "myring: mmap SUCCESS (flip window, %u slots)\n", d->nr_flip);
+    return 0;
+  }
+
   if (len > d->vmem_len) {
     printk(KERN_ERR "myring: mmap failed - len %zu > vmem_len %zu\n", len, d->vmem_len);
     return -EINVAL;
   }
 
+  if (d->pages) {
+    /* reclaim zaps through one address_space, so every mapping has to
+       come through the same device node */
+    if (d->mapping && d->mapping != f->f_mapping) return -EBUSY;
+    d->mapping = f->f_mapping;
+    COMPAT_VM_FLAGS_SET(vma, VM_DONTEXPAND | VM_DONTDUMP);
+    vma->vm_ops = &myring_vm_ops;
+    vma->vm_private_data = d;
+    printk(KERN_INFO "myring: mmap SUCCESS (page array, mapped on fault)\n");
+    return 0;
+  }
+
   //printk(KERN_INFO "myring: setting VM flags\n");
   //COMPAT_VM_FLAGS_SET(vma, VM_DONTEXPAND | VM_DONTDUMP);
 
@@ -475,138 +2395,261 @@ static const struct file_operations myring_fops = {
 
 /* Init & Exit */
 
-static int __init myring_init(void)
+static void myring_free_ring(struct myring_dev *d)
+{
+  myring_flip_free(d);
+  if (d->pages) {
+    for (unsigned long i = 0; i < d->nr_pages; i++)
+      if (d->pages[i]) put_page(d->pages[i]);
+    kvfree(d->pages);
+    d->pages = NULL;
+    free_page((unsigned long)d->vmem);
+    d->vmem = NULL;
+    return;
+  }
+  if (!d->vmem) return;
+  if (d->use_free_pages) {
+    unsigned int order = get_order(d->vmem_len);
+    free_pages((unsigned long)d->vmem, order);
+  } else if (d->dma_handle != 0) {
+    dma_free_coherent(d->dev, d->vmem_len, d->vmem, d->dma_handle);
+  } else {
+    vfree(d->vmem);
+  }
+  d->vmem = NULL;
+}
+
+/* Allocate ring instance id and register its misc device */
+static int myring_dev_init(struct myring_dev *d, uint32_t id)
 {
   int ret;
   size_t data_sz = 1ull << ring_order;
   size_t total = PAGE_SIZE + data_sz;
 
-  printk(KERN_INFO "myring: initializing module, ring_order=%u, data_sz=%zu, total=%zu\n", 
-         ring_order, data_sz, total);
+  printk(KERN_INFO "myring: initializing ring %u, ring_order=%u, data_sz=%zu, total=%zu\n", 
+         id, ring_order, data_sz, total);
 
-  memset(&_this_dev, 0, sizeof(_this_dev));
-  init_waitqueue_head(&_this_dev.wq);
-  mutex_init(&_this_dev.ioctl_mu);
+  memset(d, 0, sizeof(*d));
+  d->id = id;
+  if (id) snprintf(d->name, sizeof(d->name), DRV_NAME "%u", id);
+  else strscpy(d->name, DRV_NAME, sizeof(d->name));
+  init_waitqueue_head(&d->wq);
+  mutex_init(&d->ioctl_mu);
+  spin_lock_init(&d->prod_lock);
 
   /* Try multiple allocation strategies for physically contiguous memory */
-  _this_dev.dev = NULL;
-  _this_dev.use_free_pages = false;
-  _this_dev.vmem = NULL;
+  d->dev = NULL;
+  d->use_free_pages = false;
+  d->vmem = NULL;
   
   unsigned int order = get_order(total);
   printk(KERN_INFO "myring: trying to allocate %zu bytes (order %u)\n", total, order);
+
+  /* ring_pages: ctrl page plus an empty page array, filled on first write */
+  if (ring_pages) {
+    if (data_sz < PAGE_SIZE) return -EINVAL;
+    d->nr_pages = data_sz >> PAGE_SHIFT;
+    d->pages = kvcalloc(d->nr_pages, sizeof(*d->pages), GFP_KERNEL);
+    d->vmem = (void *)get_zeroed_page(GFP_KERNEL);
+    if (!d->pages || !d->vmem) {
+      kvfree(d->pages);
+      d->pages = NULL;
+      free_page((unsigned long)d->vmem);
+      return -ENOMEM;
+    }
+    printk(KERN_INFO "myring: page array for %lu pages, populated on use\n", d->nr_pages);
+  }
   
   /* Strategy 1: __get_free_pages with reduced flags */
-  if (order <= 10) { /* Only try for reasonable sizes */
+  if (!d->vmem && order <= 10) { /* Only try for reasonable sizes */
     unsigned long page = __get_free_pages(GFP_KERNEL, order);
     if (page) {
-      _this_dev.vmem = (void*)page;
-      _this_dev.dma_handle = virt_to_phys(_this_dev.vmem);
-      _this_dev.use_free_pages = true;
-      memset(_this_dev.vmem, 0, total);
+      d->vmem = (void*)page;
+      d->dma_handle = virt_to_phys(d->vmem);
+      d->use_free_pages = true;
+      memset(d->vmem, 0, total);
       printk(KERN_INFO "myring: __get_free_pages succeeded, vmem=%p, phys_addr=0x%llx, order=%u\n", 
-             _this_dev.vmem, (unsigned long long)_this_dev.dma_handle, order);
+             d->vmem, (unsigned long long)d->dma_handle, order);
     }
   }
   
   /* Strategy 2: Try DMA coherent allocation */
-  if (!_this_dev.vmem) {
-    _this_dev.vmem = dma_alloc_coherent(NULL, total, &_this_dev.dma_handle, GFP_KERNEL);
-    if (_this_dev.vmem) {
-      _this_dev.use_free_pages = false;
+  if (!d->vmem) {
+    d->vmem = dma_alloc_coherent(NULL, total, &d->dma_handle, GFP_KERNEL);
+    if (d->vmem) {
+      d->use_free_pages = false;
       printk(KERN_INFO "myring: dma_alloc_coherent succeeded, vmem=%p, dma_handle=0x%llx\n", 
-             _this_dev.vmem, (unsigned long long)_this_dev.dma_handle);
+             d->vmem, (unsigned long long)d->dma_handle);
     }
   }
   
   /* Strategy 3: Fallback to vmalloc (not physically contiguous but works) */
-  if (!_this_dev.vmem) {
+  if (!d->vmem) {
     printk(KERN_WARNING "myring: contiguous allocation failed, falling back to vmalloc\n");
     printk(KERN_WARNING "myring: WARNING - memory will NOT be physically contiguous for DMA\n");
-    _this_dev.vmem = vzalloc(total);
-    if (_this_dev.vmem) {
-      _this_dev.dma_handle = 0; /* Invalid for DMA */
-      _this_dev.use_free_pages = false;
-      printk(KERN_INFO "myring: vmalloc succeeded, vmem=%p (NOT DMA-suitable)\n", _this_dev.vmem);
+    d->vmem = vzalloc(total);
+    if (d->vmem) {
+      d->dma_handle = 0; /* Invalid for DMA */
+      d->use_free_pages = false;
+      printk(KERN_INFO "myring: vmalloc succeeded, vmem=%p (NOT DMA-suitable)\n", d->vmem);
     }
   }
   
-  if (!_this_dev.vmem) {
+  if (!d->vmem) {
     printk(KERN_ERR "myring: all allocation strategies failed\n");
     return -ENOMEM;
   }
-  _this_dev.vmem_len = total;
-  _this_dev.ctrl = (struct myring_ctrl *)_this_dev.vmem;
-  _this_dev.data = (uint8_t*)_this_dev.vmem + PAGE_SIZE;
-  _this_dev.size = data_sz;
-  printk(KERN_INFO "myring: _this_dev.vmem_len=%zu, _this_dev.size=%zu, data_sz=%zu\n", _this_dev.vmem_len, _this_dev.size, data_sz);
-  printk(KERN_INFO "myring: Pointer layout: vmem=%p, ctrl=%p, data=%p\n", _this_dev.vmem, _this_dev.ctrl, _this_dev.data);
+  d->vmem_len = total;
+  d->ctrl = (struct myring_ctrl *)d->vmem;
+  d->data = d->pages ? NULL : (uint8_t*)d->vmem + PAGE_SIZE;
+  d->size = data_sz;
+  printk(KERN_INFO "myring: vmem_len=%zu, size=%zu, data_sz=%zu\n", d->vmem_len, d->size, data_sz);
+  printk(KERN_INFO "myring: Pointer layout: vmem=%p, ctrl=%p, data=%p\n", d->vmem, d->ctrl, d->data);
   printk(KERN_INFO "myring: Pointer arithmetic: vmem + PAGE_SIZE(%lu) = %p (should equal data)\n", 
-         PAGE_SIZE, ((uint8_t*)_this_dev.vmem) + PAGE_SIZE);
+         PAGE_SIZE, ((uint8_t*)d->vmem) + PAGE_SIZE);
   printk(KERN_INFO "myring: Data pointer offset: %ld bytes from vmem\n", 
-         (long)((uint8_t*)_this_dev.data - (uint8_t*)_this_dev.vmem));
-
-  _this_dev.ctrl->head = 0;
-  _this_dev.ctrl->tail = 0;
-  _this_dev.ctrl->size = data_sz;
-  printk(KERN_INFO "myring: initialized ctrl->size=%llu (should be data_sz=%zu)\n", _this_dev.ctrl->size, data_sz);
-  _this_dev.ctrl->hi_pct = 50;
-  _this_dev.ctrl->lo_pct = 30;
-  _this_dev.ctrl->flags = 0;
-
-  _this_dev.misc.minor = MISC_DYNAMIC_MINOR;
-  _this_dev.misc.name = DRV_NAME;
-  _this_dev.misc.fops = &myring_fops;
-  _this_dev.misc.mode = 0666;
-
-  printk(KERN_INFO "myring: registering misc device, name=%s\n", _this_dev.misc.name);
-  ret = misc_register(&_this_dev.misc);
+         (long)((uint8_t*)d->data - (uint8_t*)d->vmem));
+
+  d->ctrl->head = 0;
+  d->ctrl->tail = 0;
+  d->ctrl->size = data_sz;
+  printk(KERN_INFO "myring: initialized ctrl->size=%llu (should be data_sz=%zu)\n", d->ctrl->size, data_sz);
+  d->ctrl->hi_pct = 50;
+  d->ctrl->lo_pct = 30;
+  d->ctrl->flags = 0;
+  d->ctrl->ring_id = id;
+  d->ctrl->nr_rings = nr_rings;
+  d->slot_size = slot_size;
+  d->ctrl->slot_size = slot_size;
+
+  ret = myring_flip_init(d);
+  if (ret) {
+    printk(KERN_ERR "myring: flip page allocation failed, ret=%d\n", ret);
+    myring_free_ring(d);
+    return ret;
+  }
+
+  d->misc.minor = MISC_DYNAMIC_MINOR;
+  d->misc.name = d->name;
+  d->misc.fops = &myring_fops;
+  d->misc.mode = 0666;
+
+  printk(KERN_INFO "myring: registering misc device, name=%s\n", d->misc.name);
+  ret = misc_register(&d->misc);
   if (ret) {
     printk(KERN_ERR "myring: misc_register failed, ret=%d\n", ret);
-    if (_this_dev.vmem) {
-      if (_this_dev.use_free_pages) {
-        unsigned int order = get_order(_this_dev.vmem_len);
-        free_pages((unsigned long)_this_dev.vmem, order);
-      } else if (_this_dev.dma_handle != 0) {
-        dma_free_coherent(_this_dev.dev, _this_dev.vmem_len, _this_dev.vmem, _this_dev.dma_handle);
-      } else {
-        vfree(_this_dev.vmem);
-      }
-    }
+    myring_free_ring(d);
     return ret;
   }
   printk(KERN_INFO "myring: misc device registered successfully\n");
 
-  /* start synthetic producer */
-  INIT_DELAYED_WORK(&_this_dev.prod_work, myring_prod_fn);
-  _this_dev.stopping = false;
-  _this_dev.seq_number = 0;  /* Initialize sequence counter */
-  schedule_delayed_work(&_this_dev.prod_work, msecs_to_jiffies(100));
+  ret = myring_stage_init(d);
+  if (ret) {
+    printk(KERN_ERR "myring: per-CPU staging allocation failed, ret=%d\n", ret);
+    myring_stage_free(d);
+    misc_deregister(&d->misc);
+    myring_free_ring(d);
+    return ret;
+  }
 
-  pr_info(DRV_NAME ": loaded, ring=%zu bytes, dev=/dev/%s\n", data_sz, _this_dev.misc.name);
   return 0;
 }
 
-static void __exit myring_exit(void)
+static void myring_dev_exit(struct myring_dev *d)
+{
+  mutex_lock(&d->ioctl_mu);
+  myring_capture_stop(d, NULL);
+  mutex_unlock(&d->ioctl_mu);
+  myring_stage_free(d);
+  if (d->evt) {
+    eventfd_ctx_put(d->evt);
+    d->evt = NULL;
+  }
+  misc_deregister(&d->misc);
+  myring_free_ring(d);
+}
+
+static int __init myring_init(void)
 {
-  _this_dev.stopping = true;
-  cancel_delayed_work_sync(&_this_dev.prod_work);
+  unsigned int i;
+  int ret;
 
-  if (_this_dev.evt) {
-    eventfd_ctx_put(_this_dev.evt);
-    _this_dev.evt = NULL;
+  if (!nr_rings || nr_rings > MYRING_MAX_RINGS) {
+    printk(KERN_ERR "myring: nr_rings=%u out of range 1..%u\n", nr_rings, MYRING_MAX_RINGS);
+    return -EINVAL;
   }
-  misc_deregister(&_this_dev.misc);
-  if (_this_dev.vmem) {
-    if (_this_dev.use_free_pages) {
-      unsigned int order = get_order(_this_dev.vmem_len);
-      free_pages((unsigned long)_this_dev.vmem, order);
-    } else if (_this_dev.dma_handle != 0) {
-      dma_free_coherent(_this_dev.dev, _this_dev.vmem_len, _this_dev.vmem, _this_dev.dma_handle);
-    } else {
-      vfree(_this_dev.vmem);
+  if (slot_size && (!is_power_of_2(slot_size) || slot_size < 64 ||
+                    slot_size > (1ull << ring_order))) {
+    printk(KERN_ERR "myring: slot_size=%u must be a power of two, 64..ring size\n", slot_size);
+    return -EINVAL;
+  }
+  if (flip_pages > 65536) {
+    printk(KERN_ERR "myring: flip_pages=%u out of range 0..65536\n", flip_pages);
+    return -EINVAL;
+  }
+  for (i = 0; i < nr_rings; i++) {
+    ret = myring_dev_init(&myring_devs[i], i);
+    if (ret) goto err_devs;
+  }
+  if (ring_pages) {
+    ret = myring_shrinker_register();
+    if (ret) {
+      printk(KERN_ERR "myring: shrinker registration failed, ret=%d\n", ret);
+      goto err_devs;
     }
   }
+
+#ifdef USE_NETFILTER
+  ret = myring_nf_set(nf_hooks);
+  if (ret) goto err_shrinker;
+#endif
+
+#ifdef USE_BPF_KFUNC
+  ret = myring_register_kfuncs();
+  if (ret) {
+    printk(KERN_ERR "myring: kfunc registration failed, ret=%d\n", ret);
+    goto err_nf;
+  }
+#endif
+
+  /* start synthetic producer */
+  INIT_DELAYED_WORK(&_src.prod_work, myring_prod_fn);
+  _src.stopping = false;
+  _src.seq_number = 0;  /* Initialize sequence counter */
+  if (prod_kthread) {
+    ret = myring_start_prod_thread();
+    if (ret) goto err_nf;
+  } else {
+    myring_schedule_prod(msecs_to_jiffies(100));
+  }
+
+  pr_info(DRV_NAME ": loaded, %u ring(s) of %llu bytes, dev=/dev/%s\n",
+          nr_rings, 1ull << ring_order, myring_devs[0].misc.name);
+  return 0;
+
+err_nf:
+#ifdef USE_NETFILTER
+  myring_nf_set(0);
+err_shrinker:  /* only the netfilter setup jumps here */
+#endif
+  if (ring_pages) myring_shrinker_unregister();
+err_devs:
+  while (i--) myring_dev_exit(&myring_devs[i]);
+  return ret;
+}
+
+static void __exit myring_exit(void)
+{
+  _src.stopping = true;
+#ifdef USE_NETFILTER
+  myring_nf_set(0);
+#endif
+  if (_src.prod_task) kthread_stop(_src.prod_task);
+  cancel_delayed_work_sync(&_src.prod_work);
+  if (ring_pages) myring_shrinker_unregister();
+
+  for (unsigned int i = 0; i < nr_rings; i++)
+    myring_dev_exit(&myring_devs[i]);
   pr_info(DRV_NAME ": unloaded\n");
 }
 
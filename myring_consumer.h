@@ -0,0 +1,1371 @@
+// SPDX-License-Identifier: MIT
+// myring consumer library (header-only)
+// - maps /dev/myring (or attaches to any ctrl+data block already in memory)
+// - walks records zero-copy, reassembling only the ones that wrap
+// - MYRING_DEFINE_DRAIN() builds a drain loop with the per-type handlers
+//   inlined into one switch, so dispatch is a jump table instead of calls
+//   through function pointers
+// - myring_decode_batch() scatters a batch of headers into column arrays
+//   (structure-of-arrays) so filters/aggregates can run as vector loops
+// - optional software prefetch of the next K cache lines (bounded by head)
+//   ahead of the record being handled
+// - myring_set_sched() / struct myring_hist: real-time consumer threads and
+//   the latency percentiles used to judge them
+// - struct myring_producer: a user process as the ring's producer, for
+//   process-to-process records with a syscall only to wake a sleeping peer
+// - struct myring_merge: records of several rings in global ts_ns order,
+//   through a small heap and a bounded reorder window
+// - struct myring_sketch: heavy hitters in fixed memory (count-min sketch
+//   plus a space-saving top-K), updated per record from a drain loop
+// - struct myring_breakdown: per-stage latency (queue, notify, wakeup,
+//   process) from the kernel's commit and notify stamps
+// - struct myring_capfile: capture files read through the same consumer
+//   and drain loops as a live ring, split at record boundaries
+// - struct myring_flow_key: the 5-tuple of a PKT_META record
+// - USDT probes (provider "myring") at batch start/end, wakeup, tail
+//   advance and DROP records, compiled in whenever <sys/sdt.h> is present
+
+#ifndef _MYRING_CONSUMER_H_
+#define _MYRING_CONSUMER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "myring_uapi.h"
+
+#define MYRING_ALWAYS_INLINE inline __attribute__((always_inline))
+
+#ifndef MYRING_CACHE_LINE
+#define MYRING_CACHE_LINE 64
+#endif
+
+/* USDT probes. With <sys/sdt.h> (systemtap-sdt-dev / systemtap-sdt-devel)
+   each MYRING_PROBE() is a single nop plus a .note.stapsdt entry naming
+   where its arguments live; a tracer turns the nop into a breakpoint only
+   while attached. Arguments are values already in registers, so nothing is
+   computed for a probe nobody watches. Build with -DMYRING_NO_USDT to leave
+   them out entirely.
+     myring:batch_start  (c, tail, head)     drain or decode_batch begins
+     myring:batch_end    (c, records, tail)  ... and ends (local tail only)
+     myring:tail_advance (c, tail)           myring_consumer_commit()
+     myring:wakeup       (c, ret)            myring_consumer_wait() returns
+     myring:drop         (pos, payload)      a DROP record is dispatched;
+                                             payload is a struct myring_rec_drop */
+#if !defined(MYRING_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MYRING_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef MYRING_HAVE_USDT
+#define MYRING_PROBE(name, ...) STAP_PROBEV(myring, name, ##__VA_ARGS__)
+#else
+#define MYRING_PROBE(name, ...) do { } while (0)
+#endif
+
+struct myring_consumer {
+  int fd;                     /* ring device, or -1 for an attached in-memory ring */
+  void *map;
+  size_t map_len;
+  struct myring_ctrl *ctrl;
+  uint8_t *data;
+  uint64_t size;              /* ring data bytes (power-of-two) */
+  uint64_t mask;
+  uint32_t slot_size;         /* ctrl->slot_size, 0 = variable-length records */
+  unsigned slot_shift;        /* log2(slot_size) */
+  uint64_t tail;              /* local read cursor, published by myring_consumer_commit() */
+  uint8_t *scratch;           /* reassembly buffer for records that wrap */
+  size_t scratch_len;
+  unsigned prefetch_lines;    /* software prefetch distance in cache lines (0 = off) */
+  uint64_t pf_pos;            /* next ring position to prefetch */
+  uint8_t *flip;              /* flip window (ctrl->flip_pages slots), or NULL */
+  size_t page_size;
+};
+
+/* One record as seen by a handler. hdr/payload point into the mapping unless
+   the record wrapped, in which case they point into the consumer's scratch
+   buffer and stay valid until the next record is read. */
+struct myring_rec {
+  const struct myring_rec_hdr *hdr;
+  const uint8_t *payload;
+  uint64_t pos;               /* ring position of the header */
+  uint64_t reclen;            /* header + payload bytes */
+};
+
+/* Per-type handlers. Return non-zero to stop the drain after this record
+   (the record still counts as consumed). Unset handlers fall back to
+   on_other; an unset on_other silently skips the record. */
+struct myring_handlers {
+  int (*on_pkt)(void *ctx, const struct myring_rec *rec);
+  int (*on_meta)(void *ctx, const struct myring_rec *rec);  /* REC_TYPE_PKT_META */
+  int (*on_page)(void *ctx, const struct myring_rec *rec);  /* REC_TYPE_PAGE, see myring_page_data() */
+  int (*on_drop)(void *ctx, const struct myring_rec *rec);
+  int (*on_other)(void *ctx, const struct myring_rec *rec);
+};
+
+/* head/tail sit at 8-byte aligned offsets of the page-aligned ctrl page, so
+   the packed attribute on myring_ctrl never makes them unaligned. */
+static inline uint64_t myring_load_acquire(const volatile void *p)
+{
+  return __atomic_load_n((const volatile uint64_t *)p, __ATOMIC_ACQUIRE);
+}
+
+static inline void myring_store_release(volatile void *p, uint64_t v)
+{
+  __atomic_store_n((volatile uint64_t *)p, v, __ATOMIC_RELEASE);
+}
+
+static inline void myring_consumer_setup(struct myring_consumer *c, void *map,
+                                         size_t map_len, size_t page_size)
+{
+  c->map = map;
+  c->map_len = map_len;
+  c->ctrl = (struct myring_ctrl *)map;
+  c->data = (uint8_t *)map + page_size;
+  c->size = c->ctrl->size;
+  c->mask = c->size - 1;
+  c->slot_size = c->ctrl->slot_size;
+  c->slot_shift = c->slot_size ? (unsigned)__builtin_ctz(c->slot_size) : 0;
+  c->tail = myring_load_acquire(&c->ctrl->tail);
+  c->scratch = NULL;
+  c->scratch_len = 0;
+  c->prefetch_lines = 0;
+  c->pf_pos = 0;
+  c->flip = NULL;
+  c->page_size = page_size;
+}
+
+/* Prefetch distance in cache lines past the local tail. Worth enabling when
+   the ring is larger than the LLC and records vary in length; 0 leaves it
+   all to the hardware prefetcher. */
+static inline void myring_consumer_set_prefetch(struct myring_consumer *c, unsigned lines)
+{
+  c->prefetch_lines = lines;
+  c->pf_pos = c->tail;
+}
+
+/* Attach to a ctrl page + data region that is already mapped (tests,
+   benchmarks, or a ring shared some other way). Tail is published with a
+   plain store-release instead of the ADVANCE_TAIL ioctl. */
+static inline void myring_consumer_attach(struct myring_consumer *c, void *map, size_t page_size)
+{
+  c->fd = -1;
+  myring_consumer_setup(c, map, page_size + ((struct myring_ctrl *)map)->size, page_size);
+}
+
+/* Open and map a ring device. Returns 0, or -1 with errno set. */
+static inline int myring_consumer_open(struct myring_consumer *c, const char *dev)
+{
+  struct myring_config cfg;
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t map_len;
+  void *map;
+  int fd = open(dev, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  if (ioctl(fd, MYRING_IOC_GET_CONFIG, &cfg) != 0) goto fail;
+
+  map_len = page_size + cfg.ring_size;
+  map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) goto fail;
+
+  c->fd = fd;
+  myring_consumer_setup(c, map, map_len, page_size);
+  if (c->ctrl->flip_pages) {
+    void *flip = mmap(NULL, (size_t)c->ctrl->flip_pages * page_size, PROT_READ, MAP_SHARED,
+                      fd, (off_t)MYRING_OFF_FLIP);
+    if (flip == MAP_FAILED) {
+      munmap(map, map_len);
+      goto fail;
+    }
+    c->flip = (uint8_t *)flip;
+  }
+  return 0;
+
+fail: {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+}
+
+static inline void myring_consumer_close(struct myring_consumer *c)
+{
+  free(c->scratch);
+  c->scratch = NULL;
+  c->scratch_len = 0;
+  if (c->fd >= 0) {
+    if (c->flip) munmap(c->flip, (size_t)c->ctrl->flip_pages * c->page_size);
+    munmap(c->map, c->map_len);
+    close(c->fd);
+    c->fd = -1;
+  }
+}
+
+/* Publish the local tail. Through the device this goes via ADVANCE_TAIL so
+   the kernel re-evaluates the low watermark. With a user producer the kernel
+   has nothing to re-evaluate: a plain store, and a NOTIFY only if the
+   producer sleeps waiting for the low watermark. */
+static inline int myring_consumer_commit(struct myring_consumer *c)
+{
+  MYRING_PROBE(tail_advance, c, c->tail);
+  if (c->fd < 0) {
+    myring_store_release(&c->ctrl->tail, c->tail);
+    return 0;
+  }
+  if (c->ctrl->flags & CTRL_FLAG_USER_PROD) {
+    myring_store_release(&c->ctrl->tail, c->tail);
+    /* pairs with the fence in myring_producer_wait(): either it sees the
+       new tail or we see its flag */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if ((__atomic_load_n(&c->ctrl->flags, __ATOMIC_RELAXED) & CTRL_FLAG_PROD_WAIT) &&
+        (myring_load_acquire(&c->ctrl->head) - c->tail) * 100 <= (uint64_t)c->ctrl->lo_pct * c->size)
+      return ioctl(c->fd, MYRING_IOC_NOTIFY);
+    return 0;
+  }
+  struct myring_advance adv = { .new_tail = c->tail };
+  return ioctl(c->fd, MYRING_IOC_ADVANCE_TAIL, &adv);
+}
+
+/* Decode the record at the local tail. The caller guarantees tail != head.
+   Returns 0, or -1 with errno = EPROTO for a record that runs past head
+   (corrupt ring) or ENOMEM if a wrapped record can't be reassembled. */
+static MYRING_ALWAYS_INLINE int myring_consumer_peek(struct myring_consumer *c, uint64_t head,
+                                                     struct myring_rec *rec)
+{
+  uint64_t off = c->tail & c->mask;
+  uint64_t room = c->size - off;
+  const struct myring_rec_hdr *hdr = (const struct myring_rec_hdr *)(c->data + off);
+  struct myring_rec_hdr tmp;
+
+  if (__builtin_expect(room < sizeof(*hdr), 0)) {
+    memcpy(&tmp, c->data + off, room);
+    memcpy((uint8_t *)&tmp + room, c->data, sizeof(tmp) - room);
+    hdr = &tmp;
+  }
+
+  uint64_t reclen = c->slot_size ? c->slot_size : sizeof(*hdr) + hdr->len;
+  if (__builtin_expect(reclen > head - c->tail, 0)) {
+    errno = EPROTO;
+    return -1;
+  }
+  rec->pos = c->tail;
+  rec->reclen = reclen;
+
+  if (__builtin_expect(reclen <= room, 1)) {
+    rec->hdr = (const struct myring_rec_hdr *)(c->data + off);
+    rec->payload = c->data + off + sizeof(*hdr);
+    return 0;
+  }
+
+  if (c->scratch_len < reclen) {
+    uint8_t *p = (uint8_t *)realloc(c->scratch, reclen);
+    if (!p) { errno = ENOMEM; return -1; }
+    c->scratch = p;
+    c->scratch_len = reclen;
+  }
+  memcpy(c->scratch, c->data + off, room);
+  memcpy(c->scratch + room, c->data, reclen - room);
+  rec->hdr = (const struct myring_rec_hdr *)c->scratch;
+  rec->payload = c->scratch + sizeof(*hdr);
+  return 0;
+}
+
+/* Issue prefetches so that [tail, tail + prefetch_lines lines) is in
+   flight, never past head (those bytes may not be written yet). Each line
+   is prefetched once, so the steady-state cost is one prefetch per cache
+   line consumed. */
+static MYRING_ALWAYS_INLINE void myring_consumer_prefetch(struct myring_consumer *c, uint64_t head)
+{
+  if (!c->prefetch_lines) return;
+  uint64_t end = c->tail + (uint64_t)c->prefetch_lines * MYRING_CACHE_LINE;
+  if (end > head) end = head;
+  /* tail moved backwards (reset) or jumped past the window: restart */
+  if (c->pf_pos < c->tail || c->pf_pos > end + MYRING_CACHE_LINE)
+    c->pf_pos = c->tail & ~(uint64_t)(MYRING_CACHE_LINE - 1);
+  for (; c->pf_pos < end; c->pf_pos += MYRING_CACHE_LINE)
+    __builtin_prefetch(c->data + (c->pf_pos & c->mask), 0, 3);
+}
+
+static MYRING_ALWAYS_INLINE int myring_dispatch(const struct myring_handlers *h, void *ctx,
+                                                const struct myring_rec *rec)
+{
+  switch (rec->hdr->type) {
+    case REC_TYPE_PKT:
+      if (h->on_pkt) return h->on_pkt(ctx, rec);
+      break;
+    case REC_TYPE_PKT_META:
+      if (h->on_meta) return h->on_meta(ctx, rec);
+      break;
+    case REC_TYPE_PAGE:
+      if (h->on_page) return h->on_page(ctx, rec);
+      break;
+    case REC_TYPE_DROP:
+      MYRING_PROBE(drop, rec->pos, rec->payload);
+      if (h->on_drop) return h->on_drop(ctx, rec);
+      break;
+    default:
+      break;
+  }
+  return h->on_other ? h->on_other(ctx, rec) : 0;
+}
+
+/* Consume up to budget records (0 = until head). Only advances the local
+   tail; call myring_consumer_commit() to hand the space back. Returns the
+   number of records consumed, or -1 on a decode error. */
+static MYRING_ALWAYS_INLINE long myring_drain_with(struct myring_consumer *c,
+                                                   const struct myring_handlers *h,
+                                                   void *ctx, size_t budget)
+{
+  uint64_t head = myring_load_acquire(&c->ctrl->head);
+  long n = 0;
+
+  MYRING_PROBE(batch_start, c, c->tail, head);
+  while (c->tail != head && (!budget || (size_t)n < budget)) {
+    struct myring_rec rec;
+    myring_consumer_prefetch(c, head);
+    if (myring_consumer_peek(c, head, &rec) != 0) return -1;
+    int stop = myring_dispatch(h, ctx, &rec);
+    c->tail += rec.reclen;
+    n++;
+    if (stop) break;
+  }
+  MYRING_PROBE(batch_end, c, n, c->tail);
+  return n;
+}
+
+/* Payload of a REC_TYPE_PAGE record: the first len bytes of its flip slot,
+   valid until the tail is committed past the record. The first access
+   after a flip takes a minor fault that maps the new page. */
+static inline const uint8_t *myring_page_data(const struct myring_consumer *c,
+                                              const struct myring_rec *rec, uint32_t *len)
+{
+  struct myring_rec_page rp;
+  memcpy(&rp, rec->payload, sizeof(rp));
+  if (len) *len = rp.len;
+  return c->flip + (size_t)rp.slot * c->page_size;
+}
+
+/* --- slot mode (ctrl->slot_size != 0) ---
+   Every record sits at the start of its own slot and none wraps, so slots
+   can be addressed directly: split a range across threads, skip ahead, or
+   prefetch exactly the slots about to be read. The drain functions above
+   work unchanged. */
+
+/* Slots written but not yet consumed, from the local tail */
+static inline uint64_t myring_slots_ready(const struct myring_consumer *c)
+{
+  return (myring_load_acquire(&c->ctrl->head) - c->tail) >> c->slot_shift;
+}
+
+/* Header of the i-th slot past the local tail; i < myring_slots_ready().
+   The payload follows the header, hdr->len bytes of it are valid. */
+static inline const struct myring_rec_hdr *myring_slot(const struct myring_consumer *c, uint64_t i)
+{
+  return (const struct myring_rec_hdr *)(c->data + ((c->tail + (i << c->slot_shift)) & c->mask));
+}
+
+/* Mark the first n ready slots consumed (publish with myring_consumer_commit()) */
+static inline void myring_slots_consume(struct myring_consumer *c, uint64_t n)
+{
+  c->tail += n << c->slot_shift;
+}
+
+/* --- user producer (ctrl->flags & CTRL_FLAG_USER_PROD) ---
+   MYRING_IOC_SET_USER_PROD hands the producer side of a ring to the process
+   that opened it; another process attaches with myring_consumer_open() as
+   usual. Records and head go through the shared mapping, so nothing is
+   copied by the kernel and the fast path makes no syscalls. A side that runs
+   dry sets its wait flag, re-checks, and sleeps in poll(); the peer issues
+   MYRING_IOC_NOTIFY after publishing only while that flag is set. */
+
+/* Commit, then sleep until the ring holds a record. Returns 1 if it does,
+   0 on timeout, -1 with errno set. Only a user producer honours
+   CTRL_FLAG_NEED_WAKEUP; a kernel-produced ring signals at hi_pct (wait on
+   its eventfd instead) and an attached ring has no device, so both fail
+   with EINVAL. timeout_ms as for poll(). */
+static inline int myring_consumer_wait(struct myring_consumer *c, int timeout_ms)
+{
+  struct pollfd pfd = { .fd = c->fd, .events = POLLIN };
+  int ret = 1;
+
+  if (c->fd < 0 || !(__atomic_load_n(&c->ctrl->flags, __ATOMIC_RELAXED) & CTRL_FLAG_USER_PROD)) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (myring_consumer_commit(c) != 0) return -1;
+  __atomic_fetch_or(&c->ctrl->flags, CTRL_FLAG_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+  if (myring_load_acquire(&c->ctrl->head) == c->tail) {
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret > 0) ret = 1;
+  }
+  __atomic_fetch_and(&c->ctrl->flags, ~CTRL_FLAG_NEED_WAKEUP, __ATOMIC_RELAXED);
+  MYRING_PROBE(wakeup, c, ret);
+  return ret;
+}
+
+struct myring_producer {
+  int fd;
+  void *map;
+  size_t map_len;
+  struct myring_ctrl *ctrl;
+  uint8_t *data;
+  uint64_t size, mask;
+  uint32_t slot_size;         /* ctrl->slot_size, 0 = variable-length records */
+  uint64_t head;              /* local write cursor, published by myring_producer_publish() */
+  uint64_t tail;              /* last tail seen, re-read only when the ring looks full */
+  uint64_t notifies;          /* MYRING_IOC_NOTIFY calls made */
+};
+
+/* Open a ring device and take over its producer side. The ring starts
+   empty; kernel producers routed to it drop until myring_producer_close().
+   Returns 0, or -1 with errno set (EBUSY: another process produces). */
+static inline int myring_producer_open(struct myring_producer *p, const char *dev)
+{
+  struct myring_config cfg;
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  uint32_t on = 1;
+  size_t map_len;
+  void *map;
+  int fd = open(dev, O_RDWR | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  if (ioctl(fd, MYRING_IOC_GET_CONFIG, &cfg) != 0) goto fail;
+  map_len = page_size + cfg.ring_size;
+  map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) goto fail;
+  if (ioctl(fd, MYRING_IOC_SET_USER_PROD, &on) != 0) {
+    int err = errno;
+    munmap(map, map_len);
+    errno = err;
+    goto fail;
+  }
+
+  memset(p, 0, sizeof(*p));
+  p->fd = fd;
+  p->map = map;
+  p->map_len = map_len;
+  p->ctrl = (struct myring_ctrl *)map;
+  p->data = (uint8_t *)map + page_size;
+  p->size = p->ctrl->size;
+  p->mask = p->size - 1;
+  p->slot_size = p->ctrl->slot_size;
+  return 0;
+
+fail: {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+}
+
+/* Hand the producer side back to the kernel (the ring is emptied) */
+static inline void myring_producer_close(struct myring_producer *p)
+{
+  uint32_t off = 0;
+  ioctl(p->fd, MYRING_IOC_SET_USER_PROD, &off);
+  munmap(p->map, p->map_len);
+  close(p->fd);
+  p->fd = -1;
+}
+
+static inline void myring_producer_copy(struct myring_producer *p, uint64_t pos,
+                                        const void *src, uint64_t len)
+{
+  uint64_t off = pos & p->mask;
+  uint64_t first = len < p->size - off ? len : p->size - off;
+  memcpy(p->data + off, src, first);
+  memcpy(p->data, (const uint8_t *)src + first, len - first);
+}
+
+/* Write one record at the local head (type, flags and ts_ns as given, the
+   payload cut to one slot in slot mode). Not visible to the consumer until
+   myring_producer_publish(). Returns 0, or -1 with errno = EAGAIN if the
+   ring is full. */
+static MYRING_ALWAYS_INLINE int myring_produce(struct myring_producer *p,
+                                               const struct myring_rec_hdr *h, const void *payload)
+{
+  struct myring_rec_hdr hdr = *h;
+  uint64_t need;
+
+  if (p->slot_size) {
+    if (hdr.len > p->slot_size - sizeof(hdr)) hdr.len = p->slot_size - sizeof(hdr);
+    need = p->slot_size;
+  } else {
+    need = sizeof(hdr) + hdr.len;
+  }
+  if (p->size - (p->head - p->tail) < need) {
+    p->tail = myring_load_acquire(&p->ctrl->tail);
+    if (p->size - (p->head - p->tail) < need) {
+      errno = EAGAIN;
+      return -1;
+    }
+  }
+  myring_producer_copy(p, p->head, &hdr, sizeof(hdr));
+  myring_producer_copy(p, p->head + sizeof(hdr), payload, hdr.len);
+  p->head += need;
+  return 0;
+}
+
+/* Publish the records written so far; wake the consumer only if it sleeps */
+static inline int myring_producer_publish(struct myring_producer *p)
+{
+  myring_store_release(&p->ctrl->head, p->head);
+  /* pairs with the flag update in myring_consumer_wait() */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&p->ctrl->flags, __ATOMIC_RELAXED) & CTRL_FLAG_NEED_WAKEUP) {
+    p->notifies++;
+    return ioctl(p->fd, MYRING_IOC_NOTIFY);
+  }
+  return 0;
+}
+
+/* Publish, then sleep until the consumer has drained the ring to lo_pct.
+   Returns 0, or -1 with errno set. */
+static inline int myring_producer_wait(struct myring_producer *p)
+{
+  struct pollfd pfd = { .fd = p->fd, .events = POLLOUT };
+  int ret = 0;
+
+  if (myring_producer_publish(p) != 0) return -1;
+  __atomic_fetch_or(&p->ctrl->flags, CTRL_FLAG_PROD_WAIT, __ATOMIC_SEQ_CST);
+  p->tail = myring_load_acquire(&p->ctrl->tail);
+  if ((p->head - p->tail) * 100 > (uint64_t)p->ctrl->lo_pct * p->size)
+    ret = poll(&pfd, 1, -1) < 0 ? -1 : 0;
+  __atomic_fetch_and(&p->ctrl->flags, ~CTRL_FLAG_PROD_WAIT, __ATOMIC_RELAXED);
+  p->tail = myring_load_acquire(&p->ctrl->tail);
+  return ret;
+}
+
+/* --- timestamp-ordered merge across rings ---
+   Records split over several rings (nr_rings, per-CPU routing) come out in
+   global ts_ns order from one iterator. A small binary heap holds the
+   oldest unconsumed record of each ring, a zero-copy view into its mapping
+   (or its consumer's scratch buffer if it wrapped). Each ring is assumed
+   ordered on its own, so the heap top is safe to hand out once every ring
+   has a record pending. A ring with nothing pending can still produce an
+   older record, so while one is empty the top is only handed out once it
+   is window_ns older than `now`: the reorder window. Records that turn up
+   older than one already handed out (late beyond the window, or an
+   unordered producer) are still yielded, and counted. */
+
+#define MYRING_MERGE_MAX 64
+
+struct myring_merge {
+  struct myring_consumer *c[MYRING_MERGE_MAX];
+  unsigned n;
+  uint64_t window_ns;
+  uint64_t head[MYRING_MERGE_MAX];        /* last head seen per ring */
+  struct myring_rec rec[MYRING_MERGE_MAX]; /* pending record per ring */
+  struct { uint64_t ts; uint32_t ring; } heap[MYRING_MERGE_MAX];
+  unsigned nheap;
+  int last;                   /* ring of the record handed out last, or -1 */
+  uint64_t last_ts;
+  uint64_t records;           /* handed out */
+  uint64_t late;              /* handed out behind an already newer record */
+};
+
+static inline int myring_merge_init(struct myring_merge *m, struct myring_consumer **c,
+                                    unsigned n, uint64_t window_ns)
+{
+  memset(m, 0, sizeof(*m));
+  if (!n || n > MYRING_MERGE_MAX) { errno = EINVAL; return -1; }
+  for (unsigned i = 0; i < n; i++) {
+    m->c[i] = c[i];
+    m->head[i] = c[i]->tail;
+  }
+  m->n = n;
+  m->window_ns = window_ns;
+  m->last = -1;
+  return 0;
+}
+
+static MYRING_ALWAYS_INLINE bool myring_merge_before(const struct myring_merge *m,
+                                                     unsigned a, unsigned b)
+{
+  return m->heap[a].ts < m->heap[b].ts ||
+         (m->heap[a].ts == m->heap[b].ts && m->heap[a].ring < m->heap[b].ring);
+}
+
+static MYRING_ALWAYS_INLINE void myring_merge_swap(struct myring_merge *m, unsigned a, unsigned b)
+{
+  __typeof__(m->heap[0]) t = m->heap[a];
+  m->heap[a] = m->heap[b];
+  m->heap[b] = t;
+}
+
+/* Peek ring i's next record into the heap. Returns 1 if it had one, 0 if
+   it is empty, -1 on a decode error. */
+static MYRING_ALWAYS_INLINE int myring_merge_fill(struct myring_merge *m, unsigned i)
+{
+  struct myring_consumer *c = m->c[i];
+
+  if (c->tail == m->head[i]) {
+    m->head[i] = myring_load_acquire(&c->ctrl->head);
+    if (c->tail == m->head[i]) return 0;
+  }
+  if (myring_consumer_peek(c, m->head[i], &m->rec[i]) != 0) return -1;
+
+  unsigned k = m->nheap++;
+  m->heap[k].ts = m->rec[i].hdr->ts_ns;
+  m->heap[k].ring = i;
+  while (k && myring_merge_before(m, k, (k - 1) / 2)) {
+    myring_merge_swap(m, k, (k - 1) / 2);
+    k = (k - 1) / 2;
+  }
+  return 1;
+}
+
+static MYRING_ALWAYS_INLINE void myring_merge_pop(struct myring_merge *m)
+{
+  unsigned k = 0;
+  m->heap[0] = m->heap[--m->nheap];
+  for (;;) {
+    unsigned l = 2 * k + 1, r = l + 1, min = k;
+    if (l < m->nheap && myring_merge_before(m, l, min)) min = l;
+    if (r < m->nheap && myring_merge_before(m, r, min)) min = r;
+    if (min == k) break;
+    myring_merge_swap(m, k, min);
+    k = min;
+  }
+}
+
+/* Hand out the oldest record across the rings, if it is safe to (see
+   above); now is CLOCK_MONOTONIC ns like ts_ns (UINT64_MAX flushes the
+   window). rec stays valid until the next call, which consumes it from its
+   ring's local tail; *ring (may be NULL) gets the ring's index. Returns 1,
+   0 if nothing can be handed out yet, or -1 on a decode error. */
+static MYRING_ALWAYS_INLINE int myring_merge_next(struct myring_merge *m, uint64_t now,
+                                                  struct myring_rec *rec, unsigned *ring)
+{
+  if (m->last >= 0) {
+    unsigned i = (unsigned)m->last;
+    m->c[i]->tail += m->rec[i].reclen;
+    m->last = -1;
+    if (myring_merge_fill(m, i) < 0) return -1;
+  }
+  /* empty rings are only polled while they can still change the answer */
+  if (m->nheap < m->n && (!m->nheap || m->heap[0].ts + m->window_ns > now)) {
+    uint64_t pending = 0;
+    for (unsigned k = 0; k < m->nheap; k++) pending |= 1ull << m->heap[k].ring;
+    for (unsigned i = 0; i < m->n; i++)
+      if (!(pending & (1ull << i)) && myring_merge_fill(m, i) < 0) return -1;
+  }
+  if (!m->nheap) return 0;
+  if (m->nheap < m->n && m->heap[0].ts + m->window_ns > now) return 0;
+
+  unsigned i = m->heap[0].ring;
+  uint64_t ts = m->heap[0].ts;
+  myring_merge_pop(m);
+  *rec = m->rec[i];
+  if (ring) *ring = i;
+  m->last = (int)i;
+  m->records++;
+  if (ts < m->last_ts) m->late++;
+  else m->last_ts = ts;
+  return 1;
+}
+
+/* Publish every ring's tail. The record handed out last is not included
+   until the next myring_merge_next(). */
+static inline int myring_merge_commit(struct myring_merge *m)
+{
+  int ret = 0;
+  for (unsigned i = 0; i < m->n; i++)
+    if (myring_consumer_commit(m->c[i]) != 0) ret = -1;
+  return ret;
+}
+
+/* Define `static long name(struct myring_consumer *, void *ctx, size_t budget)`
+   with the given handlers baked in, e.g.
+     MYRING_DEFINE_DRAIN(drain, .on_pkt = on_pkt, .on_drop = on_drop)
+   The handler table is a compile-time constant, so the compiler turns every
+   handler call into a direct (normally inlined) call inside the switch. */
+#define MYRING_DEFINE_DRAIN(name, ...)                                            \
+  static long name(struct myring_consumer *c, void *ctx, size_t budget)           \
+  {                                                                               \
+    static const struct myring_handlers name##_handlers = { __VA_ARGS__ };        \
+    return myring_drain_with(c, &name##_handlers, ctx, budget);                   \
+  }
+
+/* Structure-of-arrays view of a batch of records. Row i describes the i-th
+   record; field[k][i] holds the u64 at payload offset field_off[k] (0 when
+   the payload is too short). Payload pointers stay valid until the tail is
+   committed, except for a wrapped record, which is only ever decoded as the
+   single row of its batch and lives in the consumer's scratch buffer. */
+#define MYRING_BATCH_MAX_FIELDS 4
+
+struct myring_batch {
+  size_t cap;                 /* rows allocated */
+  size_t n;                   /* rows decoded by the last myring_decode_batch() */
+  uint64_t *ts_ns;
+  uint32_t *len;
+  uint16_t *type;
+  uint64_t *pos;              /* ring position of each header */
+  const uint8_t **payload;
+  unsigned nfields;
+  uint32_t field_off[MYRING_BATCH_MAX_FIELDS];
+  uint64_t *field[MYRING_BATCH_MAX_FIELDS];
+};
+
+static inline void myring_batch_free(struct myring_batch *b)
+{
+  free(b->ts_ns);
+  free(b->len);
+  free(b->type);
+  free(b->pos);
+  free(b->payload);
+  for (unsigned k = 0; k < MYRING_BATCH_MAX_FIELDS; k++) free(b->field[k]);
+  memset(b, 0, sizeof(*b));
+}
+
+/* Allocate columns for cap rows, gathering nfields u64 payload fields at the
+   given byte offsets. Returns 0, or -1 with errno set. */
+static inline int myring_batch_init(struct myring_batch *b, size_t cap,
+                                    const uint32_t *field_off, unsigned nfields)
+{
+  memset(b, 0, sizeof(*b));
+  if (nfields > MYRING_BATCH_MAX_FIELDS || !cap) { errno = EINVAL; return -1; }
+  b->cap = cap;
+  b->nfields = nfields;
+  b->ts_ns = (uint64_t *)malloc(cap * sizeof(*b->ts_ns));
+  b->len = (uint32_t *)malloc(cap * sizeof(*b->len));
+  b->type = (uint16_t *)malloc(cap * sizeof(*b->type));
+  b->pos = (uint64_t *)malloc(cap * sizeof(*b->pos));
+  b->payload = (const uint8_t **)malloc(cap * sizeof(*b->payload));
+  int ok = b->ts_ns && b->len && b->type && b->pos && b->payload;
+  for (unsigned k = 0; k < nfields; k++) {
+    b->field_off[k] = field_off[k];
+    b->field[k] = (uint64_t *)malloc(cap * sizeof(*b->field[k]));
+    ok = ok && b->field[k];
+  }
+  if (!ok) { myring_batch_free(b); errno = ENOMEM; return -1; }
+  return 0;
+}
+
+/* Walk up to b->cap records from the local tail in one pass and scatter
+   their header fields into the batch columns. Advances the local tail past
+   the decoded rows. Returns the row count (0 when empty), or -1 on a decode
+   error. */
+static inline long myring_decode_batch(struct myring_consumer *c, struct myring_batch *b)
+{
+  uint64_t head = myring_load_acquire(&c->ctrl->head);
+  size_t n = 0;
+
+  MYRING_PROBE(batch_start, c, c->tail, head);
+  while (n < b->cap && c->tail != head) {
+    uint64_t off = c->tail & c->mask;
+    struct myring_rec rec;
+
+    myring_consumer_prefetch(c, head);
+    /* a record that wraps is reassembled into scratch; keep it alone in
+       its batch so earlier payload pointers aren't invalidated */
+    if (c->size - off < sizeof(struct myring_rec_hdr) ||
+        c->size - off < sizeof(struct myring_rec_hdr) +
+                        ((const struct myring_rec_hdr *)(c->data + off))->len) {
+      if (n) break;
+    }
+    if (myring_consumer_peek(c, head, &rec) != 0) return -1;
+
+    const struct myring_rec_hdr *h = rec.hdr;
+    b->ts_ns[n] = h->ts_ns;
+    b->len[n] = h->len;
+    b->type[n] = h->type;
+    b->pos[n] = rec.pos;
+    b->payload[n] = rec.payload;
+    for (unsigned k = 0; k < b->nfields; k++) {
+      uint64_t v = 0;
+      if ((uint64_t)b->field_off[k] + sizeof(v) <= h->len)
+        memcpy(&v, rec.payload + b->field_off[k], sizeof(v));
+      b->field[k][n] = v;
+    }
+    c->tail += rec.reclen;
+    n++;
+    if (rec.hdr == (const struct myring_rec_hdr *)c->scratch) break;
+  }
+  b->n = n;
+  MYRING_PROBE(batch_end, c, n, c->tail);
+  return (long)n;
+}
+
+/* --- real-time scheduling for the consumer thread --- */
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+/* sched_setattr(2) argument; glibc has no wrapper, and newer glibc versions
+   declare their own struct sched_attr, hence the private name */
+struct myring_sched_attr {
+  uint32_t size;
+  uint32_t sched_policy;
+  uint64_t sched_flags;
+  int32_t sched_nice;
+  uint32_t sched_priority;
+  uint64_t sched_runtime;
+  uint64_t sched_deadline;
+  uint64_t sched_period;
+};
+
+/* Move the calling thread to policy: SCHED_OTHER, SCHED_FIFO (prio 1..99)
+   or SCHED_DEADLINE (runtime_ns budget every period_ns, deadline = period).
+   Returns 0, or -1 with errno set (EPERM without CAP_SYS_NICE). */
+static inline int myring_set_sched(int policy, int prio, uint64_t runtime_ns, uint64_t period_ns)
+{
+  struct myring_sched_attr attr = {
+    .size = sizeof(attr),
+    .sched_policy = (uint32_t)policy,
+  };
+  if (policy == SCHED_FIFO || policy == SCHED_RR) {
+    attr.sched_priority = (uint32_t)prio;
+  } else if (policy == SCHED_DEADLINE) {
+    attr.sched_runtime = runtime_ns;
+    attr.sched_deadline = period_ns;
+    attr.sched_period = period_ns;
+  }
+  return (int)syscall(SYS_sched_setattr, 0, &attr, 0);
+}
+
+/* --- latency histogram ---
+   Log-linear buckets: 16 sub-buckets per power of two, i.e. ~6% relative
+   error, fixed 8KB, O(1) insert. Good enough for p99.9 over ns values. */
+
+#define MYRING_HIST_SUB_BITS 4
+#define MYRING_HIST_BUCKETS  (64 << MYRING_HIST_SUB_BITS)
+
+struct myring_hist {
+  uint64_t count;
+  uint64_t max;
+  uint64_t bucket[MYRING_HIST_BUCKETS];
+};
+
+static inline unsigned myring_hist_index(uint64_t v)
+{
+  if (v < (1u << MYRING_HIST_SUB_BITS)) return (unsigned)v;
+  unsigned msb = 63 - (unsigned)__builtin_clzll(v);
+  unsigned sub = (unsigned)(v >> (msb - MYRING_HIST_SUB_BITS)) & ((1u << MYRING_HIST_SUB_BITS) - 1);
+  return ((msb - MYRING_HIST_SUB_BITS + 1) << MYRING_HIST_SUB_BITS) + sub;
+}
+
+/* Lower bound of the values that land in bucket i. */
+static inline uint64_t myring_hist_value(unsigned i)
+{
+  if (i < (1u << MYRING_HIST_SUB_BITS)) return i;
+  unsigned msb = (i >> MYRING_HIST_SUB_BITS) + MYRING_HIST_SUB_BITS - 1;
+  uint64_t sub = i & ((1u << MYRING_HIST_SUB_BITS) - 1);
+  return (1ull << msb) | (sub << (msb - MYRING_HIST_SUB_BITS));
+}
+
+static inline void myring_hist_add(struct myring_hist *h, uint64_t v)
+{
+  h->bucket[myring_hist_index(v)]++;
+  h->count++;
+  if (v > h->max) h->max = v;
+}
+
+/* Value at percentile pct (0..100), 0 for an empty histogram. */
+static inline uint64_t myring_hist_pct(const struct myring_hist *h, double pct)
+{
+  if (!h->count) return 0;
+  uint64_t rank = (uint64_t)(pct / 100.0 * (double)h->count);
+  if (rank >= h->count) return h->max;
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < MYRING_HIST_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if (seen > rank) return myring_hist_value(i);
+  }
+  return h->max;
+}
+
+/* dst += src, e.g. per-thread histograms into one */
+static inline void myring_hist_merge(struct myring_hist *dst, const struct myring_hist *src)
+{
+  for (unsigned i = 0; i < MYRING_HIST_BUCKETS; i++) dst->bucket[i] += src->bucket[i];
+  dst->count += src->count;
+  if (src->max > dst->max) dst->max = src->max;
+}
+
+/* --- latency breakdown (MYRING_IOC_SET_STAMPS) ---
+   Splits each record's ts_ns -> handler latency into stages, one knob each:
+     queue    ts_ns -> head commit      per-CPU staging, coalescing
+     notify   commit -> signal          watermarks (hi_pct)
+     wakeup   signal -> consumer runs   wait strategy, scheduling, placement
+     process  consumer runs -> handler  position in the batch, handler cost
+   The kernel logs commits as ranges of ring bytes and stamps the first
+   signal of each batch in the ctrl page. A record's commit time is
+   interpolated by its end position between its range's first and last
+   commit, so a range of one commit is exact. Call myring_breakdown_wake() when the wait
+   returns and myring_breakdown_rec() from the handlers. matched counts the
+   records in the stage histograms, skipped those with no log entry
+   (committed before stamps were on). */
+
+struct myring_breakdown {
+  struct myring_hist queue, notify, wakeup, process, total;
+  uint64_t matched, skipped;
+  uint64_t seq;               /* next log entry to look at */
+  uint64_t wake_ns, notify_ns, notify_head;
+};
+
+/* Turn the kernel's stamps on or off. Returns 0, or -1 with errno set. */
+static inline int myring_consumer_set_stamps(struct myring_consumer *c, bool on)
+{
+  uint32_t v = on;
+  if (c->fd < 0) {
+    /* an attached ring: its producer stamps if it follows the protocol */
+    if (on) __atomic_fetch_or(&c->ctrl->flags, CTRL_FLAG_STAMPS, __ATOMIC_RELAXED);
+    else __atomic_fetch_and(&c->ctrl->flags, ~CTRL_FLAG_STAMPS, __ATOMIC_RELAXED);
+    return 0;
+  }
+  return ioctl(c->fd, MYRING_IOC_SET_STAMPS, &v);
+}
+
+static inline void myring_breakdown_init(struct myring_breakdown *b, const struct myring_consumer *c)
+{
+  (void)c;
+  memset(b, 0, sizeof(*b));
+}
+
+/* The consumer is running again: now from CLOCK_MONOTONIC */
+static inline void myring_breakdown_wake(struct myring_breakdown *b, const struct myring_consumer *c,
+                                         uint64_t now)
+{
+  b->wake_ns = now;
+  b->notify_head = myring_load_acquire(&c->ctrl->notify_head);
+  b->notify_ns = c->ctrl->notify_ns;
+}
+
+/* Commit time of the reclen bytes at pos, 0 if they have no log entry */
+static inline uint64_t myring_breakdown_commit(struct myring_breakdown *b, const struct myring_ctrl *ctrl,
+                                               uint64_t pos, uint64_t reclen)
+{
+  for (;;) {
+    /* entry seq % MYRING_STAMPS may be mid-rewrite, older ones are gone */
+    uint64_t seq = myring_load_acquire(&ctrl->stamp_seq);
+    if (b->seq + MYRING_STAMPS <= seq) b->seq = seq - MYRING_STAMPS + 1;
+    if (b->seq >= seq) return 0;
+    unsigned i = (unsigned)(b->seq % MYRING_STAMPS);
+    /* the newest entry grows: its head is published after last_ns */
+    uint64_t head = myring_load_acquire(&ctrl->stamp[i].head);
+    uint64_t start = ctrl->stamp[i].start;
+    uint64_t first = ctrl->stamp[i].first_ns;
+    uint64_t last = ctrl->stamp[i].last_ns;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (b->seq + MYRING_STAMPS <= myring_load_acquire(&ctrl->stamp_seq)) continue;
+    if (head <= pos) {
+      b->seq++;
+      continue;
+    }
+    if (start > pos || last < first) return 0;
+    /* the commit that covered the record's end, never before it */
+    uint64_t end = pos + reclen < head ? pos + reclen : head;
+    return first + (uint64_t)((double)(last - first) * (double)(end - start) / (double)(head - start));
+  }
+}
+
+/* One record, handled at now */
+static inline void myring_breakdown_rec(struct myring_breakdown *b, const struct myring_consumer *c,
+                                        const struct myring_rec *rec, uint64_t now)
+{
+  uint64_t ts = rec->hdr->ts_ns;
+  uint64_t commit = myring_breakdown_commit(b, c->ctrl, rec->pos, rec->reclen);
+  if (!commit) {
+    b->skipped++;
+    return;
+  }
+  b->matched++;
+  if (commit < ts) commit = ts;
+  /* committed after the batch's signal: it never waited for one */
+  uint64_t notified = rec->pos < b->notify_head && b->notify_ns > commit ? b->notify_ns : commit;
+  uint64_t woke = b->wake_ns > notified ? b->wake_ns : notified;
+  if (now < woke) now = woke;
+  myring_hist_add(&b->queue, commit - ts);
+  myring_hist_add(&b->notify, notified - commit);
+  myring_hist_add(&b->wakeup, woke - notified);
+  myring_hist_add(&b->process, now - woke);
+  myring_hist_add(&b->total, now - ts);
+}
+
+/* --- heavy hitters: count-min sketch + space-saving top-K ---
+   Fixed memory whatever the key cardinality: a depth x width count-min
+   sketch estimates every key's weight (conservative update, so it only
+   ever over-counts by what collided), and k monitored entries hold the
+   current top-K. A key that isn't monitored replaces the smallest entry
+   only once its sketch estimate beats that entry, so one-off keys don't
+   churn the table; it enters with the estimate as its count and the
+   estimate minus this record as its possible error. Per record: depth
+   counter updates, one probe of a small open-addressing index, and a
+   sift in a k-entry min-heap that almost never moves far. Keys are up to
+   MYRING_SKETCH_KEY_MAX bytes (a flow 5-tuple, a payload prefix, a CPU
+   number); reset between reporting intervals for tumbling windows. */
+
+#define MYRING_SKETCH_KEY_MAX 40
+
+struct myring_topk {
+  uint64_t count;             /* estimated weight, >= the true one */
+  uint64_t err;               /* count - err <= true weight */
+  uint64_t hash;
+  uint32_t len;
+  uint8_t key[MYRING_SKETCH_KEY_MAX];
+};
+
+struct myring_sketch {
+  uint32_t depth, width;      /* width a power of two */
+  uint64_t *cm;               /* depth rows of width counters */
+  uint32_t k, n;              /* monitored entries: capacity, in use */
+  struct myring_topk *ent;
+  uint32_t *heap;             /* entry indices, min-heap on count */
+  uint32_t *pos;              /* heap position of each entry */
+  uint32_t *index;            /* hash -> entry + 1, linear probing; 0 = empty */
+  uint32_t index_mask;
+  uint64_t total;             /* weight added since the last reset */
+};
+
+static inline uint64_t myring_sketch_hash(const void *key, uint32_t len)
+{
+  const uint8_t *p = (const uint8_t *)key;
+  uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+  while (len >= 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 31;
+    p += 8;
+    len -= 8;
+  }
+  if (len) {
+    uint64_t w = 0;
+    memcpy(&w, p, len);
+    h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+  }
+  h ^= h >> 33;
+  h *= 0x94D049BB133111EBull;
+  h ^= h >> 29;
+  return h;
+}
+
+static inline void myring_sketch_free(struct myring_sketch *s)
+{
+  free(s->cm);
+  free(s->ent);
+  free(s->heap);
+  free(s->pos);
+  free(s->index);
+  memset(s, 0, sizeof(*s));
+}
+
+static inline void myring_sketch_reset(struct myring_sketch *s)
+{
+  memset(s->cm, 0, (size_t)s->depth * s->width * sizeof(*s->cm));
+  memset(s->index, 0, ((size_t)s->index_mask + 1) * sizeof(*s->index));
+  s->n = 0;
+  s->total = 0;
+}
+
+/* depth rows (1..8) of width counters (rounded up to a power of two), top
+   k. Returns 0, or -1 with errno set. */
+static inline int myring_sketch_init(struct myring_sketch *s, uint32_t depth, uint32_t width, uint32_t k)
+{
+  memset(s, 0, sizeof(*s));
+  if (!depth || depth > 8 || !width || width > (1u << 30) || !k || k > (1u << 20)) {
+    errno = EINVAL;
+    return -1;
+  }
+  s->depth = depth;
+  for (s->width = 1; s->width < width; s->width <<= 1) ;
+  s->k = k;
+  uint32_t isz = 1;
+  while (isz < 2 * k) isz <<= 1;  /* index at most half full */
+  s->index_mask = isz - 1;
+  s->cm = (uint64_t *)calloc((size_t)depth * s->width, sizeof(*s->cm));
+  s->ent = (struct myring_topk *)calloc(k, sizeof(*s->ent));
+  s->heap = (uint32_t *)calloc(k, sizeof(*s->heap));
+  s->pos = (uint32_t *)calloc(k, sizeof(*s->pos));
+  s->index = (uint32_t *)calloc(isz, sizeof(*s->index));
+  if (!s->cm || !s->ent || !s->heap || !s->pos || !s->index) {
+    myring_sketch_free(s);
+    errno = ENOMEM;
+    return -1;
+  }
+  return 0;
+}
+
+static MYRING_ALWAYS_INLINE void myring_sketch_heap_swap(struct myring_sketch *s, uint32_t a, uint32_t b)
+{
+  uint32_t ea = s->heap[a], eb = s->heap[b];
+  s->heap[a] = eb;
+  s->heap[b] = ea;
+  s->pos[eb] = a;
+  s->pos[ea] = b;
+}
+
+/* Entry at heap position i grew: move it towards the leaves */
+static MYRING_ALWAYS_INLINE void myring_sketch_sift(struct myring_sketch *s, uint32_t i)
+{
+  for (;;) {
+    uint32_t l = 2 * i + 1, r = l + 1, min = i;
+    if (l < s->n && s->ent[s->heap[l]].count < s->ent[s->heap[min]].count) min = l;
+    if (r < s->n && s->ent[s->heap[r]].count < s->ent[s->heap[min]].count) min = r;
+    if (min == i) return;
+    myring_sketch_heap_swap(s, i, min);
+    i = min;
+  }
+}
+
+/* Index slot holding the entry for (hash, key), or the empty slot where it
+   would go */
+static MYRING_ALWAYS_INLINE uint32_t myring_sketch_find(const struct myring_sketch *s, uint64_t h,
+                                                        const void *key, uint32_t len)
+{
+  uint32_t i = (uint32_t)h & s->index_mask;
+  for (;; i = (i + 1) & s->index_mask) {
+    uint32_t e = s->index[i];
+    if (!e) return i;
+    const struct myring_topk *t = &s->ent[e - 1];
+    if (t->hash == h && t->len == len && memcmp(t->key, key, len) == 0) return i;
+  }
+}
+
+/* Remove index slot i, shifting later entries of its probe run back */
+static inline void myring_sketch_unindex(struct myring_sketch *s, uint32_t i)
+{
+  uint32_t j = i;
+  for (;;) {
+    s->index[i] = 0;
+    for (;;) {
+      j = (j + 1) & s->index_mask;
+      if (!s->index[j]) return;
+      uint32_t home = (uint32_t)s->ent[s->index[j] - 1].hash & s->index_mask;
+      /* j's entry may move to i unless its home lies cyclically in (i, j] */
+      if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) break;
+    }
+    s->index[i] = s->index[j];
+    i = j;
+  }
+}
+
+/* Add weight w for key (len bytes, cut to MYRING_SKETCH_KEY_MAX) */
+static MYRING_ALWAYS_INLINE void myring_sketch_add(struct myring_sketch *s, const void *key,
+                                                   uint32_t len, uint64_t w)
+{
+  if (len > MYRING_SKETCH_KEY_MAX) len = MYRING_SKETCH_KEY_MAX;
+  uint64_t h = myring_sketch_hash(key, len);
+  uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1, mask = s->width - 1;
+  uint64_t *cell[8];
+  uint64_t est = UINT64_MAX;
+
+  /* conservative update: raise only the cells below the new minimum */
+  for (uint32_t r = 0; r < s->depth; r++) {
+    cell[r] = &s->cm[(size_t)r * s->width + ((h1 + r * h2) & mask)];
+    if (*cell[r] < est) est = *cell[r];
+  }
+  est += w;
+  for (uint32_t r = 0; r < s->depth; r++)
+    if (*cell[r] < est) *cell[r] = est;
+  s->total += w;
+
+  uint32_t slot = myring_sketch_find(s, h, key, len);
+  uint32_t e = s->index[slot];
+  if (e) {
+    s->ent[e - 1].count += w;
+    myring_sketch_sift(s, s->pos[e - 1]);
+    return;
+  }
+  if (s->n < s->k) {
+    e = s->n++;
+    s->heap[e] = e;
+    s->pos[e] = e;
+    /* the new entry is the largest count seen so far or it sifts up */
+    for (uint32_t i = e; i && est < s->ent[s->heap[(i - 1) / 2]].count; i = (i - 1) / 2)
+      myring_sketch_heap_swap(s, i, (i - 1) / 2);
+  } else {
+    e = s->heap[0];
+    if (est <= s->ent[e].count) return;
+    myring_sketch_unindex(s, myring_sketch_find(s, s->ent[e].hash, s->ent[e].key, s->ent[e].len));
+    slot = myring_sketch_find(s, h, key, len);  /* the probe run may have shifted */
+  }
+  struct myring_topk *t = &s->ent[e];
+  t->count = est;
+  t->err = est - w;
+  t->hash = h;
+  t->len = len;
+  memcpy(t->key, key, len);
+  s->index[slot] = e + 1;
+  myring_sketch_sift(s, s->pos[e]);
+}
+
+/* Sketch estimate for any key, monitored or not */
+static inline uint64_t myring_sketch_estimate(const struct myring_sketch *s, const void *key, uint32_t len)
+{
+  if (len > MYRING_SKETCH_KEY_MAX) len = MYRING_SKETCH_KEY_MAX;
+  uint64_t h = myring_sketch_hash(key, len), est = UINT64_MAX;
+  uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+  for (uint32_t r = 0; r < s->depth; r++) {
+    uint64_t v = s->cm[(size_t)r * s->width + ((h1 + r * h2) & (s->width - 1))];
+    if (v < est) est = v;
+  }
+  return est;
+}
+
+static inline int myring_topk_cmp(const void *a, const void *b)
+{
+  uint64_t ca = ((const struct myring_topk *)a)->count, cb = ((const struct myring_topk *)b)->count;
+  return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+/* Copy up to max monitored entries, largest first. Returns the count. */
+static inline uint32_t myring_sketch_top(const struct myring_sketch *s, struct myring_topk *out, uint32_t max)
+{
+  struct myring_topk *tmp = (struct myring_topk *)malloc((size_t)s->n * sizeof(*tmp) + 1);
+  if (!tmp) return 0;
+  memcpy(tmp, s->ent, (size_t)s->n * sizeof(*tmp));
+  qsort(tmp, s->n, sizeof(*tmp), myring_topk_cmp);
+  uint32_t n = s->n < max ? s->n : max;
+  memcpy(out, tmp, (size_t)n * sizeof(*out));
+  free(tmp);
+  return n;
+}
+
+/* --- capture files ---
+   MYRING_IOC_CAPTURE writes records back to back exactly as they sat in the
+   ring (so does capz -d). myring_capfile_reader() points a consumer at a
+   byte range of such a file, mapped read-only: the drain loops and handlers
+   written for a live ring run over it unchanged. Each thread can take its
+   own range once myring_capfile_split() has found record boundaries. */
+
+struct myring_capfile {
+  int fd;
+  const uint8_t *data;
+  uint64_t len;
+  uint32_t slot_size;         /* 0 = variable-length records */
+};
+
+/* slot_size as the capturing ring had it (a power of two), or 0. Returns 0,
+   or -1 with errno set. */
+static inline int myring_capfile_open(struct myring_capfile *f, const char *path, uint32_t slot_size)
+{
+  struct stat st;
+  memset(f, 0, sizeof(*f));
+  if (slot_size & (slot_size - 1)) { errno = EINVAL; return -1; }
+  f->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (f->fd < 0) return -1;
+  if (fstat(f->fd, &st) != 0) goto fail;
+  f->len = (uint64_t)st.st_size;
+  f->slot_size = slot_size;
+  if (f->len) {
+    void *p = mmap(NULL, f->len, PROT_READ, MAP_SHARED, f->fd, 0);
+    if (p == MAP_FAILED) goto fail;
+    f->data = (const uint8_t *)p;
+  }
+  return 0;
+
+fail: {
+    int err = errno;
+    close(f->fd);
+    f->fd = -1;
+    errno = err;
+    return -1;
+  }
+}
+
+static inline void myring_capfile_close(struct myring_capfile *f)
+{
+  if (f->data) munmap((void *)f->data, f->len);
+  if (f->fd >= 0) close(f->fd);
+  memset(f, 0, sizeof(*f));
+  f->fd = -1;
+}
+
+/* Cut the file into parts ranges of about equal size at record
+   boundaries: cuts[0] = 0, cuts[parts] = the end of the last whole record.
+   Slot files are cut by arithmetic; others take one pass over the record
+   headers. Returns the number of non-empty ranges, which may be fewer. */
+static inline unsigned myring_capfile_split(const struct myring_capfile *f, uint64_t *cuts, unsigned parts)
+{
+  uint64_t pos = 0, end = f->len;
+  unsigned n = 0;
+
+  if (f->slot_size) end -= end % f->slot_size;
+  cuts[0] = 0;
+  for (unsigned i = 1; i <= parts; i++) {
+    uint64_t want = i == parts ? end : end / parts * i;
+    if (f->slot_size) {
+      pos = want - want % f->slot_size;
+    } else {
+      while (pos < want && end - pos >= sizeof(struct myring_rec_hdr)) {
+        struct myring_rec_hdr hdr;
+        memcpy(&hdr, f->data + pos, sizeof(hdr));
+        if (sizeof(hdr) + (uint64_t)hdr.len > end - pos) break;  /* torn tail */
+        pos += sizeof(hdr) + hdr.len;
+      }
+    }
+    if (pos > cuts[n]) cuts[++n] = pos;
+  }
+  return n;
+}
+
+/* Point c at [start, end) of f. ctrl is the consumer's control block (8-byte
+   aligned), owned by the caller and valid as long as c is used; nothing is
+   ever published through it. */
+static inline void myring_capfile_reader(const struct myring_capfile *f, struct myring_consumer *c,
+                                         struct myring_ctrl *ctrl, uint64_t start, uint64_t end)
+{
+  uint64_t size = 1;
+  while (size < f->len) size <<= 1;  /* positions never wrap */
+  memset(ctrl, 0, sizeof(*ctrl));
+  ctrl->size = size;
+  ctrl->head = end;
+  ctrl->tail = start;
+  ctrl->slot_size = f->slot_size;
+  c->fd = -1;
+  myring_consumer_setup(c, ctrl, 0, 0);
+  c->data = (uint8_t *)f->data;
+}
+
+/* --- flows --- */
+
+struct myring_flow_key {
+  uint8_t saddr[16];
+  uint8_t daddr[16];
+  uint16_t sport;
+  uint16_t dport;
+  uint8_t proto;
+  uint8_t ip_version;
+} __attribute__((packed));
+
+static inline void myring_flow_key(struct myring_flow_key *k, const struct myring_pkt_meta *m)
+{
+  memcpy(k->saddr, m->saddr, sizeof(k->saddr));
+  memcpy(k->daddr, m->daddr, sizeof(k->daddr));
+  k->sport = m->sport;
+  k->dport = m->dport;
+  k->proto = m->proto;
+  k->ip_version = m->ip_version;
+}
+
+/* "proto saddr:sport -> daddr:dport" */
+static inline void myring_flow_str(const struct myring_flow_key *k, char *buf, size_t len)
+{
+  int af = k->ip_version == 6 ? AF_INET6 : AF_INET;
+  char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+  inet_ntop(af, k->saddr, src, sizeof(src));
+  inet_ntop(af, k->daddr, dst, sizeof(dst));
+  snprintf(buf, len, "%u %s:%u -> %s:%u", k->proto, src, k->sport, dst, k->dport);
+}
+
+#endif /* _MYRING_CONSUMER_H_ */
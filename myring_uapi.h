@@ -12,19 +12,172 @@
 #define MYRING_IOC_RESET           _IO(MYRING_IOC_MAGIC, 5)
 #define MYRING_IOC_GET_CONFIG     _IOR(MYRING_IOC_MAGIC, 6, struct myring_config)
 #define MYRING_IOC_SET_RATE       _IOW(MYRING_IOC_MAGIC, 7, __u32)
+#define MYRING_IOC_SET_ROUTE      _IOW(MYRING_IOC_MAGIC, 8, struct myring_route)
+#define MYRING_IOC_SELFTEST      _IOWR(MYRING_IOC_MAGIC, 9, struct myring_selftest)
+#define MYRING_IOC_INJECT        _IOWR(MYRING_IOC_MAGIC, 10, struct myring_inject)
+#define MYRING_IOC_SET_NF_HOOKS   _IOW(MYRING_IOC_MAGIC, 11, __u32)
+#define MYRING_IOC_PAGES         _IOWR(MYRING_IOC_MAGIC, 12, struct myring_pages)
+#define MYRING_IOC_SET_USER_PROD  _IOW(MYRING_IOC_MAGIC, 13, __u32)
+#define MYRING_IOC_NOTIFY          _IO(MYRING_IOC_MAGIC, 14)
+#define MYRING_IOC_CAPTURE       _IOWR(MYRING_IOC_MAGIC, 15, struct myring_capture)
+#define MYRING_IOC_SET_STAMPS     _IOW(MYRING_IOC_MAGIC, 16, __u32)
+
+/* Ring instances: /dev/myring is ring 0, /dev/myring1.. the others */
+#define MYRING_MAX_RINGS   8
+#define MYRING_MAX_ROUTES  16
 
 /* Record types */
 #define REC_TYPE_PKT   1
+#define REC_TYPE_PKT_META  2  /* struct myring_pkt_meta + cap_len payload bytes */
+#define REC_TYPE_PAGE  3      /* struct myring_rec_page, payload in a flip page */
 #define REC_TYPE_DROP  0xFFFF
 
+/* Record sources, for routing */
+#define MYRING_SRC_SYNTH      1  /* synthetic producer */
+#define MYRING_SRC_NETFILTER  2  /* netfilter hook */
+#define MYRING_SRC_RING       3  /* records the ring emits itself (DROP) */
+#define MYRING_SRC_XDP        4  /* bpf_myring_push_xdp() */
+#define MYRING_SRC_TC         5  /* bpf_myring_push_skb(), tc ingress */
+
+/* Netfilter capture points (USE_NETFILTER). A hook mask has one bit per
+   family and hook, MYRING_NF_IPV4(h) / MYRING_NF_IPV6(h), where h is
+   numbered like enum nf_inet_hooks. Only hooks in the mask are registered. */
+#define MYRING_NF_PRE_ROUTING   0
+#define MYRING_NF_LOCAL_IN      1
+#define MYRING_NF_FORWARD       2
+#define MYRING_NF_LOCAL_OUT     3
+#define MYRING_NF_POST_ROUTING  4
+#define MYRING_NF_IPV6_SHIFT    8
+#define MYRING_NF_IPV4(h)       (1u << (h))
+#define MYRING_NF_IPV6(h)       (1u << (MYRING_NF_IPV6_SHIFT + (h)))
+#define MYRING_NF_ALL           0x1F1Fu
+
 /* Flags */
 #define CTRL_FLAG_DROPPING   (1u << 0)
 
+/* User producer mode (MYRING_IOC_SET_USER_PROD): a process that opened
+   the device writes records and head itself, the consumer publishes tail
+   with a plain store-release, kernel producers drop. Either side about to
+   sleep sets its wait flag (atomically: both sides share the word), then
+   re-checks the ring; the other side, after publishing, issues
+   MYRING_IOC_NOTIFY only if the flag is set. */
+#define CTRL_FLAG_USER_PROD    (1u << 1)
+#define CTRL_FLAG_NEED_WAKEUP  (1u << 2)  /* consumer waits for records */
+#define CTRL_FLAG_PROD_WAIT    (1u << 3)  /* producer waits for <= lo_pct */
+
+/* Latency breakdown stamps (MYRING_IOC_SET_STAMPS). Head commits are
+   logged in stamp[stamp_seq % MYRING_STAMPS] before head is published. An
+   entry covers ring bytes [start, head), committed between first_ns and
+   last_ns: a commit extends the newest entry (last_ns, then head) unless
+   the consumer has read all of it, i.e. a new batch begins, or it would
+   span more than 1/(MYRING_STAMPS / 2) of the ring. Then it opens the next
+   entry and bumps stamp_seq. Unread records thus never need more than half
+   the log, however many commits a batch takes. The first eventfd/poll
+   signal after the consumer moved tail sets notify_ns and then
+   notify_head (head at that moment). */
+#define CTRL_FLAG_STAMPS       (1u << 4)
+#define MYRING_STAMPS          64
+
+/* Record header flags. PKT records from the netfilter source carry
+   REC_FLAG_NF plus the hook's bit number in the hook mask, so
+   MYRING_NF_IPV4(h) == 1u << REC_NF_BIT(flags) for an IPv4 hook h. */
+#define REC_FLAG_NF          (1u << 15)
+/* Wake the consumer as soon as the record is in the ring, whatever the
+   watermarks say. Set on every DROP record; producers and injected records
+   may set it for alarms. */
+#define REC_FLAG_URGENT      (1u << 14)
+#define REC_NF_BIT(f)        ((f) & 0xFFu)
+#define REC_NF_HOOK(f)       ((f) & 0x7u)
+#define REC_NF_IS_IPV6(f)    (((f) & (1u << MYRING_NF_IPV6_SHIFT)) != 0)
+
 struct myring_watermarks {
   __u32 hi_pct;  /* e.g., 50 */
   __u32 lo_pct;  /* e.g., 30 */
 };
 
+/* Send records of (type, source) to ring. type 0 / source 0 match any;
+   the most specific entry wins, unmatched records go to ring 0.
+   ring = MYRING_ROUTE_DEL removes the (type, source) entry. */
+#define MYRING_ROUTE_DEL  0xFFFFFFFFu
+struct myring_route {
+  __u16 type;
+  __u16 source;
+  __u32 ring;
+};
+
+/* In-kernel loopback over this ring's memory and cursor protocol: a
+   producer kthread on prod_cpu and a consumer kthread on cons_cpu for
+   duration_ms. The ring is reset before and after; records other
+   producers route to it meanwhile are dropped. */
+struct myring_selftest {
+  __u32 rec_size;        /* payload bytes per record */
+  __u32 prod_cpu;
+  __u32 cons_cpu;
+  __u32 duration_ms;     /* 0 = 1000, max 10000 */
+  __u64 records;         /* out: records consumed */
+  __u64 bytes;           /* out: bytes consumed, headers included */
+  __u64 ns;              /* out: consumer run time */
+};
+
+/* Push user-built records into this ring through the normal enqueue path
+   (drop accounting, DROP records, watermarks). buf holds records back to
+   back, each a struct myring_rec_hdr followed by hdr.len payload bytes;
+   ts_ns 0 is stamped at enqueue. Types 0 and REC_TYPE_DROP are refused,
+   payloads are limited to MYRING_INJECT_MAX_PAYLOAD. */
+#define MYRING_INJECT_MAX_PAYLOAD  65536
+struct myring_inject {
+  __u64 buf;             /* user pointer */
+  __u32 len;             /* bytes in buf */
+  __u32 records;         /* out: records enqueued */
+  __u32 dropped;         /* out: records dropped, ring full */
+  __u32 _pad;
+};
+
+/* Zero-copy page flipping (flip_pages=N). The ring has N page slots,
+   mapped separately at MYRING_OFF_FLIP. A PAGE record hands slot `slot`
+   to the consumer; the payload is its first `len` bytes. The slot stays
+   the consumer's until its tail passes the record, then the producer may
+   install a new page there. Slots are mapped by fault, so after a flip
+   the next access picks up the new page: no payload bytes are copied. */
+#define MYRING_OFF_FLIP  (1ull << 40)   /* mmap offset of the flip window */
+struct myring_rec_page {
+  __u32 slot;
+  __u32 len;
+} __attribute__((packed));
+
+/* Kernel page producer, for comparing copy and flip: count records of len
+   (<= page size) bytes, each written into a page first, then either
+   copied into the ring as a PKT record or, with MYRING_PAGES_FLIP, flipped
+   into a slot behind a PAGE record. Waits while the ring or the slots are
+   full; a signal ends it early. */
+#define MYRING_PAGES_FLIP  (1u << 0)
+struct myring_pages {
+  __u32 len;
+  __u32 count;
+  __u32 flags;           /* MYRING_PAGES_* */
+  __u32 records;         /* out: records produced */
+  __u64 ns;              /* out: producer run time */
+};
+
+/* Kernel capture-to-file (MYRING_IOC_CAPTURE). A kernel thread becomes
+   the ring's consumer and appends the ring bytes, records back to back
+   exactly as in the ring, to path.0, path.1, ... Every file starts and
+   ends on a record boundary. An empty path stops the capture and returns
+   the totals. Capture outlives the file descriptor that started it.
+   Needs CAP_SYS_ADMIN; files are opened with the starter's credentials. */
+#define MYRING_CAPTURE_PATH_MAX  256
+struct myring_capture {
+  char  path[MYRING_CAPTURE_PATH_MAX];  /* absolute */
+  __u64 rotate_bytes;    /* start the next file past this size, 0 = one file */
+  __u32 max_files;       /* reuse names round robin after N files, 0 = never */
+  __u32 chunk_kb;        /* write once this much is queued (default 1024) */
+  __u32 flush_ms;        /* and whatever is queued this often (default 100) */
+  __s32 error;           /* out (stop): first write/open error, 0 = none */
+  __u64 bytes;           /* out (stop): bytes written, all files */
+  __u32 files;           /* out (stop): files opened */
+  __u32 _pad;
+};
+
 struct myring_advance {
   __u64 new_tail;
 };
@@ -56,6 +209,21 @@ struct myring_ctrl {
   __u32 _pad;
   __u64 drop_start_ns;
   __u64 lost_in_drop;
+  __u32 ring_id;         /* index of this ring instance */
+  __u32 nr_rings;        /* ring instances loaded */
+  __u32 slot_size;       /* slot mode: every record takes this many bytes,
+                            slot i of the ring at i * slot_size; 0 = records
+                            are sizeof(hdr) + len bytes back to back */
+  __u32 flip_pages;      /* page slots at MYRING_OFF_FLIP, 0 = none */
+  volatile __u64 stamp_seq;    /* CTRL_FLAG_STAMPS: log entries opened so far */
+  volatile __u64 notify_ns;
+  volatile __u64 notify_head;
+  struct myring_stamp {
+    __u64 start;
+    __u64 head;
+    __u64 first_ns;
+    __u64 last_ns;
+  } stamp[MYRING_STAMPS];
 } __attribute__((packed));
 
 /* record header (in ring data) */
@@ -66,11 +234,33 @@ struct myring_rec_hdr {
   __u64 ts_ns;
 } __attribute__((packed));
 
+/* REC_TYPE_PKT_META payload (netfilter source with nf_meta=1): headers
+   parsed once in the kernel. Fields a packet doesn't have are 0 (no ports
+   in non-first fragments or for protocols other than TCP/UDP/UDP-Lite).
+   Offsets are from the L3 header. cap_len bytes of L4 payload follow. */
+struct myring_pkt_meta {
+  __u8  saddr[16];       /* network order; IPv4 uses the first 4 bytes */
+  __u8  daddr[16];
+  __u16 sport;           /* host order */
+  __u16 dport;
+  __u8  ip_version;      /* 4 or 6 */
+  __u8  proto;           /* IPPROTO_*, past any IPv6 extension headers */
+  __u8  tcp_flags;       /* FIN..CWR byte of the TCP header */
+  __u8  hook;            /* hook mask bit, as REC_NF_BIT() */
+  __u32 ifindex;         /* input device, output device on the way out */
+  __u32 pkt_len;         /* L3 length */
+  __u16 l4_off;
+  __u16 payload_off;
+  __u32 cap_len;
+  __u32 cpu;             /* CPU the hook ran on */
+} __attribute__((packed));
+
 /* drop payload */
 struct myring_rec_drop {
   __u32 lost;
   __u64 start_ns;
   __u64 end_ns;
+  __u32 ring;            /* ring the records were lost from */
 } __attribute__((packed));
 
 #endif /* _MYRING_UAPI_H_ */
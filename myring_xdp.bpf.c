@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0
+// myring BPF ingest source: XDP and tc ingress programs that copy the first
+// snaplen bytes of each packet into the ring through the module's kfuncs
+// (module built with -DUSE_BPF_KFUNC). Packets always continue unchanged.
+//
+// Build : make bpf        (needs clang, bpftool and /sys/kernel/btf/vmlinux)
+// Attach: ip link set dev eth0 xdpgeneric obj build/myring_xdp.bpf.o sec xdp
+//         tc qdisc add dev eth0 clsact
+//         tc filter add dev eth0 ingress bpf da obj build/myring_xdp.bpf.o sec tc
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+
+#define TC_ACT_OK 0
+
+extern int bpf_myring_push_xdp(struct xdp_md *ctx, __u32 snaplen) __ksym;
+extern int bpf_myring_push_skb(struct __sk_buff *skb, __u32 snaplen) __ksym;
+
+const volatile __u32 snaplen = 256;
+
+SEC("xdp")
+int myring_xdp(struct xdp_md *ctx)
+{
+  bpf_myring_push_xdp(ctx, snaplen);
+  return XDP_PASS;
+}
+
+SEC("tc")
+int myring_tc(struct __sk_buff *skb)
+{
+  bpf_myring_push_skb(skb, snaplen);
+  return TC_ACT_OK;
+}
+
+char LICENSE[] SEC("license") = "GPL";
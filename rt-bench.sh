@@ -0,0 +1,68 @@
+#!/usr/bin/env bash
+# myring real-time scheduling benchmark
+# Loads the module in each producer/consumer scheduling mode, runs the consumer
+# under background load and prints its end-to-end latency percentiles.
+#
+# Usage: ./rt-bench.sh [packets] [rate_hz]
+# Background load: stress-ng (cpu hogs + cyclic timer noise) if installed,
+#                  otherwise one busy loop per CPU.
+
+set -e
+
+PACKETS="${1:-20000}"
+RATE="${2:-10000}"
+NCPU=$(nproc)
+PROD_CPU=$((NCPU > 1 ? 1 : 0))
+CONS_CPU=$((NCPU > 2 ? 2 : 0))
+
+echo "=== MyRing RT Benchmark ==="
+echo "$(date): packets=${PACKETS} rate=${RATE}Hz cpus=${NCPU} prod_cpu=${PROD_CPU} cons_cpu=${CONS_CPU}"
+
+make
+make user
+
+LOAD_PIDS=()
+start_load() {
+    if command -v stress-ng >/dev/null; then
+        stress-ng --cpu "${NCPU}" --cyclic 1 --cyclic-policy fifo --cyclic-prio 10 --quiet &
+        LOAD_PIDS+=($!)
+    else
+        for _ in $(seq "${NCPU}"); do
+            ( while :; do :; done ) &
+            LOAD_PIDS+=($!)
+        done
+    fi
+}
+stop_load() {
+    kill "${LOAD_PIDS[@]}" 2>/dev/null || true
+    wait 2>/dev/null || true
+    LOAD_PIDS=()
+}
+trap stop_load EXIT
+
+# name | insmod params | consumer sched options
+run_case() {
+    local name="$1" params="$2" sched="$3"
+    lsmod | grep -q '^myring' && sudo rmmod myring
+    sudo insmod build/myring.ko rate_hz="${RATE}" prod_cpu="${PROD_CPU}" ${params}
+    sleep 0.5
+    start_load
+    # hi=0/lo=0: wake on every commit, so the number is scheduling, not batching
+    # SCHED_DEADLINE refuses tasks pinned narrower than their root domain
+    local line pin="taskset -c ${CONS_CPU}"
+    [[ "${sched}" == *deadline* ]] && pin=""
+    line=$(sudo ${pin} build/user -q -w 0:0 -n "${PACKETS}" ${sched} | grep '^Latency')
+    stop_load
+    printf "%-22s %s\n" "${name}" "${line}"
+}
+
+echo "----------------------------------------"
+run_case "workqueue + CFS"      ""                                   ""
+run_case "kthread + CFS"        "prod_kthread=1"                     ""
+run_case "FIFO + FIFO"          "prod_kthread=1 prod_policy=1 prod_prio=80" "-s fifo -p 80"
+run_case "DEADLINE + DEADLINE"  "prod_kthread=1 prod_policy=6 prod_runtime_us=20 prod_period_us=100" \
+                                "-s deadline -R 200 -P 1000"
+echo "----------------------------------------"
+
+sudo rmmod myring
+echo "$(date): RT benchmark finished"
@@ -1,7 +1,21 @@
 // SPDX-License-Identifier: MIT
 // user-space consumer for myring
-// - opens /dev/myring, sets watermarks, registers eventfd
+// - opens /dev/myring (or another ring instance), sets routes and watermarks,
+//   registers eventfd
 // - mmaps ctrl+data, waits on epoll(eventfd), consumes records, advances tail
+// - record handling goes through myring_consumer.h's compile-time dispatcher
+// - optional SCHED_FIFO/SCHED_DEADLINE and end-to-end latency percentiles
+// - optional per-stage latency breakdown (-B) from the kernel's commit and
+//   notify stamps
+// - optional heavy hitters (-K): top-k flows, payload prefixes or CPUs by
+//   bytes, reported every interval
+// - USDT probes (myring:*) from the consumer library, plus myring:wakeup
+//   after each epoll_wait
+//
+// Usage: user [-d dev] [-r type:source:ring]... [-N nf_hook_mask] [-s other|fifo|deadline]
+//             [-p prio] [-R runtime_us] [-P period_us] [-w hi:lo] [-n packets]
+//             [-f prefetch_lines] [-K flow|prefix:N|cpu] [-k topk] [-i interval_ms]
+//             [-B] [-q] [rate_hz]
 
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -20,8 +34,11 @@
 #include <sys/sysmacros.h>
 #include <inttypes.h>
 #include <time.h>
+#include <getopt.h>
+#include <arpa/inet.h>
 
 #include "myring_uapi.h"
+#include "myring_consumer.h"
 
 /* Get current timestamp as string */
 static void get_timestamp_str(char *buf, size_t buf_size) {
@@ -47,34 +64,6 @@ static void get_timestamp_str(char *buf, size_t buf_size) {
     fprintf(stderr, "[%s %s:%d] ERROR: " fmt, ts_buf, __FILE__, __LINE__, ##__VA_ARGS__); \
 } while(0)
 
-#ifndef PAGE_SIZE
-#define PAGE_SIZE 4096
-#endif
-
-/* Choose a mapping size. Must match kernel's allocation:
-   total = PAGE_SIZE + (1ull << ring_order). We don't know ring_order here,
-   so we'll probe via /proc or just map a generous upper bound. For demo,
-   map  (PAGE_SIZE + 4MB) by default; adjust via env if needed. */
-#define DEFAULT_RING_SIZE   (1ull << 20) /* 1MB */
-#define DEFAULT_MAP_SIZE    (PAGE_SIZE + DEFAULT_RING_SIZE)
-
-static inline uint64_t load_acquire_u64(volatile uint64_t *p) {
-  __sync_synchronize();
-  return *p;
-}
-static inline void store_release_u64(volatile uint64_t *p, uint64_t v) {
-  *p = v;
-  __sync_synchronize();
-}
-
-/* Safe load for potentially unaligned packed struct members */
-static inline uint64_t load_acquire_u64_packed(const volatile void *p) {
-  __sync_synchronize();
-  uint64_t val;
-  memcpy(&val, (const void*)p, sizeof(val));
-  return val;
-}
-
 static void hexdump(const void *buf, size_t len, size_t max)
 {
   const unsigned char *p = (const unsigned char*)buf;
@@ -87,9 +76,312 @@ static void hexdump(const void *buf, size_t len, size_t max)
   fprintf(stdout, "\n");
 }
 
+static uint64_t mono_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* consumer state shared by the record handlers */
+struct consume_state {
+  uint64_t total_packets;
+  uint64_t total_drops;
+  uint64_t total_bytes;
+  uint64_t head;              /* head snapshot for diagnostics */
+  uint64_t max_packets;       /* stop after this many (-n) */
+  bool quiet;                 /* -q: no per-packet output */
+  bool stop;
+  const struct myring_consumer *ring;
+  struct timespec start_time;
+  struct myring_hist lat;     /* ts_ns (kernel, CLOCK_MONOTONIC) -> handler */
+  struct myring_hist urgent_lat;  /* the same for REC_FLAG_URGENT records */
+  struct myring_sketch *sketch;   /* -K: heavy hitters, NULL = off */
+  int sketch_key;                 /* SKETCH_KEY_* */
+  uint32_t prefix_len;            /* -K prefix:N */
+  struct myring_breakdown *bd;    /* -B: per-stage latency, NULL = off */
+};
+
+/* -K keys */
+enum { SKETCH_KEY_FLOW, SKETCH_KEY_PREFIX, SKETCH_KEY_CPU };
+
+/* Feed one record to the sketch, weighted by bytes. Flow and CPU keys need
+   nf_meta=1 records; raw packets only have a payload prefix. */
+static void sketch_rec(struct consume_state *s, const struct myring_rec *rec,
+                       const struct myring_pkt_meta *m)
+{
+  switch (s->sketch_key) {
+    case SKETCH_KEY_FLOW: {
+      if (!m) return;
+      struct myring_flow_key k;
+      myring_flow_key(&k, m);
+      myring_sketch_add(s->sketch, &k, sizeof(k), m->pkt_len);
+      break;
+    }
+    case SKETCH_KEY_PREFIX: {
+      const uint8_t *p = rec->payload;
+      uint32_t len = rec->hdr->len, w = len;
+      if (m) {
+        p += sizeof(*m);
+        len = len > sizeof(*m) ? len - sizeof(*m) : 0;
+        w = m->pkt_len;
+      }
+      myring_sketch_add(s->sketch, p, len < s->prefix_len ? len : s->prefix_len, w);
+      break;
+    }
+    case SKETCH_KEY_CPU:
+      if (m) myring_sketch_add(s->sketch, &m->cpu, sizeof(m->cpu), m->pkt_len);
+      break;
+  }
+}
+
+static void sketch_report(struct consume_state *s, uint32_t topk)
+{
+  struct myring_topk top[topk];
+  uint32_t n = myring_sketch_top(s->sketch, top, topk);
+  double total = s->sketch->total ? (double)s->sketch->total : 1.0;
+
+  printf("--- top %u of %" PRIu64 " bytes ---\n", n, s->sketch->total);
+  for (uint32_t i = 0; i < n; i++) {
+    const struct myring_topk *t = &top[i];
+    char key[128];
+    if (s->sketch_key == SKETCH_KEY_FLOW) {
+      struct myring_flow_key k;
+      memcpy(&k, t->key, sizeof(k));
+      myring_flow_str(&k, key, sizeof(key));
+    } else if (s->sketch_key == SKETCH_KEY_CPU) {
+      uint32_t cpu;
+      memcpy(&cpu, t->key, sizeof(cpu));
+      snprintf(key, sizeof(key), "cpu %u", cpu);
+    } else {
+      for (uint32_t j = 0; j < t->len; j++) snprintf(key + 2 * j, 3, "%02x", t->key[j]);
+      if (!t->len) snprintf(key, sizeof(key), "(empty)");
+    }
+    printf("%2u. %-48s %12" PRIu64 " (+-%" PRIu64 ") %5.1f%%\n",
+           i + 1, key, t->count, t->err, 100.0 * t->count / total);
+  }
+}
+
+static void add_latency(struct consume_state *s, const struct myring_rec *rec)
+{
+  const struct myring_rec_hdr *hdr = rec->hdr;
+  uint64_t now = mono_ns();
+  uint64_t ns = now > hdr->ts_ns ? now - hdr->ts_ns : 0;
+  myring_hist_add(hdr->flags & REC_FLAG_URGENT ? &s->urgent_lat : &s->lat, ns);
+  if (s->bd) myring_breakdown_rec(s->bd, s->ring, rec, now);
+}
+
+static void print_stage(const char *name, const struct myring_hist *h)
+{
+  printf("  %-8s p50=%9.1fus p99=%9.1fus p99.9=%9.1fus max=%9.1fus\n", name,
+         myring_hist_pct(h, 50) / 1e3, myring_hist_pct(h, 99) / 1e3,
+         myring_hist_pct(h, 99.9) / 1e3, h->max / 1e3);
+}
+
+static void log_pkt(struct consume_state *s, const struct myring_rec *rec)
+{
+  const struct myring_rec_hdr *rh = rec->hdr;
+  const uint8_t *payload = rec->payload;
+  uint64_t size = s->ring->size;
+
+  /* Detailed packet consumption diagnostics */
+  DEBUG_LOG("[CONSUME] Packet #%" PRIu64 ": ts=%" PRIu64 " len=%" PRIu32 "\n",
+         s->total_packets, rh->ts_ns, rh->len);
+  if (rh->flags & REC_FLAG_NF) {
+    static const char *const hooks[] = { "PRE_ROUTING", "LOCAL_IN", "FORWARD", "LOCAL_OUT", "POST_ROUTING" };
+    unsigned h = REC_NF_HOOK(rh->flags);
+    DEBUG_LOG("[CONSUME] Netfilter hook: %s %s\n", REC_NF_IS_IPV6(rh->flags) ? "ipv6" : "ipv4",
+              h < sizeof(hooks) / sizeof(hooks[0]) ? hooks[h] : "?");
+  }
+  DEBUG_LOG("[CONSUME] Ring state: head=%" PRIu64 " tail=%" PRIu64 " used=%" PRIu64 "\n",
+         s->head, rec->pos, s->head - rec->pos);
+  DEBUG_LOG("[CONSUME] Record position: tail_offset=%" PRIu64 " record_len=%" PRIu64 "\n",
+         rec->pos & (size - 1), rec->reclen);
+  DEBUG_LOG("[CONSUME] Memory: ring_size=%" PRIu64 " wrap=%s\n",
+         size, (size - (rec->pos & (size - 1))) < rec->reclen ? "YES" : "NO");
+
+  /* Show first 16 bytes of payload for diagnostics */
+  if (rh->len >= 8) {
+    uint64_t first8;
+    memcpy(&first8, payload, sizeof(first8));
+    DEBUG_LOG("[CONSUME] Payload first 8 bytes: 0x%016" PRIx64 "\n", first8);
+  }
+
+  /* Show detailed hexdump for first few packets */
+  if (s->total_packets <= 5) {
+    DEBUG_LOG("[CONSUME] Full hexdump for packet #%" PRIu64 ":\n", s->total_packets);
+    hexdump(payload, rh->len, rh->len); /* Show full packet for first 5 */
+  } else {
+    hexdump(payload, rh->len, 32); /* Truncated for others */
+  }
+
+  /* Print progress every 10 packets */
+  if (s->total_packets % 10 == 0) {
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC, &current_time);
+    double elapsed = (current_time.tv_sec - s->start_time.tv_sec) +
+                    (current_time.tv_nsec - s->start_time.tv_nsec) / 1e9;
+    double rate_pps = elapsed > 0 ? s->total_packets / elapsed : 0;
+    double rate_bps = elapsed > 0 ? s->total_bytes / elapsed : 0;
+
+    printf("\n=== PROGRESS ===\n");
+    printf("Packets: %" PRIu64 ", Bytes: %" PRIu64 " (%.2f KB, %.2f MB)\n",
+           s->total_packets, s->total_bytes, s->total_bytes / 1024.0, s->total_bytes / (1024.0 * 1024.0));
+    printf("Elapsed: %.2fs, Rate: %.1f pps, %.2f KB/s\n",
+           elapsed, rate_pps, rate_bps / 1024.0);
+    printf("Drops: %" PRIu64 "\n", s->total_drops);
+    printf("Ring utilization: %.1f%% (%" PRIu64 "/%" PRIu64 ")\n",
+           size > 0 ? (100.0 * (s->head - rec->pos)) / size : 0.0, s->head - rec->pos, size);
+    printf("================\n\n");
+  }
+}
+
+static int on_pkt(void *ctx, const struct myring_rec *rec)
+{
+  struct consume_state *s = ctx;
+
+  s->total_packets++;
+  s->total_bytes += rec->hdr->len;
+  add_latency(s, rec);
+  if (s->sketch) sketch_rec(s, rec, NULL);
+  if (!s->quiet) log_pkt(s, rec);
+
+  /* optional: stop early demonstration */
+  if (s->total_packets >= s->max_packets) {
+    if (!s->quiet) DEBUG_LOG("stopping after %"PRIu64" packets\n", s->total_packets);
+    s->stop = true;
+    return 1;
+  }
+  return 0;
+}
+
+/* nf_meta=1: headers already parsed by the kernel */
+static int on_meta(void *ctx, const struct myring_rec *rec)
+{
+  struct consume_state *s = ctx;
+  const struct myring_pkt_meta *m = (const struct myring_pkt_meta *)rec->payload;
+
+  s->total_packets++;
+  s->total_bytes += rec->hdr->len;
+  add_latency(s, rec);
+  if (s->sketch) sketch_rec(s, rec, m);
+  if (!s->quiet) {
+    int af = m->ip_version == 6 ? AF_INET6 : AF_INET;
+    char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+    inet_ntop(af, m->saddr, src, sizeof(src));
+    inet_ntop(af, m->daddr, dst, sizeof(dst));
+    DEBUG_LOG("[META] hook=%u if=%" PRIu32 " proto=%u %s:%u -> %s:%u len=%" PRIu32
+              " tcp_flags=0x%02x payload=%" PRIu32 "@%u\n",
+              m->hook, m->ifindex, m->proto, src, m->sport, dst, m->dport, m->pkt_len,
+              m->tcp_flags, m->cap_len, m->payload_off);
+  }
+
+  if (s->total_packets >= s->max_packets) {
+    s->stop = true;
+    return 1;
+  }
+  return 0;
+}
+
+static int on_drop(void *ctx, const struct myring_rec *rec)
+{
+  struct consume_state *s = ctx;
+  struct myring_rec_drop dr;
+  memcpy(&dr, rec->payload, sizeof(dr));
+  s->total_drops += dr.lost;
+  add_latency(s, rec);
+  DEBUG_LOG("** DROP ** ring=%" PRIu32 " lost=%" PRIu32 "  start=%" PRIu64 " end=%" PRIu64 "  (total lost=%" PRIu64 ")\n",
+         dr.ring, dr.lost, dr.start_ns, dr.end_ns, s->total_drops);
+  return 0;
+}
+
+static int on_unknown(void *ctx, const struct myring_rec *rec)
+{
+  (void)ctx;
+  DEBUG_LOG("[unknown type=0x%x] len=%" PRIu32 "\n", rec->hdr->type, rec->hdr->len);
+  return 0;
+}
+
+MYRING_DEFINE_DRAIN(drain_records, .on_pkt = on_pkt, .on_meta = on_meta, .on_drop = on_drop,
+                    .on_other = on_unknown)
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "usage: %s [-d dev] [-r type:source:ring]... [-N nf_hook_mask] [-s other|fifo|deadline]\n"
+                  "          [-p prio] [-R runtime_us] [-P period_us] [-w hi:lo] [-n packets]\n"
+                  "          [-f prefetch_lines] [-W path[:rotate_mb[:max_files]] | -W -]\n"
+                  "          [-K flow|prefix:N|cpu] [-k topk] [-i interval_ms] [-B] [-q] [rate_hz]\n", argv0);
+}
+
 int main(int argc, char **argv)
 {
   const char *dev = "/dev/myring";
+  int policy = SCHED_OTHER, prio = 50;
+  uint64_t runtime_us = 200, period_us = 1000;
+  struct myring_watermarks wm = { .hi_pct = 50, .lo_pct = 30 };
+  struct consume_state cs = { .max_packets = 100 };
+  unsigned prefetch_lines = 0;
+  struct myring_route routes[MYRING_MAX_ROUTES];
+  unsigned nroutes = 0;
+  long nf_hooks = -1;         /* -N: MYRING_NF_* mask, -1 = leave as is */
+  const char *capture = NULL; /* -W: start ("-": stop) kernel capture-to-file, then exit */
+  const char *sketch_key = NULL;  /* -K: heavy-hitter key */
+  uint32_t topk = 10;
+  int interval_ms = 1000;     /* -i: heavy-hitter reporting interval */
+  struct myring_sketch sketch;
+  bool breakdown = false;     /* -B */
+  struct myring_breakdown bd;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:r:N:s:p:R:P:w:n:f:W:K:k:i:Bqh")) != -1) {
+    switch (opt) {
+      case 'd': dev = optarg; break;
+      case 'r': {
+        int type, source, ring;  /* ring -1 = MYRING_ROUTE_DEL */
+        if (nroutes == MYRING_MAX_ROUTES ||
+            sscanf(optarg, "%i:%i:%i", &type, &source, &ring) != 3) {
+          usage(argv[0]);
+          return 2;
+        }
+        routes[nroutes++] = (struct myring_route){ .type = type, .source = source, .ring = (__u32)ring };
+        break;
+      }
+      case 'N': nf_hooks = strtol(optarg, NULL, 0); break;
+      case 's':
+        if (strcmp(optarg, "fifo") == 0) policy = SCHED_FIFO;
+        else if (strcmp(optarg, "deadline") == 0) policy = SCHED_DEADLINE;
+        else if (strcmp(optarg, "other") == 0) policy = SCHED_OTHER;
+        else { usage(argv[0]); return 2; }
+        break;
+      case 'p': prio = atoi(optarg); break;
+      case 'R': runtime_us = strtoull(optarg, NULL, 0); break;
+      case 'P': period_us = strtoull(optarg, NULL, 0); break;
+      case 'w':
+        if (sscanf(optarg, "%u:%u", &wm.hi_pct, &wm.lo_pct) != 2) { usage(argv[0]); return 2; }
+        break;
+      case 'n': cs.max_packets = strtoull(optarg, NULL, 0); break;
+      case 'f': prefetch_lines = (unsigned)atoi(optarg); break;
+      case 'W': capture = optarg; break;
+      case 'K': sketch_key = optarg; break;
+      case 'k': topk = (uint32_t)strtoul(optarg, NULL, 0); break;
+      case 'i': interval_ms = atoi(optarg); break;
+      case 'B': breakdown = true; break;
+      case 'q': cs.quiet = true; break;
+      default: usage(argv[0]); return 2;
+    }
+  }
+
+  if (sketch_key) {
+    if (strcmp(sketch_key, "flow") == 0) cs.sketch_key = SKETCH_KEY_FLOW;
+    else if (strcmp(sketch_key, "cpu") == 0) cs.sketch_key = SKETCH_KEY_CPU;
+    else if (sscanf(sketch_key, "prefix:%u", &cs.prefix_len) == 1 && cs.prefix_len &&
+             cs.prefix_len <= MYRING_SKETCH_KEY_MAX) cs.sketch_key = SKETCH_KEY_PREFIX;
+    else { usage(argv[0]); return 2; }
+    if (!topk || topk > 1000 || interval_ms <= 0) { usage(argv[0]); return 2; }
+    /* 4 x 64K counters (2 MB): estimates within ~total/16K of the truth */
+    if (myring_sketch_init(&sketch, 4, 1u << 16, 4 * topk) != 0) { perror("sketch"); return 1; }
+    cs.sketch = &sketch;
+  }
 
   DEBUG_LOG("open device %s\n", dev);
   
@@ -108,13 +400,17 @@ int main(int argc, char **argv)
   DEBUG_LOG("Device major:minor = %d:%d, mode = 0%o\n", 
          (int)major(st.st_rdev), (int)minor(st.st_rdev), st.st_mode & 0777);
   
-  DEBUG_LOG("attempting to open...\n");
-  int fd = open(dev, O_RDWR | O_NONBLOCK);
-  if (fd < 0) { 
-    ERROR_LOG("open %s failed: %s (errno=%d)\n", dev, strerror(errno), errno);
+  /* open + GET_CONFIG + mmap of ctrl page and ring data */
+  DEBUG_LOG("attempting to open and map...\n");
+  struct myring_consumer ring;
+  if (myring_consumer_open(&ring, dev) != 0) {
+    ERROR_LOG("open/mmap %s failed: %s (errno=%d)\n", dev, strerror(errno), errno);
     ERROR_LOG("Check device permissions: ls -la %s\n", dev);
+    ERROR_LOG("Check: dmesg | grep myring\n");
     return 1; 
   }
+  int fd = ring.fd;
+  myring_consumer_set_prefetch(&ring, prefetch_lines);
   DEBUG_LOG("device opened successfully (fd=%d)\n", fd);
 
   /* get current configuration */
@@ -129,13 +425,50 @@ int main(int argc, char **argv)
   }
 
   /* watermarks */
-  DEBUG_LOG("set watermark\n");
-  struct myring_watermarks wm = { .hi_pct = 50, .lo_pct = 30 };
+  DEBUG_LOG("set watermark hi=%u%% lo=%u%%\n", wm.hi_pct, wm.lo_pct);
   if (ioctl(fd, MYRING_IOC_SET_WM, &wm) != 0) { perror("IOCTL_SET_WM"); }
 
+  /* record routing is module-wide, any ring's fd will do */
+  for (unsigned i = 0; i < nroutes; i++) {
+    DEBUG_LOG("route type=0x%x source=%u -> ring %u\n", routes[i].type, routes[i].source, routes[i].ring);
+    if (ioctl(fd, MYRING_IOC_SET_ROUTE, &routes[i]) != 0) perror("SET_ROUTE");
+  }
+  DEBUG_LOG("this is ring %u of %u\n", ring.ctrl->ring_id, ring.ctrl->nr_rings);
+  if (ring.slot_size) DEBUG_LOG("slot mode, %u-byte slots\n", ring.slot_size);
+
+  /* netfilter capture points, also module-wide */
+  if (nf_hooks >= 0) {
+    uint32_t mask = (uint32_t)nf_hooks;
+    DEBUG_LOG("netfilter hooks 0x%x\n", mask);
+    if (ioctl(fd, MYRING_IOC_SET_NF_HOOKS, &mask) != 0) perror("SET_NF_HOOKS");
+  }
+
+  /* kernel capture-to-file: the module consumes this ring from now on */
+  if (capture) {
+    struct myring_capture cap = { 0 };
+    if (strcmp(capture, "-") != 0) {
+      unsigned long long rotate_mb = 0;
+      char *colon = strchr(capture, ':');
+      size_t n = colon ? (size_t)(colon - capture) : strlen(capture);
+      if (n >= sizeof(cap.path)) { ERROR_LOG("capture path too long\n"); return 2; }
+      memcpy(cap.path, capture, n);
+      if (colon) sscanf(colon + 1, "%llu:%u", &rotate_mb, &cap.max_files);
+      cap.rotate_bytes = rotate_mb << 20;
+    }
+    if (ioctl(fd, MYRING_IOC_CAPTURE, &cap) != 0) { perror("CAPTURE"); return 1; }
+    if (cap.path[0])
+      printf("capturing %s to %s.N (rotate %" PRIu64 " MB, %u files)\n", dev, cap.path,
+             (uint64_t)(cap.rotate_bytes >> 20), cap.max_files);
+    else
+      printf("capture stopped: %" PRIu64 " bytes in %u files, error %d\n",
+             (uint64_t)cap.bytes, cap.files, cap.error);
+    myring_consumer_close(&ring);
+    return 0;
+  }
+
   /* optionally change the rate */
-  if (argc > 1) {
-    uint32_t new_rate = (uint32_t)atoi(argv[1]);
+  if (optind < argc) {
+    uint32_t new_rate = (uint32_t)atoi(argv[optind]);
     if (new_rate > 0) {
       DEBUG_LOG("setting new rate to %u Hz\n", new_rate);
       if (ioctl(fd, MYRING_IOC_SET_RATE, &new_rate) != 0) {
@@ -152,28 +485,18 @@ int main(int argc, char **argv)
   if (efd < 0) { perror("eventfd"); return 1; }
   if (ioctl(fd, MYRING_IOC_SET_EVENTFD, &efd) != 0) { perror("IOCTL_SET_EVENTFD"); }
 
-
-  /* Try a simple ioctl first to see if the device is working */
-  DEBUG_LOG("testing device with GET_CONFIG ioctl...\n");
-  struct myring_config test_cfg;
-  int ioctl_ret = ioctl(fd, MYRING_IOC_GET_CONFIG, &test_cfg);
-  if (ioctl_ret != 0) {
-    ERROR_LOG("GET_CONFIG ioctl failed: %s (errno=%d)\n", strerror(errno), errno);
-    ERROR_LOG("This suggests the kernel module is not properly loaded or compatible\n");
-    ERROR_LOG("Check: dmesg | grep myring\n");
-    return 1;
+  /* commit and notify stamps for the latency breakdown */
+  if (breakdown) {
+    if (myring_consumer_set_stamps(&ring, true) != 0) {
+      perror("SET_STAMPS");
+    } else {
+      myring_breakdown_init(&bd, &ring);
+      cs.bd = &bd;
+    }
   }
-  DEBUG_LOG("ioctl works, ring_order=%u, rate_hz=%u\n", test_cfg.ring_order, test_cfg.rate_hz);
-
-  /* mmap */
-  void *map = mmap(NULL, DEFAULT_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-  if (map == MAP_FAILED) { perror("mmap"); return 1; }
 
-  struct myring_ctrl *ctrl = (struct myring_ctrl *)map;
-  uint8_t *data = (uint8_t*)map + PAGE_SIZE;
-  uint64_t size = ctrl->size; /* provided by kernel */
-
-  DEBUG_LOG("mapped ctrl@%p data@%p size=%" PRIu64 " bytes\n", (void*)ctrl, (void*)data, size);
+  DEBUG_LOG("mapped ctrl@%p data@%p size=%" PRIu64 " bytes\n",
+            (void*)ring.ctrl, (void*)ring.data, ring.size);
 
 
   /* epoll on eventfd */
@@ -182,161 +505,113 @@ int main(int argc, char **argv)
   struct epoll_event ev = { .events = EPOLLIN, .data.fd = efd };
   if (epoll_ctl(ep, EPOLL_CTL_ADD, efd, &ev) != 0) { perror("epoll_ctl"); return 1; }
 
-  uint64_t total_packets = 0, total_drops = 0;
-  uint64_t total_bytes = 0;
-  struct timespec start_time, current_time;
-  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  /* real-time consumer thread */
+  if (policy != SCHED_OTHER) {
+    if (myring_set_sched(policy, prio, runtime_us * 1000, period_us * 1000) != 0) {
+      ERROR_LOG("sched_setattr(policy=%d) failed: %s\n", policy, strerror(errno));
+      return 1;
+    }
+    DEBUG_LOG("consumer running as %s (prio=%d runtime=%" PRIu64 "us period=%" PRIu64 "us)\n",
+              policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_DEADLINE", prio, runtime_us, period_us);
+  }
+
+  cs.ring = &ring;
+  struct timespec current_time;
+  clock_gettime(CLOCK_MONOTONIC, &cs.start_time);
+  uint64_t report_at = mono_ns() + (uint64_t)interval_ms * 1000000ull;
 
-  for (;;) {
+  while (!cs.stop) {
     struct epoll_event out;
-    int n = epoll_wait(ep, &out, 1, -1);
+    int timeout = -1;
+    if (cs.sketch) {
+      uint64_t now = mono_ns();
+      if (now >= report_at) {
+        sketch_report(&cs, topk);
+        myring_sketch_reset(cs.sketch);
+        report_at = now + (uint64_t)interval_ms * 1000000ull;
+      }
+      timeout = (int)((report_at - now + 999999) / 1000000);
+    }
+    int n = epoll_wait(ep, &out, 1, timeout);
     if (n < 0) {
       if (errno == EINTR) continue;
       perror("epoll_wait");
       break;
     }
+    if (n == 0) continue;
+    MYRING_PROBE(wakeup, &ring, n);
+    if (cs.bd) myring_breakdown_wake(cs.bd, &ring, mono_ns());
     /* drain eventfd */
     uint64_t tick;
     if (read(efd, &tick, sizeof(tick)) < 0 && errno != EAGAIN) perror("read eventfd");
 
-    /* consume records until tail == head or we drop below lo% */
-    for (;;) {
-      uint64_t head = load_acquire_u64_packed(&ctrl->head);
-      uint64_t tail = load_acquire_u64_packed(&ctrl->tail);
-      if (tail == head) break;
-
-      /* data region is a power-of-two ring */
-      uint64_t mask = size - 1;
-      uint64_t off = tail & mask;
-      /* peek header (may wrap) */
-      struct myring_rec_hdr hdr;
-      size_t first = (size - off) < sizeof(hdr) ? (size - off) : sizeof(hdr);
-      memcpy(&hdr, data + off, first);
-      if (first < sizeof(hdr)) {
-        memcpy(((uint8_t*)&hdr)+first, data, sizeof(hdr) - first);
-      }
-      uint64_t reclen = sizeof(hdr) + hdr.len;
-
-      /* now copy the whole record to a temp buffer and parse */
-      uint8_t *tmp = malloc(reclen);
-      if (!tmp) { fprintf(stderr, "oom\n"); exit(1); }
-      first = (size - off) < reclen ? (size - off) : reclen;
-      memcpy(tmp, data + off, first);
-      if (first < reclen) memcpy(tmp + first, data, reclen - first);
-
-      /* parse */
-      struct myring_rec_hdr *rh = (struct myring_rec_hdr*)tmp;
-      uint8_t *payload = tmp + sizeof(*rh);
-
-      if (rh->type == REC_TYPE_PKT) {
-        total_packets++;
-        total_bytes += rh->len;
-        
-        /* Detailed packet consumption diagnostics */
-        DEBUG_LOG("[CONSUME] Packet #%" PRIu64 ": ts=%" PRIu64 " len=%" PRIu32 "\n",
-               total_packets, rh->ts_ns, rh->len);
-        DEBUG_LOG("[CONSUME] Ring state: head=%" PRIu64 " tail=%" PRIu64 " used=%" PRIu64 "\n",
-               head, tail, head - tail);
-        DEBUG_LOG("[CONSUME] Record position: tail_offset=%" PRIu64 " record_len=%" PRIu64 "\n",
-               tail & (size - 1), reclen);
-        DEBUG_LOG("[CONSUME] Memory: ring_size=%" PRIu64 " wrap=%s\n",
-               size, (first < reclen) ? "YES" : "NO");
-        
-        /* Show first 16 bytes of payload for diagnostics */
-        if (rh->len >= 8) {
-          uint64_t *payload_u64 = (uint64_t*)payload;
-          DEBUG_LOG("[CONSUME] Payload first 8 bytes: 0x%016" PRIx64 "\n", *payload_u64);
-        }
-        
-        /* Show detailed hexdump for first few packets */
-        if (total_packets <= 5) {
-          DEBUG_LOG("[CONSUME] Full hexdump for packet #%" PRIu64 ":\n", total_packets);
-          hexdump(payload, rh->len, rh->len); /* Show full packet for first 5 */
-        } else {
-          hexdump(payload, rh->len, 32); /* Truncated for others */
-        }
-        
-        /* Print progress every 10 packets */
-        if (total_packets % 10 == 0) {
-          clock_gettime(CLOCK_MONOTONIC, &current_time);
-          double elapsed = (current_time.tv_sec - start_time.tv_sec) + 
-                          (current_time.tv_nsec - start_time.tv_nsec) / 1e9;
-          double rate_pps = elapsed > 0 ? total_packets / elapsed : 0;
-          double rate_bps = elapsed > 0 ? total_bytes / elapsed : 0;
-          
-          printf("\n=== PROGRESS ===\n");
-          printf("Packets: %" PRIu64 ", Bytes: %" PRIu64 " (%.2f KB, %.2f MB)\n", 
-                 total_packets, total_bytes, total_bytes / 1024.0, total_bytes / (1024.0 * 1024.0));
-          printf("Elapsed: %.2fs, Rate: %.1f pps, %.2f KB/s\n", 
-                 elapsed, rate_pps, rate_bps / 1024.0);
-          printf("Drops: %" PRIu64 "\n", total_drops);
-          printf("Ring utilization: %.1f%% (%" PRIu64 "/%" PRIu64 ")\n", 
-                 size > 0 ? (100.0 * (head - tail)) / size : 0.0, head - tail, size);
-          printf("================\n\n");
-        }
-      } else if (rh->type == REC_TYPE_DROP) {
-        struct myring_rec_drop *dr = (struct myring_rec_drop*)payload;
-        total_drops += dr->lost;
-        DEBUG_LOG("** DROP ** lost=%" PRIu32 "  start=%" PRIu64 " end=%" PRIu64 "  (total lost=%" PRIu64 ")\n",
-               dr->lost, dr->start_ns, dr->end_ns, total_drops);
-      } else {
-        DEBUG_LOG("[unknown type=0x%x] len=%" PRIu32 "\n", rh->type, rh->len);
-      }
-
-      free(tmp);
+    /* consume records until tail == head or a handler asks to stop */
+    cs.head = myring_load_acquire(&ring.ctrl->head);
+    uint64_t old_tail = ring.tail;
+    if (drain_records(&ring, &cs, 0) < 0) {
+      ERROR_LOG("record decode failed at tail=%" PRIu64 ": %s\n", ring.tail, strerror(errno));
+      break;  /* the same record would fail again on every wakeup */
+    }
 
-      /* advance tail */
-      uint64_t new_tail = tail + reclen;
-      uint64_t old_tail = tail;
-      
+    /* advance tail once for the whole batch */
+    if (!cs.quiet)
       DEBUG_LOG("[ADVANCE] Advancing tail: %" PRIu64 " -> %" PRIu64 " (delta=%" PRIu64 ")\n",
-             old_tail, new_tail, reclen);
-      
-      struct myring_advance adv = { .new_tail = new_tail };
-      if (ioctl(fd, MYRING_IOC_ADVANCE_TAIL, &adv) != 0) { 
-        ERROR_LOG("ADVANCE_TAIL ioctl failed: %s (errno=%d)\n", strerror(errno), errno);
-        ERROR_LOG("Failed to advance tail from %" PRIu64 " to %" PRIu64 "\n", old_tail, new_tail);
-        perror("ADVANCE_TAIL"); 
-        break; 
-      }
-      
-      DEBUG_LOG("[ADVANCE] Tail successfully advanced, record consumed\n");
-
-
-      /* optional: stop early demonstration */
-      if (total_packets >= 100) { 
-        DEBUG_LOG("stopping after %"PRIu64" packets\n", total_packets);
-        break;
-      }
-    }
-    
-    /* show final stats */
-    clock_gettime(CLOCK_MONOTONIC, &current_time);
-    double total_elapsed = (current_time.tv_sec - start_time.tv_sec) + 
-                          (current_time.tv_nsec - start_time.tv_nsec) / 1e9;
-    
-    struct myring_stats stats;
-    if (ioctl(fd, MYRING_IOC_GET_STATS, &stats) == 0) {
-      DEBUG_LOG("\nFinal stats: head=%"PRIu64" tail=%"PRIu64" records=%"PRIu64" drops=%"PRIu64" bytes=%"PRIu64"\n",
-             stats.head, stats.tail, stats.records, stats.drops, stats.bytes);
-    }
-    
-    printf("\n=== FINAL SUMMARY ===\n");
-    printf("Total Runtime: %.2f seconds\n", total_elapsed);
-    printf("Packets Processed: %" PRIu64 "\n", total_packets);
-    printf("Bytes Processed: %" PRIu64 " (%.2f KB, %.2f MB)\n", 
-           total_bytes, total_bytes / 1024.0, total_bytes / (1024.0 * 1024.0));
-    if (total_elapsed > 0) {
-      printf("Average Rate: %.1f packets/sec, %.2f KB/sec\n", 
-             total_packets / total_elapsed, (total_bytes / 1024.0) / total_elapsed);
+             old_tail, ring.tail, ring.tail - old_tail);
+    if (myring_consumer_commit(&ring) != 0) {
+      ERROR_LOG("ADVANCE_TAIL ioctl failed: %s (errno=%d)\n", strerror(errno), errno);
+      ERROR_LOG("Failed to advance tail from %" PRIu64 " to %" PRIu64 "\n", old_tail, ring.tail);
+      break;
+    } else if (!cs.quiet) {
+      DEBUG_LOG("[ADVANCE] Tail successfully advanced, records consumed\n");
     }
-    printf("Total Drops: %" PRIu64 "\n", total_drops);
-    printf("====================\n");
-    break;
+  }
+
+  /* show final stats */
+  clock_gettime(CLOCK_MONOTONIC, &current_time);
+  double total_elapsed = (current_time.tv_sec - cs.start_time.tv_sec) + 
+                        (current_time.tv_nsec - cs.start_time.tv_nsec) / 1e9;
+  
+  struct myring_stats stats;
+  if (ioctl(fd, MYRING_IOC_GET_STATS, &stats) == 0) {
+    DEBUG_LOG("\nFinal stats: head=%"PRIu64" tail=%"PRIu64" records=%"PRIu64" drops=%"PRIu64" bytes=%"PRIu64"\n",
+           stats.head, stats.tail, stats.records, stats.drops, stats.bytes);
   }
   
-  munmap(map, DEFAULT_MAP_SIZE);
+  printf("\n=== FINAL SUMMARY ===\n");
+  printf("Total Runtime: %.2f seconds\n", total_elapsed);
+  printf("Packets Processed: %" PRIu64 "\n", cs.total_packets);
+  printf("Bytes Processed: %" PRIu64 " (%.2f KB, %.2f MB)\n", 
+         cs.total_bytes, cs.total_bytes / 1024.0, cs.total_bytes / (1024.0 * 1024.0));
+  if (total_elapsed > 0) {
+    printf("Average Rate: %.1f packets/sec, %.2f KB/sec\n", 
+           cs.total_packets / total_elapsed, (cs.total_bytes / 1024.0) / total_elapsed);
+  }
+  printf("Total Drops: %" PRIu64 "\n", cs.total_drops);
+  printf("Latency (ts_ns -> consume): p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+         myring_hist_pct(&cs.lat, 50) / 1e3, myring_hist_pct(&cs.lat, 99) / 1e3,
+         myring_hist_pct(&cs.lat, 99.9) / 1e3, cs.lat.max / 1e3);
+  if (cs.urgent_lat.count)
+    printf("Urgent records (%" PRIu64 "):    p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+           cs.urgent_lat.count, myring_hist_pct(&cs.urgent_lat, 50) / 1e3,
+           myring_hist_pct(&cs.urgent_lat, 99) / 1e3, myring_hist_pct(&cs.urgent_lat, 99.9) / 1e3,
+           cs.urgent_lat.max / 1e3);
+  if (cs.bd) {
+    printf("Latency breakdown (%" PRIu64 " records matched, %" PRIu64 " skipped without a commit stamp):\n",
+           cs.bd->matched, cs.bd->skipped);
+    print_stage("queue", &cs.bd->queue);
+    print_stage("notify", &cs.bd->notify);
+    print_stage("wakeup", &cs.bd->wakeup);
+    print_stage("process", &cs.bd->process);
+    print_stage("total", &cs.bd->total);
+    myring_consumer_set_stamps(&ring, false);
+  }
+  printf("====================\n");
+  if (cs.sketch) {
+    if (cs.sketch->total) sketch_report(&cs, topk);
+    myring_sketch_free(cs.sketch);
+  }
+
   close(efd);
-  close(fd);
+  myring_consumer_close(&ring);
   return 0;
 }
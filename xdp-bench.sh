@@ -0,0 +1,93 @@
+#!/usr/bin/env bash
+# myring ingest path comparison: netfilter vs. tc ingress vs. XDP
+# A veth pair carries pktgen traffic from netns "mrgen" (mr1) to mr0 in the
+# root namespace, where each capture path is attached in turn. pktgen and the
+# receive softirq share one CPU, so the per-packet cost of a capture path is
+# 1e9/pps minus the no-capture baseline. A consumer drains the ring so the
+# numbers include the copy, not just the drop path.
+#
+# Usage: ./xdp-bench.sh [packets] [pkt_size]
+# Needs: root, pktgen, iproute2 with libbpf, clang + bpftool (make bpf)
+
+set -e
+
+COUNT="${1:-2000000}"
+SIZE="${2:-128}"
+NS=mrgen
+CPU=0
+
+echo "=== MyRing ingest path benchmark ==="
+echo "$(date): packets=${COUNT} size=${SIZE}"
+
+make user
+make bpf
+modprobe pktgen
+
+cleanup() {
+    kill "${CONS_PID:-}" 2>/dev/null || true
+    ip link del mr0 2>/dev/null || true
+    ip netns del "${NS}" 2>/dev/null || true
+    lsmod | grep -q '^myring' && rmmod myring || true
+}
+trap cleanup EXIT
+
+ip netns add "${NS}"
+ip link add mr0 type veth peer name mr1 netns "${NS}"
+ip addr add 10.77.0.1/24 dev mr0
+ip link set mr0 up
+ip -n "${NS}" addr add 10.77.0.2/24 dev mr1
+ip -n "${NS}" link set mr1 up
+# veth native XDP on mr0 needs the peer's frames to go through NAPI
+ethtool -K mr0 gro on >/dev/null 2>&1 || true
+DST_MAC=$(cat /sys/class/net/mr0/address)
+
+pg() { echo "$2" | ip netns exec "${NS}" tee "/proc/net/pktgen/$1" >/dev/null; }
+
+# pps of one pktgen run on ${CPU}
+run_pktgen() {
+    pg "kpktgend_${CPU}" "rem_device_all"
+    pg "kpktgend_${CPU}" "add_device mr1"
+    pg mr1 "count ${COUNT}"
+    pg mr1 "pkt_size ${SIZE}"
+    pg mr1 "delay 0"
+    pg mr1 "dst 10.77.0.1"
+    pg mr1 "dst_mac ${DST_MAC}"
+    pg mr1 "udp_dst_min 9"
+    pg mr1 "udp_dst_max 9"
+    pg pgctrl "start"
+    ip netns exec "${NS}" grep -o '[0-9]*pps' /proc/net/pktgen/mr1 | tr -d pps
+}
+
+# name | module defines | attach | detach
+BASE_NS=""
+run_case() {
+    local name="$1" defs="$2" attach="$3" detach="$4"
+    lsmod | grep -q '^myring' && rmmod myring
+    make clean >/dev/null && make MYRING_DEFS="${defs}" >/dev/null && make user bpf >/dev/null
+    insmod build/myring.ko rate_hz=1 nf_snaplen="${SIZE}" 2>/dev/null \
+        || insmod build/myring.ko rate_hz=1
+    eval "${attach}"
+    ./build/user -q -n 1000000000000 >/dev/null 2>&1 &
+    CONS_PID=$!
+    sleep 0.5
+    local pps ns
+    pps=$(run_pktgen)
+    ns=$(awk -v p="${pps}" 'BEGIN { printf "%.1f", 1e9 / p }')
+    [ -z "${BASE_NS}" ] && BASE_NS="${ns}"
+    printf "%-14s %10s pps  %7s ns/pkt  %+7.1f ns vs. baseline\n" \
+        "${name}" "${pps}" "${ns}" "$(awk -v a="${ns}" -v b="${BASE_NS}" 'BEGIN { print a - b }')"
+    kill "${CONS_PID}" 2>/dev/null || true
+    wait "${CONS_PID}" 2>/dev/null || true
+    eval "${detach}"
+}
+
+OBJ=build/myring_xdp.bpf.o
+run_case "baseline"    ""                 ":" ":"
+run_case "netfilter"   "-DUSE_NETFILTER"  ":" ":"
+run_case "tc ingress"  "-DUSE_BPF_KFUNC" \
+    "tc qdisc add dev mr0 clsact && tc filter add dev mr0 ingress bpf da obj ${OBJ} sec tc" \
+    "tc qdisc del dev mr0 clsact"
+run_case "xdp generic" "-DUSE_BPF_KFUNC" \
+    "ip link set dev mr0 xdpgeneric obj ${OBJ} sec xdp" "ip link set dev mr0 xdpgeneric off"
+run_case "xdp native"  "-DUSE_BPF_KFUNC" \
+    "ip link set dev mr0 xdpdrv obj ${OBJ} sec xdp" "ip link set dev mr0 xdpdrv off"